@@ -0,0 +1,163 @@
+#include <math.h>
+#include <string.h>
+
+#include "arrival_gen.h"
+
+static const char* pattern_names[] = {"uniform", "poisson", "rush", "conflict"};
+
+
+bool parse_pattern(const char* name, Pattern* pattern)
+{
+  for (int i = 0; i <= CONFLICT_PATTERN; i++)
+  {
+    if (strcmp(name, pattern_names[i]) == 0)
+    {
+      *pattern = i;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+const char* pattern_name(Pattern pattern)
+{
+  return pattern_names[pattern];
+}
+
+
+/*
+ * next_random(ArrivalGenerator* generator)
+ *
+ * get the next number of the random state of the generator, like random()
+ */
+static int next_random(ArrivalGenerator* generator)
+{
+  int32_t value;
+  random_r(&generator->random, &value);
+  return value;
+}
+
+
+/*
+ * random_unit(ArrivalGenerator* generator)
+ *
+ * get a uniformly distributed random number in (0, 1]
+ */
+static double random_unit(ArrivalGenerator* generator)
+{
+  return (next_random(generator) + 1.0) / ((double)RAND_MAX + 1.0);
+}
+
+
+/*
+ * rush_weight(const Topology* topology, int light)
+ *
+ * get the relative number of cars on the lane of the light during rush hour:
+ *   most cars go straight from the north and south, fewer turn there, and few come from the east and west
+ * in a loaded topology the north and south are the approaches 0 and 2, and straight is lane 1
+ */
+static int rush_weight(const Topology* topology, int light)
+{
+  if (topology->lights[light].side == NORTH || topology->lights[light].side == SOUTH)
+  {
+    return topology->lights[light].direction == STRAIGHT ? 8 : 4;
+  }
+  return 1;
+}
+
+
+/*
+ * find_conflict_lanes(ArrivalGenerator* generator)
+ *
+ * fill conflict_lanes with a large group of lights that all conflict with each other,
+ *   starting with the lights whose paths cross the most sections
+ */
+static void find_conflict_lanes(ArrivalGenerator* generator)
+{
+  const Topology* topology = generator->topology;
+  bool used[MAX_LIGHTS] = {false};
+  generator->num_conflict_lanes = 0;
+  while (true)
+  {
+    int pick = -1;
+    for (int i = 0; i < topology->num_lights; i++)
+    {
+      bool conflicts = !used[i];
+      for (int j = 0; j < generator->num_conflict_lanes && conflicts; j++)
+      {
+        conflicts = (topology->lights[i].sections & topology->lights[generator->conflict_lanes[j]].sections) != 0;
+      }
+      if (conflicts && (pick < 0 || __builtin_popcount(topology->lights[i].sections) > __builtin_popcount(topology->lights[pick].sections)))
+      {
+        pick = i;
+      }
+    }
+    if (pick < 0)
+    {
+      return;
+    }
+    used[pick] = true;
+    generator->conflict_lanes[generator->num_conflict_lanes] = pick;
+    generator->num_conflict_lanes += 1;
+  }
+}
+
+
+/*
+ * pick_lane(ArrivalGenerator* generator)
+ *
+ * get the index in topology->lights[] for the next car
+ */
+static int pick_lane(ArrivalGenerator* generator)
+{
+  const Topology* topology = generator->topology;
+  if (generator->pattern == CONFLICT_PATTERN)
+  {
+    return generator->conflict_lanes[next_random(generator) % generator->num_conflict_lanes];
+  }
+  if (generator->pattern != RUSH_PATTERN)
+  {
+    return next_random(generator) % topology->num_lights;
+  }
+  int total = 0;
+  for (int i = 0; i < topology->num_lights; i++)
+  {
+    total += rush_weight(topology, i);
+  }
+  int pick = next_random(generator) % total;
+  for (int i = 0; i < topology->num_lights; i++)
+  {
+    if (pick < rush_weight(topology, i))
+    {
+      return i;
+    }
+    pick -= rush_weight(topology, i);
+  }
+  return topology->num_lights - 1;
+}
+
+
+void init_generator(ArrivalGenerator* generator, const Topology* topology, Pattern pattern, double rate, unsigned int seed)
+{
+  generator->topology = topology;
+  generator->pattern = pattern;
+  generator->rate = rate;
+  generator->time = 0;
+  generator->next_id = 0;
+  // a state of 128 bytes gives the same numbers as srandom(seed) and random()
+  memset(&generator->random, 0, sizeof(generator->random));
+  initstate_r(seed, generator->random_state, sizeof(generator->random_state), &generator->random);
+  find_conflict_lanes(generator);
+}
+
+
+Arrival generate_arrival(ArrivalGenerator* generator)
+{
+  int lane = pick_lane(generator);
+  const Light* light = &generator->topology->lights[lane];
+  Arrival arrival = {generator->next_id++, light->side, light->direction, (int)generator->time};
+  // the time until the next arrival
+  generator->time += generator->pattern == UNIFORM_PATTERN ? 1.0 / generator->rate : -log(random_unit(generator)) / generator->rate;
+  return arrival;
+}
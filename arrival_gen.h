@@ -0,0 +1,66 @@
+#ifndef ARRIVAL_GEN_H
+#define ARRIVAL_GEN_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "arrivals.h"
+#include "topology.h"
+
+/*
+ * Pattern
+ *
+ * How synthetic arrivals are spread over the lanes and in time:
+ * UNIFORM_PATTERN: every lane is equally likely, cars arrive evenly spread at the given rate
+ * POISSON_PATTERN: every lane is equally likely, exponentially distributed times between arrivals
+ * RUSH_PATTERN: poisson arrivals, but most cars come from the north and south
+ * CONFLICT_PATTERN: poisson arrivals on the lanes whose paths all cross each other, the worst case
+ */
+typedef enum {UNIFORM_PATTERN, POISSON_PATTERN, RUSH_PATTERN, CONFLICT_PATTERN} Pattern;
+
+/*
+ * parse_pattern(const char* name, Pattern* pattern), pattern_name(Pattern pattern)
+ *
+ * convert between a pattern and its name: uniform, poisson, rush or conflict
+ * parse_pattern returns false for an unknown name
+ */
+bool parse_pattern(const char* name, Pattern* pattern);
+const char* pattern_name(Pattern pattern);
+
+/*
+ * ArrivalGenerator
+ *
+ * A generator of synthetic arrivals with its own random state, so several can run in different threads
+ * The same pattern, rate and seed always give the same trace
+ * conflict_lanes[]: indices in topology->lights[] of lights that all share a section with each other,
+ *   so only one of them can ever be green
+ */
+typedef struct
+{
+  const Topology* topology;
+  Pattern pattern;
+  double rate;
+  double time;
+  int next_id;
+  int conflict_lanes[MAX_LIGHTS];
+  int num_conflict_lanes;
+  struct random_data random;
+  char random_state[128];
+} ArrivalGenerator;
+
+/*
+ * init_generator(ArrivalGenerator* generator, const Topology* topology, Pattern pattern, double rate, unsigned int seed)
+ *
+ * start a trace of arrivals for the topology, which has to stay valid while the generator is used,
+ *   with rate the mean number of cars arriving per second
+ */
+void init_generator(ArrivalGenerator* generator, const Topology* topology, Pattern pattern, double rate, unsigned int seed);
+
+/*
+ * generate_arrival(ArrivalGenerator* generator)
+ *
+ * get the next arrival of the trace, the ids count up from 0
+ */
+Arrival generate_arrival(ArrivalGenerator* generator);
+
+#endif
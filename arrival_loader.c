@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "arrival_loader.h"
+#include "arrival_stream.h"
+#include "log.h"
+
+
+struct ArrivalLoader
+{
+  // text traces
+  FILE* file;
+  char* line;
+  size_t line_size;
+  long line_number;
+  // binary traces and compiled in arrays, packed holds the records of a binary trace of ARRIVAL_VERSION
+  const Arrival* records;
+  const PackedArrival* packed;
+  size_t num_records;
+  size_t next_record;
+  void* mapping;
+  size_t mapping_size;
+  // live arrivals, with the time the last one was received
+  ArrivalStream* stream;
+  long long received;
+  // the time of the previous arrival, traces have to be ordered by time
+  int last_time;
+  // of the arrivals returned so far
+  TraceFingerprint fingerprint;
+};
+
+
+static ArrivalLoader* new_loader()
+{
+  ArrivalLoader* loader = calloc(1, sizeof(ArrivalLoader));
+  if (loader == NULL)
+  {
+    log_error("(Loader):\t Out of memory\n");
+    return NULL;
+  }
+  loader->received = -1;
+  // the offset basis of FNV-1a
+  loader->fingerprint.hash = 0xcbf29ce484222325ULL;
+  return loader;
+}
+
+
+/*
+ * map_binary(ArrivalLoader* loader, int fd, const char* path)
+ *
+ * memory map a binary trace
+ * returns 1 when it was mapped, 0 when the file is not a binary trace and -1 when it is an invalid one
+ */
+static int map_binary(ArrivalLoader* loader, int fd, const char* path)
+{
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < sizeof(ArrivalHeader))
+  {
+    return 0;
+  }
+  void* mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (mapping == MAP_FAILED)
+  {
+    return 0;
+  }
+  const ArrivalHeader* header = mapping;
+  if (memcmp(header->magic, ARRIVAL_MAGIC, sizeof(header->magic)) != 0)
+  {
+    munmap(mapping, st.st_size);
+    return 0;
+  }
+  size_t record_size = header->version == ARRIVAL_VERSION ? sizeof(PackedArrival) : sizeof(Arrival);
+  if ((header->version != ARRIVAL_VERSION && header->version != 1) || (st.st_size - sizeof(ArrivalHeader)) % record_size != 0)
+  {
+    log_error("(Loader):\t %s: unsupported binary trace (version %u, %lld bytes)\n", path, header->version, (long long)st.st_size);
+    munmap(mapping, st.st_size);
+    return -1;
+  }
+  // the trace is read once from front to back
+  madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+  loader->mapping = mapping;
+  loader->mapping_size = st.st_size;
+  const void* records = (const char*)mapping + sizeof(ArrivalHeader);
+  if (header->version == ARRIVAL_VERSION)
+  {
+    loader->packed = records;
+  }
+  else
+  {
+    loader->records = records;
+  }
+  loader->num_records = (st.st_size - sizeof(ArrivalHeader)) / record_size;
+  return 1;
+}
+
+
+ArrivalLoader* open_arrivals(const char* path)
+{
+  ArrivalLoader* loader = new_loader();
+  if (loader == NULL)
+  {
+    return NULL;
+  }
+  if (strcmp(path, "-") == 0)
+  {
+    loader->file = stdin;
+    return loader;
+  }
+  if (is_stream_address(path))
+  {
+    if ((loader->stream = open_stream(path)) == NULL)
+    {
+      free(loader);
+      return NULL;
+    }
+    return loader;
+  }
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+  {
+    perror(path);
+    free(loader);
+    return NULL;
+  }
+  int mapped = map_binary(loader, fd, path);
+  if (mapped != 0)
+  {
+    // the mapping stays valid after closing the file
+    close(fd);
+    if (mapped < 0)
+    {
+      free(loader);
+      return NULL;
+    }
+    return loader;
+  }
+  if ((loader->file = fdopen(fd, "r")) != NULL)
+  {
+    return loader;
+  }
+  perror(path);
+  close(fd);
+  free(loader);
+  return NULL;
+}
+
+
+ArrivalLoader* open_arrivals_array(const Arrival* arrivals, size_t count)
+{
+  ArrivalLoader* loader = new_loader();
+  if (loader != NULL)
+  {
+    loader->records = arrivals;
+    loader->num_records = count;
+  }
+  return loader;
+}
+
+
+bool pack_arrival(const Arrival* arrival, PackedArrival* packed)
+{
+  if (arrival->time < 0 || arrival->time >= 1 << PACKED_TIME_BITS || arrival->side < 0 || arrival->side >= 1 << PACKED_LANE_BITS
+    || arrival->direction < 0 || arrival->direction >= 1 << PACKED_LANE_BITS)
+  {
+    return false;
+  }
+  packed->id = arrival->id;
+  packed->time_lane = (uint32_t)arrival->time << (2 * PACKED_LANE_BITS) | (uint32_t)arrival->side << PACKED_LANE_BITS | arrival->direction;
+  return true;
+}
+
+
+/*
+ * check_arrival(ArrivalLoader* loader, const Arrival* arrival, long position)
+ *
+ * returns whether the arrival is valid and not earlier than the previous one
+ */
+static bool check_arrival(ArrivalLoader* loader, const Arrival* arrival, long position)
+{
+  // whether the intersection has a light for the lane is up to its topology
+  if (arrival->side < 0 || arrival->direction < 0)
+  {
+    log_error("(Loader):\t Arrival %ld: invalid lane %d / %d\n", position, arrival->side, arrival->direction);
+    return false;
+  }
+  if (arrival->time < loader->last_time)
+  {
+    log_error("(Loader):\t Arrival %ld: time %d is before the previous arrival at %d\n", position, arrival->time, loader->last_time);
+    return false;
+  }
+  loader->last_time = arrival->time;
+  // FNV-1a over the fields, so the fingerprint does not depend on the padding or the format of the trace
+  int32_t fields[] = {arrival->id, arrival->side, arrival->direction, arrival->time};
+  const unsigned char* bytes = (const unsigned char*)fields;
+  for (size_t i = 0; i < sizeof(fields); i++)
+  {
+    loader->fingerprint.hash = (loader->fingerprint.hash ^ bytes[i]) * 0x100000001b3ULL;
+  }
+  loader->fingerprint.num_arrivals += 1;
+  return true;
+}
+
+
+bool next_arrival(ArrivalLoader* loader, Arrival* arrival)
+{
+  if (loader->stream != NULL)
+  {
+    // the stream skips what it cannot deliver, so it never fails the checks
+    return next_stream_arrival(loader->stream, arrival, &loader->received) && check_arrival(loader, arrival, 0);
+  }
+  if (loader->file == NULL)
+  {
+    if (loader->next_record >= loader->num_records)
+    {
+      return false;
+    }
+    if (loader->packed != NULL)
+    {
+      PackedArrival packed = loader->packed[loader->next_record];
+      arrival->id = packed.id;
+      arrival->time = packed.time_lane >> (2 * PACKED_LANE_BITS);
+      arrival->side = (packed.time_lane >> PACKED_LANE_BITS) & ((1u << PACKED_LANE_BITS) - 1);
+      arrival->direction = packed.time_lane & ((1u << PACKED_LANE_BITS) - 1);
+    }
+    else
+    {
+      *arrival = loader->records[loader->next_record];
+    }
+    loader->next_record += 1;
+    return check_arrival(loader, arrival, loader->next_record);
+  }
+
+  while (getline(&loader->line, &loader->line_size, loader->file) >= 0)
+  {
+    loader->line_number += 1;
+    char* line = loader->line;
+    while (*line == ' ' || *line == '\t')
+    {
+      line++;
+    }
+    if (*line == '#' || *line == '\n' || *line == '\r' || *line == '\0')
+    {
+      continue;
+    }
+    int side, direction;
+    if (sscanf(line, "%d %d %d %d", &arrival->id, &side, &direction, &arrival->time) != 4)
+    {
+      log_error("(Loader):\t Line %ld: expected \"id side direction time\"\n", loader->line_number);
+      return false;
+    }
+    arrival->side = side;
+    arrival->direction = direction;
+    return check_arrival(loader, arrival, loader->line_number);
+  }
+  return false;
+}
+
+
+void arrival_fingerprint(const ArrivalLoader* loader, TraceFingerprint* fingerprint)
+{
+  *fingerprint = loader->fingerprint;
+}
+
+
+long long arrival_received(const ArrivalLoader* loader)
+{
+  return loader->received;
+}
+
+
+void close_arrivals(ArrivalLoader* loader)
+{
+  if (loader->stream != NULL)
+  {
+    close_stream(loader->stream);
+  }
+  if (loader->file != NULL && loader->file != stdin)
+  {
+    fclose(loader->file);
+  }
+  if (loader->mapping != NULL)
+  {
+    munmap(loader->mapping, loader->mapping_size);
+  }
+  free(loader->line);
+  free(loader);
+}
@@ -0,0 +1,113 @@
+#ifndef ARRIVAL_LOADER_H
+#define ARRIVAL_LOADER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arrivals.h"
+
+/*
+ * Binary trace files start with this header, followed by PackedArrival records
+ * Traces of version 1, with Arrival records of 16 bytes, are still read
+ */
+#define ARRIVAL_MAGIC "ARRV"
+#define ARRIVAL_VERSION 2
+
+typedef struct
+{
+  char magic[4];          // ARRIVAL_MAGIC, not null terminated
+  uint32_t version;       // ARRIVAL_VERSION
+} ArrivalHeader;
+
+/*
+ * PackedArrival
+ *
+ * An arrival in 8 bytes, half of an Arrival, so that traces of millions of cars take half the disk and page cache
+ * time_lane holds the time in its upper PACKED_TIME_BITS bits, then 4 bits each for the side and the direction
+ */
+#define PACKED_TIME_BITS 24
+#define PACKED_LANE_BITS 4
+
+typedef struct
+{
+  int32_t id;
+  uint32_t time_lane;
+} PackedArrival;
+
+/*
+ * pack_arrival(const Arrival* arrival, PackedArrival* packed)
+ *
+ * store the arrival in a record of a binary trace
+ * returns false when it does not fit: a time of 2^24 seconds (194 days) or more, or a side or direction of 16 or more
+ */
+bool pack_arrival(const Arrival* arrival, PackedArrival* packed);
+
+/*
+ * ArrivalLoader
+ *
+ * A source of arrivals, read one at a time so a trace never has to be held in memory as a whole
+ */
+typedef struct ArrivalLoader ArrivalLoader;
+
+/*
+ * TraceFingerprint
+ *
+ * The number of arrivals a loader returned, and a 64-bit FNV-1a hash of them, to tell whether two runs had the same trace
+ */
+typedef struct
+{
+  uint64_t num_arrivals;
+  uint64_t hash;
+} TraceFingerprint;
+
+/*
+ * open_arrivals(const char* path)
+ *
+ * open a trace of arrivals, or stdin when path is "-", or live arrivals (see ArrivalStream)
+ *   received on tcp:[host]:port, udp:[host]:port or unix:path
+ * a file that starts with ArrivalHeader is memory mapped as binary records,
+ *   otherwise it is read as text with one arrival "id side direction time" per line,
+ *   where empty lines and lines starting with '#' are ignored
+ * returns NULL (and prints the reason) when the trace cannot be opened
+ */
+ArrivalLoader* open_arrivals(const char* path);
+
+/*
+ * open_arrivals_array(const Arrival* arrivals, size_t count)
+ *
+ * use an array of arrivals that is compiled into the program as a trace
+ */
+ArrivalLoader* open_arrivals_array(const Arrival* arrivals, size_t count);
+
+/*
+ * next_arrival(ArrivalLoader* loader, Arrival* arrival)
+ *
+ * store the next arrival of the trace in arrival
+ * returns false at the end of the trace, or when the trace is malformed (the reason is printed)
+ */
+bool next_arrival(ArrivalLoader* loader, Arrival* arrival);
+
+/*
+ * arrival_received(const ArrivalLoader* loader)
+ *
+ * returns the CLOCK_MONOTONIC time in nanoseconds at which the last arrival returned by next_arrival
+ *   was received from a stream, or -1 when the arrivals are not live
+ */
+long long arrival_received(const ArrivalLoader* loader);
+
+/*
+ * arrival_fingerprint(const ArrivalLoader* loader, TraceFingerprint* fingerprint)
+ *
+ * store the fingerprint of the arrivals that next_arrival returned so far, of the whole trace once it returned false
+ */
+void arrival_fingerprint(const ArrivalLoader* loader, TraceFingerprint* fingerprint);
+
+/*
+ * close_arrivals(ArrivalLoader* loader)
+ *
+ * close the trace and free the loader
+ */
+void close_arrivals(ArrivalLoader* loader);
+
+#endif
@@ -0,0 +1,400 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "arrival_stream.h"
+#include "sockets.h"
+#include "log.h"
+
+// the bytes buffered per connection, which is read at once and holds the lines that are not complete yet
+#define STREAM_BUFFER 65536
+// the most sockets handled per wake-up
+#define STREAM_EVENTS 64
+// the most datagrams received per wake-up, and the largest datagram
+#define STREAM_DATAGRAMS 64
+#define DATAGRAM_SIZE 2048
+
+/*
+ * Connection
+ *
+ * A connection to a stream socket, with the bytes received after its last complete line
+ * index: its index in the connections of the stream
+ */
+typedef struct
+{
+  int fd;
+  size_t index;
+  size_t length;
+  char buffer[STREAM_BUFFER];
+} Connection;
+
+/*
+ * ReceivedArrival
+ *
+ * An arrival that was received and not returned yet, with the time it was received at
+ */
+typedef struct
+{
+  Arrival arrival;
+  long long received;
+} ReceivedArrival;
+
+/*
+ * ArrivalStream
+ *
+ * listener: the socket of the address, a stream socket accepting connections or a datagram socket
+ * epoll: waits for the listener and every connection at once, the listener has no Connection as data
+ * connections[]: the open connections of a stream socket
+ * arrivals[]: a ring of the arrivals received and not returned yet, from first on, count of them
+ * datagrams: the buffers the datagrams of a wake-up are received in
+ * last_time: the time of the last arrival returned, later ones are not delivered before it
+ */
+struct ArrivalStream
+{
+  int type;
+  int listener;
+  int epoll;
+  char* path;
+  Connection** connections;
+  size_t num_connections;
+  size_t connections_capacity;
+  bool ended;
+  ReceivedArrival* arrivals;
+  size_t first;
+  size_t count;
+  size_t capacity;
+  char (*datagrams)[DATAGRAM_SIZE];
+  int last_time;
+};
+
+
+bool is_stream_address(const char* address)
+{
+  return strncmp(address, "tcp:", 4) == 0 || strncmp(address, "udp:", 4) == 0 || strncmp(address, "unix:", 5) == 0;
+}
+
+
+/*
+ * monotonic_ns()
+ *
+ * get the CLOCK_MONOTONIC time in nanoseconds
+ */
+static long long monotonic_ns()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+
+ArrivalStream* open_stream(const char* address)
+{
+  ArrivalStream* stream = calloc(1, sizeof(ArrivalStream));
+  if (stream == NULL)
+  {
+    log_error("(Stream):\t Out of memory\n");
+    return NULL;
+  }
+  stream->type = strncmp(address, "udp:", 4) == 0 ? SOCK_DGRAM : SOCK_STREAM;
+  stream->listener = open_listener(strchr(address, ':') + 1, stream->type, "(Stream)", &stream->path);
+  stream->epoll = epoll_create1(EPOLL_CLOEXEC);
+  if (stream->type == SOCK_DGRAM)
+  {
+    stream->datagrams = malloc(STREAM_DATAGRAMS * DATAGRAM_SIZE);
+  }
+  struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+  if (stream->listener < 0 || stream->epoll < 0 || (stream->type == SOCK_DGRAM && stream->datagrams == NULL)
+    || epoll_ctl(stream->epoll, EPOLL_CTL_ADD, stream->listener, &event) != 0)
+  {
+    if (stream->listener >= 0)
+    {
+      log_error("(Stream):\t Cannot wait for %s: %s\n", address, strerror(errno));
+    }
+    close_stream(stream);
+    return NULL;
+  }
+  log_info("(Stream):\t Receiving arrivals on %s\n", address);
+  return stream;
+}
+
+
+/*
+ * add_arrival(ArrivalStream* stream, char* line, long long received)
+ *
+ * parse a line that was received at the time received, and add the arrival to the ring
+ * empty lines and lines starting with '#' are ignored like in a text trace, malformed lines are logged
+ */
+static void add_arrival(ArrivalStream* stream, char* line, long long received)
+{
+  while (*line == ' ' || *line == '\t')
+  {
+    line++;
+  }
+  if (*line == '#' || *line == '\r' || *line == '\0')
+  {
+    return;
+  }
+  Arrival arrival;
+  int side, direction;
+  if (sscanf(line, "%d %d %d %d", &arrival.id, &side, &direction, &arrival.time) != 4 || side < 0 || direction < 0)
+  {
+    log_error("(Stream):\t Skipping \"%.64s\", expected \"id side direction time\"\n", line);
+    return;
+  }
+  arrival.side = side;
+  arrival.direction = direction;
+  if (stream->count == stream->capacity)
+  {
+    // unroll the ring into the larger one
+    size_t capacity = stream->capacity == 0 ? 1024 : stream->capacity * 2;
+    ReceivedArrival* arrivals = malloc(capacity * sizeof(ReceivedArrival));
+    if (arrivals == NULL)
+    {
+      log_error("(Stream):\t Out of memory, dropping car %d\n", arrival.id);
+      return;
+    }
+    for (size_t i = 0; i < stream->count; i++)
+    {
+      arrivals[i] = stream->arrivals[(stream->first + i) % stream->capacity];
+    }
+    free(stream->arrivals);
+    stream->arrivals = arrivals;
+    stream->first = 0;
+    stream->capacity = capacity;
+  }
+  stream->arrivals[(stream->first + stream->count) % stream->capacity] = (ReceivedArrival){arrival, received};
+  stream->count++;
+}
+
+
+/*
+ * add_lines(ArrivalStream* stream, char* data, size_t length, bool complete, long long received)
+ *
+ * add the arrivals of the lines in the data, when complete the last line needs no newline
+ * returns the number of bytes of complete lines
+ */
+static size_t add_lines(ArrivalStream* stream, char* data, size_t length, bool complete, long long received)
+{
+  size_t start = 0;
+  for (size_t i = 0; i < length; i++)
+  {
+    if (data[i] == '\n')
+    {
+      data[i] = '\0';
+      add_arrival(stream, data + start, received);
+      start = i + 1;
+    }
+  }
+  if (complete && start < length)
+  {
+    data[length] = '\0';
+    add_arrival(stream, data + start, received);
+    start = length;
+  }
+  return start;
+}
+
+
+/*
+ * close_connection(ArrivalStream* stream, Connection* connection)
+ *
+ * close the connection and remove it from the stream, which ends with the last one
+ */
+static void close_connection(ArrivalStream* stream, Connection* connection)
+{
+  close(connection->fd);
+  Connection* last = stream->connections[--stream->num_connections];
+  stream->connections[connection->index] = last;
+  last->index = connection->index;
+  free(connection);
+  if (stream->num_connections == 0)
+  {
+    log_info("(Stream):\t The last connection closed, the stream ends\n");
+    stream->ended = true;
+  }
+}
+
+
+/*
+ * accept_connection(ArrivalStream* stream)
+ *
+ * accept a connection on the listener and wait for it with the others
+ */
+static void accept_connection(ArrivalStream* stream)
+{
+  int fd = accept4(stream->listener, NULL, NULL, SOCK_CLOEXEC);
+  if (fd < 0)
+  {
+    return;
+  }
+  if (stream->num_connections == stream->connections_capacity)
+  {
+    size_t capacity = stream->connections_capacity == 0 ? 16 : stream->connections_capacity * 2;
+    Connection** connections = realloc(stream->connections, capacity * sizeof(Connection*));
+    if (connections == NULL)
+    {
+      log_error("(Stream):\t Out of memory, refusing a connection\n");
+      close(fd);
+      return;
+    }
+    stream->connections = connections;
+    stream->connections_capacity = capacity;
+  }
+  Connection* connection = malloc(sizeof(Connection));
+  struct epoll_event event = {.events = EPOLLIN, .data.ptr = connection};
+  if (connection == NULL || epoll_ctl(stream->epoll, EPOLL_CTL_ADD, fd, &event) != 0)
+  {
+    log_error("(Stream):\t Cannot take a connection: %s\n", connection == NULL ? "out of memory" : strerror(errno));
+    free(connection);
+    close(fd);
+    return;
+  }
+  connection->fd = fd;
+  connection->length = 0;
+  connection->index = stream->num_connections;
+  stream->connections[stream->num_connections++] = connection;
+}
+
+
+/*
+ * read_connection(ArrivalStream* stream, Connection* connection)
+ *
+ * read what fits in the buffer of the connection and add its complete lines,
+ *   closing the connection at its end, on an error or on a line longer than the buffer
+ */
+static void read_connection(ArrivalStream* stream, Connection* connection)
+{
+  ssize_t received = read(connection->fd, connection->buffer + connection->length, STREAM_BUFFER - 1 - connection->length);
+  if (received < 0 && (errno == EINTR || errno == EAGAIN))
+  {
+    return;
+  }
+  if (received <= 0)
+  {
+    // the last line of a connection needs no newline
+    add_lines(stream, connection->buffer, connection->length, true, monotonic_ns());
+    close_connection(stream, connection);
+    return;
+  }
+  connection->length += received;
+  size_t used = add_lines(stream, connection->buffer, connection->length, false, monotonic_ns());
+  memmove(connection->buffer, connection->buffer + used, connection->length - used);
+  connection->length -= used;
+  if (connection->length == STREAM_BUFFER - 1)
+  {
+    log_error("(Stream):\t A line is longer than %d bytes, closing its connection\n", STREAM_BUFFER - 1);
+    close_connection(stream, connection);
+  }
+}
+
+
+/*
+ * receive_datagrams(ArrivalStream* stream)
+ *
+ * receive the datagrams that have arrived with a single call and add their lines, an empty one ends the stream
+ */
+static void receive_datagrams(ArrivalStream* stream)
+{
+  struct mmsghdr messages[STREAM_DATAGRAMS];
+  struct iovec buffers[STREAM_DATAGRAMS];
+  memset(messages, 0, sizeof(messages));
+  for (int i = 0; i < STREAM_DATAGRAMS; i++)
+  {
+    // one byte is kept for the terminating null
+    buffers[i] = (struct iovec){stream->datagrams[i], DATAGRAM_SIZE - 1};
+    messages[i].msg_hdr.msg_iov = &buffers[i];
+    messages[i].msg_hdr.msg_iovlen = 1;
+  }
+  int count = recvmmsg(stream->listener, messages, STREAM_DATAGRAMS, MSG_DONTWAIT, NULL);
+  long long received = monotonic_ns();
+  for (int i = 0; i < count; i++)
+  {
+    if (messages[i].msg_len == 0)
+    {
+      log_info("(Stream):\t Received an empty datagram, the stream ends\n");
+      stream->ended = true;
+      continue;
+    }
+    add_lines(stream, stream->datagrams[i], messages[i].msg_len, true, received);
+  }
+}
+
+
+bool next_stream_arrival(ArrivalStream* stream, Arrival* arrival, long long* received)
+{
+  while (stream->count == 0)
+  {
+    if (stream->ended)
+    {
+      return false;
+    }
+    // take everything that arrived on any socket by the time of the wake-up
+    struct epoll_event events[STREAM_EVENTS];
+    int count = epoll_wait(stream->epoll, events, STREAM_EVENTS, -1);
+    if (count < 0 && errno != EINTR)
+    {
+      log_error("(Stream):\t Cannot wait for arrivals: %s\n", strerror(errno));
+      return false;
+    }
+    for (int i = 0; i < count; i++)
+    {
+      if (events[i].data.ptr != NULL)
+      {
+        read_connection(stream, events[i].data.ptr);
+      }
+      else if (stream->type == SOCK_DGRAM)
+      {
+        receive_datagrams(stream);
+      }
+      else
+      {
+        accept_connection(stream);
+      }
+    }
+  }
+  ReceivedArrival* next = &stream->arrivals[stream->first];
+  stream->first = (stream->first + 1) % stream->capacity;
+  stream->count--;
+  *arrival = next->arrival;
+  *received = next->received;
+  if (arrival->time < stream->last_time)
+  {
+    arrival->time = stream->last_time;
+  }
+  stream->last_time = arrival->time;
+  return true;
+}
+
+
+void close_stream(ArrivalStream* stream)
+{
+  for (size_t i = 0; i < stream->num_connections; i++)
+  {
+    close(stream->connections[i]->fd);
+    free(stream->connections[i]);
+  }
+  if (stream->listener >= 0)
+  {
+    close(stream->listener);
+  }
+  if (stream->epoll >= 0)
+  {
+    close(stream->epoll);
+  }
+  if (stream->path != NULL)
+  {
+    unlink(stream->path);
+    free(stream->path);
+  }
+  free(stream->connections);
+  free(stream->arrivals);
+  free(stream->datagrams);
+  free(stream);
+}
@@ -0,0 +1,51 @@
+#ifndef ARRIVAL_STREAM_H
+#define ARRIVAL_STREAM_H
+
+#include <stdbool.h>
+
+#include "arrivals.h"
+
+/*
+ * ArrivalStream
+ *
+ * Live arrivals from detectors, as text lines "id side direction time" like a text trace, received on a socket
+ * A stream socket (TCP or Unix) accepts any number of connections, a datagram socket (UDP) takes datagrams
+ *   of one or more lines from any number of senders, and all of them are read by the thread that reads the stream,
+ *   waiting for all of them at once with epoll, and reading everything that has arrived at every wake-up
+ * A stream ends once every connection that was opened is closed again, or with an empty datagram
+ */
+typedef struct ArrivalStream ArrivalStream;
+
+/*
+ * is_stream_address(const char* address)
+ *
+ * returns whether the address names a socket to receive arrivals on: tcp:[host]:port, udp:[host]:port or unix:path
+ */
+bool is_stream_address(const char* address);
+
+/*
+ * open_stream(const char* address)
+ *
+ * listen for arrivals on the socket of the address
+ * returns NULL (and logs the reason) when the address cannot be listened on
+ */
+ArrivalStream* open_stream(const char* address);
+
+/*
+ * next_stream_arrival(ArrivalStream* stream, Arrival* arrival, long long* received)
+ *
+ * wait for the next arrival, store it and the CLOCK_MONOTONIC time in nanoseconds at which it was received
+ * lines that are malformed are logged and skipped, an arrival whose time is before that of the previous one
+ *   is delivered at the time of the previous one, as the detectors do not share a clock
+ * returns false at the end of the stream
+ */
+bool next_stream_arrival(ArrivalStream* stream, Arrival* arrival, long long* received);
+
+/*
+ * close_stream(ArrivalStream* stream)
+ *
+ * close every connection and the socket, and free the stream
+ */
+void close_stream(ArrivalStream* stream);
+
+#endif
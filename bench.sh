@@ -0,0 +1,30 @@
+#!/bin/bash
+#
+#  Runs synthetic traces through the intersection in virtual time and reports
+#  the throughput, the wait times per lane and the CPU time per light thread
+#
+#  The settings can be changed through the environment, for example:
+#    BENCH_CARS=1000000 make bench
+#
+CARS=${BENCH_CARS:-100000}
+RATE=${BENCH_RATE:-1.5}
+CROSS_TIME=${BENCH_CROSS_TIME:-1}
+SEED=${BENCH_SEED:-1}
+PATTERNS=${BENCH_PATTERNS:-"uniform poisson rush conflict"}
+ENGINE=${BENCH_ENGINE:-threads}
+
+TRACES=$(mktemp -d)
+trap 'rm -rf "$TRACES"' EXIT
+
+for pattern in $PATTERNS
+do
+  # the conflicting lanes can only pass one car at a time
+  rate=$RATE
+  if [ "$pattern" = conflict ]
+  then
+    rate=$(awk "BEGIN {print $RATE / 4}")
+  fi
+  echo "== $pattern: $CARS cars, $rate cars/s, cross time $CROSS_TIME s, $ENGINE engine"
+  ./gen_arrivals -p "$pattern" -n "$CARS" -r "$rate" -s "$SEED" -o "$TRACES/$pattern.trace" || exit 1
+  ./intersection -v -l 0 -S -e "$ENGINE" -c "$CROSS_TIME" "$TRACES/$pattern.trace" 2>&1 >/dev/null | sed 's/^(Stats):\t //' || exit 1
+done
@@ -0,0 +1,7 @@
+#ifndef CACHE_LINE_H
+#define CACHE_LINE_H
+
+// the size of a cache line, state that different threads write is aligned to it so that they do not share cache lines
+#define CACHE_LINE_SIZE 64
+
+#endif
@@ -24,4 +24,5 @@ LIBS="-lpthread"
 #  valgrind : debugging memory and profiling
 #  gprof : call graph execution profiler
 #
-$CC $CFLAGS -o intersection intersection.c intersection_time.c $LIBS
+$CC $CFLAGS -o gen_conflicts gen_conflicts.c topology.c log.c $LIBS && ./gen_conflicts > conflicts.h || exit 1
+$CC $CFLAGS -o intersection main.c intersection.c topology.c network.c thread_pool.c intersection_time.c arrival_loader.c arrival_stream.c sockets.c grant_log.c metrics.c placement.c lane_queue.c lock_profile.c log.c output.c stats.c $LIBS
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "arrivals.h"
+#include "arrival_gen.h"
+#include "arrival_loader.h"
+#include "lights.h"
+#include "topology.h"
+
+/*
+ * gen_arrivals
+ *
+ * Generates synthetic traces of arrivals for benchmarking the intersection, in one of the patterns of arrival_gen.h
+ */
+
+/*
+ * topology
+ *
+ * The layout of the intersection the trace is for, loaded with -t or the default geometry from lights.h
+ */
+static Topology topology;
+
+
+static void usage(const char* program)
+{
+  fprintf(stderr, "usage: %s [-p pattern] [-n cars] [-r rate] [-s seed] [-t topology] [-o output]\n", program);
+  fprintf(stderr, "  -p pattern  uniform, poisson, rush or conflict (default poisson)\n");
+  fprintf(stderr, "  -n cars     the number of cars (default 1000)\n");
+  fprintf(stderr, "  -r rate     the mean number of cars arriving per second (default 1)\n");
+  fprintf(stderr, "  -s seed     the seed of the random generator (default 1)\n");
+  fprintf(stderr, "  -t topology file describing the lanes and lights of the intersection (default: lights.h)\n");
+  fprintf(stderr, "  -o output   write a binary trace to the output file instead of text to stdout\n");
+}
+
+
+int main(int argc, char* argv[])
+{
+  Pattern pattern = POISSON_PATTERN;
+  long cars = 1000;
+  double rate = 1.0;
+  unsigned int seed = 1;
+  const char* output = NULL;
+  const char* topology_file = NULL;
+
+  int option;
+  while ((option = getopt(argc, argv, "p:n:r:s:t:o:h")) != -1)
+  {
+    switch (option)
+    {
+      case 'p':
+        if (!parse_pattern(optarg, &pattern))
+        {
+          fprintf(stderr, "Unknown pattern %s\n", optarg);
+          return 1;
+        }
+        break;
+      case 'n':
+        cars = atol(optarg);
+        break;
+      case 'r':
+        rate = atof(optarg);
+        break;
+      case 's':
+        seed = (unsigned int)atol(optarg);
+        break;
+      case 't':
+        topology_file = optarg;
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return option == 'h' ? 0 : 1;
+    }
+  }
+  if (cars < 0 || rate <= 0)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+  bool topology_loaded = topology_file != NULL
+    ? load_topology(&topology, topology_file)
+    : init_topology(&topology, DEFAULT_APPROACHES, DEFAULT_LANES, DEFAULT_SECTIONS, default_lights, NUM_DEFAULT_LIGHTS, NULL);
+  if (!topology_loaded)
+  {
+    return 1;
+  }
+  ArrivalGenerator generator;
+  init_generator(&generator, &topology, pattern, rate, seed);
+
+  FILE* out = stdout;
+  if (output != NULL)
+  {
+    out = fopen(output, "wb");
+    if (out == NULL)
+    {
+      perror(output);
+      return 1;
+    }
+    ArrivalHeader header = {ARRIVAL_MAGIC, ARRIVAL_VERSION};
+    fwrite(&header, sizeof(header), 1, out);
+  }
+
+  for (long id = 0; id < cars; id++)
+  {
+    Arrival arrival = generate_arrival(&generator);
+    if (output != NULL)
+    {
+      PackedArrival packed;
+      if (!pack_arrival(&arrival, &packed))
+      {
+        fprintf(stderr, "Car %d at t%d does not fit a binary trace, write it as text instead\n", arrival.id, arrival.time);
+        fclose(out);
+        remove(output);
+        return 1;
+      }
+      fwrite(&packed, sizeof(packed), 1, out);
+    }
+    else
+    {
+      fprintf(out, "%d %d %d %d\n", arrival.id, arrival.side, arrival.direction, arrival.time);
+    }
+  }
+
+  if (fclose(out) != 0)
+  {
+    perror(output != NULL ? output : "stdout");
+    return 1;
+  }
+  free_topology(&topology);
+  return 0;
+}
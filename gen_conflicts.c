@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lights.h"
+#include "topology.h"
+
+/*
+ * gen_conflicts
+ *
+ * Generates conflicts.h from the default geometry in lights.h, with:
+ * - default_compatible_lights[]: the compatibility matrix, as a row of bits per light
+ * - default_maximal_groups[]: every group of lights that can be green together and that no other light can join
+ * - default_best_groups[]: for every set of lights that want to turn green (bit i for default_lights[i]),
+ *     the largest group of them that can be green together
+ * so that the engines can decide which lights to turn green with a single table lookup
+ * The tables are computed by init_topology, the same code that computes them for a topology loaded at startup
+ */
+
+#if NUM_DEFAULT_LIGHTS > MAX_TABLE_LIGHTS
+#error "default_best_groups[] has 2^NUM_DEFAULT_LIGHTS entries, which is too large for more than MAX_TABLE_LIGHTS lights"
+#endif
+
+
+int main()
+{
+  Topology topology;
+  if (!init_topology(&topology, DEFAULT_APPROACHES, DEFAULT_LANES, DEFAULT_SECTIONS, default_lights, NUM_DEFAULT_LIGHTS, NULL))
+  {
+    return 1;
+  }
+  const TopologyTables* tables = &topology.tables;
+
+  printf("#ifndef CONFLICTS_H\n#define CONFLICTS_H\n\n");
+  printf("// generated by gen_conflicts from lights.h, do not edit\n\n");
+  printf("#include <stdint.h>\n\n#include \"lights.h\"\n#include \"topology.h\"\n\n");
+
+  printf("// default_compatible_lights[i] has bit j set when default_lights[i] and default_lights[j] can be green at the same time\n");
+  printf("static const uint32_t default_compatible_lights[NUM_DEFAULT_LIGHTS] =\n{\n");
+  for (int i = 0; i < NUM_DEFAULT_LIGHTS; i++)
+  {
+    printf("  0x%03x,\n", tables->compatible[i]);
+  }
+  printf("};\n\n");
+
+  printf("// the groups of lights that can be green together, and that no other light can join\n");
+  printf("#define NUM_DEFAULT_MAXIMAL_GROUPS %d\n\n", tables->num_maximal_groups);
+  printf("static const uint32_t default_maximal_groups[NUM_DEFAULT_MAXIMAL_GROUPS] =\n{\n");
+  for (int i = 0; i < tables->num_maximal_groups; i++)
+  {
+    printf("  0x%03x,\n", tables->maximal_groups[i]);
+  }
+  printf("};\n\n");
+
+  printf("// default_best_groups[set] is the largest group out of the lights in set that can be green together\n");
+  printf("static const uint16_t default_best_groups[1 << NUM_DEFAULT_LIGHTS] =\n{");
+  for (uint32_t set = 0; set < (1u << NUM_DEFAULT_LIGHTS); set++)
+  {
+    printf("%s0x%03x,", set % 8 == 0 ? "\n  " : " ", tables->best_groups[set]);
+  }
+  printf("\n};\n\n");
+
+  printf("// the tables of the default geometry, for init_topology\n");
+  printf("static const TopologyTables default_tables =\n{\n");
+  printf("  default_compatible_lights, default_maximal_groups, NUM_DEFAULT_MAXIMAL_GROUPS, default_best_groups\n};\n\n");
+  printf("#endif\n");
+
+  free_topology(&topology);
+  return 0;
+}
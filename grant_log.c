@@ -0,0 +1,372 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "grant_log.h"
+#include "lock_profile.h"
+#include "log.h"
+
+/*
+ * Grant
+ *
+ * One grant to a traffic light, at time in microseconds since the start
+ */
+typedef struct
+{
+  uint8_t light;
+  uint8_t kind;
+  long long time;
+} Grant;
+
+/*
+ * GrantLog
+ *
+ * grants[]: the recorded grants, appended under lock (between begin_grant and end_grant) while recording
+ * truncated: set when recording ran out of memory, later grants are not recorded
+ * next: while replaying, the index of the grant that is next, only advanced by the light that takes it
+ * diverged: while replaying, the first grant that was taken at another time than recorded, or -1
+ * abandoned: the grant at which the replay was stopped because the run did not follow the recording, or -1
+ */
+struct GrantLog
+{
+  const char* path;
+  bool replaying;
+  GrantSettings settings;
+  TraceFingerprint trace;
+  bool check_times;
+  pthread_mutex_t lock;
+  Grant* grants;
+  size_t num_grants;
+  size_t capacity;
+  bool truncated;
+  _Atomic size_t next;
+  long long diverged;
+  long long diverged_by;
+  long long abandoned;
+};
+
+
+static GrantLog* new_grant_log(const char* path, bool replaying)
+{
+  GrantLog* log = calloc(1, sizeof(GrantLog));
+  if (log == NULL)
+  {
+    log_error("(Grants):\t Out of memory\n");
+    return NULL;
+  }
+  log->path = path;
+  log->replaying = replaying;
+  log->diverged = -1;
+  log->abandoned = -1;
+  atomic_init(&log->next, 0);
+  pthread_mutex_init(&log->lock, NULL);
+  return log;
+}
+
+
+static void free_grant_log(GrantLog* log)
+{
+  pthread_mutex_destroy(&log->lock);
+  free(log->grants);
+  free(log);
+}
+
+
+GrantLog* record_grants(const char* path)
+{
+  return new_grant_log(path, false);
+}
+
+
+/*
+ * read_varint(FILE* in, uint64_t* value)
+ *
+ * read an unsigned LEB128 number, returns false at the end of the file or on a malformed number
+ */
+static bool read_varint(FILE* in, uint64_t* value)
+{
+  *value = 0;
+  for (int shift = 0; shift < 64; shift += 7)
+  {
+    int byte = fgetc(in);
+    if (byte == EOF)
+    {
+      return false;
+    }
+    *value |= (uint64_t)(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+GrantLog* replay_grants(const char* path)
+{
+  FILE* in = fopen(path, "rb");
+  if (in == NULL)
+  {
+    perror(path);
+    return NULL;
+  }
+  GrantLogHeader header;
+  if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, GRANT_LOG_MAGIC, sizeof(header.magic)) != 0
+    || header.version != GRANT_LOG_VERSION)
+  {
+    log_error("(Grants):\t %s is not a grant log of version %d\n", path, GRANT_LOG_VERSION);
+    fclose(in);
+    return NULL;
+  }
+  GrantLog* log = new_grant_log(path, true);
+  if (log == NULL)
+  {
+    fclose(in);
+    return NULL;
+  }
+  log->settings = header.settings;
+  log->trace = header.trace;
+  log->grants = malloc(header.num_grants * sizeof(Grant) + 1);
+  if (log->grants == NULL)
+  {
+    log_error("(Grants):\t Out of memory\n");
+    free_grant_log(log);
+    fclose(in);
+    return NULL;
+  }
+  long long time = 0;
+  for (uint64_t i = 0; i < header.num_grants; i++)
+  {
+    int byte = fgetc(in);
+    uint64_t delta;
+    if (byte == EOF || !read_varint(in, &delta) || (byte & 0x1f) >= header.settings.num_lights || (byte >> 5) > GRANT_RELEASE)
+    {
+      log_error("(Grants):\t %s: grant %lu of %lu is malformed\n", path, (unsigned long)i, (unsigned long)header.num_grants);
+      free_grant_log(log);
+      fclose(in);
+      return NULL;
+    }
+    time += delta;
+    log->grants[i] = (Grant){byte & 0x1f, byte >> 5, time};
+  }
+  log->num_grants = header.num_grants;
+  log->capacity = header.num_grants;
+  fclose(in);
+  return log;
+}
+
+
+bool use_grant_settings(GrantLog* log, const GrantSettings* settings)
+{
+  if (!log->replaying)
+  {
+    log->settings = *settings;
+    return true;
+  }
+  GrantSettings recorded = log->settings;
+  log->check_times = recorded.virtual_time && settings->virtual_time;
+  recorded.virtual_time = settings->virtual_time;
+  if (memcmp(&recorded, settings, sizeof(GrantSettings)) != 0)
+  {
+    log_error("(Grants):\t %s was recorded with other settings: %d lights, cross time %d, policy %d, max wait %d, platoon %d:%d\n",
+      log->path, recorded.num_lights, recorded.cross_time, recorded.policy, recorded.max_wait, recorded.platoon, recorded.platoon_wait);
+    return false;
+  }
+  return true;
+}
+
+
+bool use_grant_trace(GrantLog* log, const TraceFingerprint* trace)
+{
+  if (!log->replaying)
+  {
+    log->trace = *trace;
+    return true;
+  }
+  if (log->trace.num_arrivals != trace->num_arrivals || log->trace.hash != trace->hash)
+  {
+    log_error("(Grants):\t %s was recorded with another trace of %lu arrivals (hash %016lx), this one has %lu (hash %016lx)\n",
+      log->path, (unsigned long)log->trace.num_arrivals, (unsigned long)log->trace.hash,
+      (unsigned long)trace->num_arrivals, (unsigned long)trace->hash);
+    return false;
+  }
+  return true;
+}
+
+
+int next_grant(GrantLog* log, GrantKind* kind, long long* time)
+{
+  if (!log->replaying)
+  {
+    return -1;
+  }
+  size_t next = atomic_load_explicit(&log->next, memory_order_acquire);
+  if (next >= log->num_grants)
+  {
+    return -1;
+  }
+  *kind = log->grants[next].kind;
+  *time = log->check_times ? log->grants[next].time * 1000 : -1;
+  return log->grants[next].light;
+}
+
+
+void begin_grant(GrantLog* log)
+{
+  if (!log->replaying)
+  {
+    lock_mutex(&log->lock, "grant log");
+  }
+}
+
+
+void end_grant(GrantLog* log)
+{
+  if (!log->replaying)
+  {
+    unlock_mutex(&log->lock);
+  }
+}
+
+
+int add_grant(GrantLog* log, int light, GrantKind kind, long long time)
+{
+  time /= 1000;
+  if (log->replaying)
+  {
+    // only the light that has the grant advances next, so nobody else writes it
+    size_t next = atomic_load_explicit(&log->next, memory_order_relaxed);
+    if (next >= log->num_grants)
+    {
+      return -1;
+    }
+    if (log->check_times && log->diverged < 0 && log->grants[next].time != time)
+    {
+      log->diverged = next;
+      log->diverged_by = time - log->grants[next].time;
+    }
+    atomic_store_explicit(&log->next, next + 1, memory_order_release);
+    return next + 1 < log->num_grants ? log->grants[next + 1].light : -1;
+  }
+
+  if (log->truncated)
+  {
+    return -1;
+  }
+  if (log->num_grants == log->capacity)
+  {
+    size_t capacity = log->capacity == 0 ? 1024 : log->capacity * 2;
+    Grant* grants = realloc(log->grants, capacity * sizeof(Grant));
+    if (grants == NULL)
+    {
+      log_error("(Grants):\t Out of memory, the recording stops at grant %zu\n", log->num_grants);
+      log->truncated = true;
+      return -1;
+    }
+    log->grants = grants;
+    log->capacity = capacity;
+  }
+  // in real time a light may read the time just before one that takes its grant first, the times never go back
+  long long last = log->num_grants > 0 ? log->grants[log->num_grants - 1].time : 0;
+  log->grants[log->num_grants++] = (Grant){light, kind, time > last ? time : last};
+  return -1;
+}
+
+
+void abandon_replay(GrantLog* log, int light, GrantKind kind)
+{
+  size_t next = atomic_load_explicit(&log->next, memory_order_relaxed);
+  if (next >= log->num_grants)
+  {
+    // another light stopped the replay first
+    return;
+  }
+  static const char* kinds[] = {"claim", "keep", "release"};
+  if (light < 0)
+  {
+    log_error("(Grants):\t Light %d has no car left to %s its sections as in %s, the run no longer follows the recording\n",
+      log->grants[next].light, kinds[log->grants[next].kind], log->path);
+  }
+  else
+  {
+    log_error("(Grants):\t Light %d wants to %s its sections where %s has light %d %s them, the run no longer follows the recording\n",
+      light, kinds[kind], log->path, log->grants[next].light, kinds[log->grants[next].kind]);
+  }
+  log->abandoned = next;
+  atomic_store_explicit(&log->next, log->num_grants, memory_order_release);
+}
+
+
+/*
+ * write_varint(FILE* out, uint64_t value)
+ *
+ * write a number as unsigned LEB128, 7 bits per byte with the high bit set on all but the last byte
+ */
+static void write_varint(FILE* out, uint64_t value)
+{
+  while (value >= 0x80)
+  {
+    fputc((int)(value & 0x7f) | 0x80, out);
+    value >>= 7;
+  }
+  fputc((int)value, out);
+}
+
+
+bool close_grant_log(GrantLog* log)
+{
+  bool ok = true;
+  if (log->replaying)
+  {
+    size_t replayed = log->abandoned >= 0 ? (size_t)log->abandoned : atomic_load(&log->next);
+    if (replayed < log->num_grants)
+    {
+      log_error("(Grants):\t Replayed %zu of %zu grants of %s\n", replayed, log->num_grants, log->path);
+      ok = false;
+    }
+    else if (log->diverged >= 0)
+    {
+      log_error("(Grants):\t Replayed %zu grants of %s, from grant %lld on %.6f s off the recorded times\n",
+        log->num_grants, log->path, log->diverged, log->diverged_by / 1e6);
+      ok = false;
+    }
+    else
+    {
+      log_info("(Grants):\t Replayed %zu grants of %s\n", log->num_grants, log->path);
+    }
+    free_grant_log(log);
+    return ok;
+  }
+
+  FILE* out = fopen(log->path, "wb");
+  if (out == NULL)
+  {
+    perror(log->path);
+    free_grant_log(log);
+    return false;
+  }
+  GrantLogHeader header = {GRANT_LOG_MAGIC, GRANT_LOG_VERSION, log->num_grants, log->settings, log->trace};
+  fwrite(&header, sizeof(header), 1, out);
+  long long time = 0;
+  for (size_t i = 0; i < log->num_grants; i++)
+  {
+    const Grant* grant = &log->grants[i];
+    fputc(grant->kind << 5 | grant->light, out);
+    write_varint(out, grant->time - time);
+    time = grant->time;
+  }
+  if (ferror(out) | (fclose(out) != 0))
+  {
+    log_error("(Grants):\t Cannot write the grants to %s\n", log->path);
+    ok = false;
+  }
+  else
+  {
+    log_info("(Grants):\t %zu grants recorded in %s\n", log->num_grants, log->path);
+  }
+  free_grant_log(log);
+  return ok;
+}
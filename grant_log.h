@@ -0,0 +1,139 @@
+#ifndef GRANT_LOG_H
+#define GRANT_LOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "arrival_loader.h"
+
+/*
+ * GrantKind
+ *
+ * What a traffic light of the threaded engine was granted, each grant is also the light change it printed:
+ * GRANT_CLAIM: it claimed its sections for the car at the front of its lane and turned green
+ * GRANT_KEEP: being green with a platoon, it kept its sections and turned green for the next car of its lane
+ * GRANT_RELEASE: it turned red and released its sections
+ */
+typedef enum {GRANT_CLAIM = 0, GRANT_KEEP = 1, GRANT_RELEASE = 2} GrantKind;
+
+/*
+ * Grant logs start with this header, followed by the grants
+ * Every grant is a byte with the kind in bits 5 and 6 and the light in bits 0 to 4,
+ *   followed by the time in microseconds since the previous grant as an unsigned LEB128 number
+ */
+#define GRANT_LOG_MAGIC "GRNT"
+#define GRANT_LOG_VERSION 2
+
+/*
+ * GrantSettings
+ *
+ * The settings of the intersection that decide which grants can happen, a replay needs the same ones
+ * virtual_time is not compared, a recording can be replayed in real time, the times are then not checked
+ */
+typedef struct
+{
+  int32_t num_lights;
+  int32_t cross_time;
+  int32_t policy;
+  int32_t max_wait;
+  int32_t platoon;
+  int32_t platoon_wait;
+  int32_t virtual_time;
+} GrantSettings;
+
+typedef struct
+{
+  char magic[4];          // GRANT_LOG_MAGIC, not null terminated
+  uint32_t version;       // GRANT_LOG_VERSION
+  uint64_t num_grants;
+  GrantSettings settings;
+  TraceFingerprint trace;  // of the trace that was recorded, a replay of another trace cannot follow the grants
+} GrantLogHeader;
+
+/*
+ * GrantLog
+ *
+ * The order in which the traffic lights of a run were granted their sections
+ * A recording log appends every grant, which any thread may do
+ * A replaying log hands out the recorded grants one at a time: a light may only take the grant that is next,
+ *   so the run repeats the interleaving of the recorded one, given the same trace and settings
+ */
+typedef struct GrantLog GrantLog;
+
+/*
+ * record_grants(const char* path)
+ *
+ * create a log that records the grants, written to the file by close_grant_log
+ * returns NULL (and logs the reason) when out of memory
+ */
+GrantLog* record_grants(const char* path);
+
+/*
+ * replay_grants(const char* path)
+ *
+ * load a recorded log to replay
+ * returns NULL (and logs the reason) when the file cannot be read or is not a grant log
+ */
+GrantLog* replay_grants(const char* path);
+
+/*
+ * use_grant_settings(GrantLog* log, const GrantSettings* settings)
+ *
+ * set the settings of the run, stored with a recording and compared with those of a replay
+ * returns false (and logs the reason) when a replay was recorded with other settings
+ */
+bool use_grant_settings(GrantLog* log, const GrantSettings* settings);
+
+/*
+ * use_grant_trace(GrantLog* log, const TraceFingerprint* trace)
+ *
+ * set the fingerprint of the trace of the run, stored with a recording and compared with that of a replay
+ * returns false (and logs the reason) when a replay was recorded with another trace
+ */
+bool use_grant_trace(GrantLog* log, const TraceFingerprint* trace);
+
+/*
+ * next_grant(GrantLog* log, GrantKind* kind, long long* time)
+ *
+ * get the light that is granted next in a replay, and store the kind of the grant and the time in nanoseconds
+ *   at which it was recorded, or -1 as time when the recording or the replay is not in virtual time
+ * returns -1 when recording, or when the replay is over and the lights run freely
+ */
+int next_grant(GrantLog* log, GrantKind* kind, long long* time);
+
+/*
+ * begin_grant(GrantLog* log), end_grant(GrantLog* log)
+ *
+ * enclose a grant and the light change that goes with it, so a recording has the grants in the order of the changes
+ * a replay needs no lock, only the light that has the next grant takes it
+ */
+void begin_grant(GrantLog* log);
+void end_grant(GrantLog* log);
+
+/*
+ * add_grant(GrantLog* log, int light, GrantKind kind, long long time)
+ *
+ * record a grant to the light at time in nanoseconds, or in a replay take the grant that is next,
+ *   which has to be this one, between begin_grant and end_grant
+ * returns the light that is granted next in a replay, so that it can be woken up, or -1
+ */
+int add_grant(GrantLog* log, int light, GrantKind kind, long long time);
+
+/*
+ * abandon_replay(GrantLog* log, int light, GrantKind kind)
+ *
+ * stop a replay because the light that is granted next wants another kind of grant than the recorded one,
+ *   or as light -1 because it has no car left to take the grant, the run does not follow the recording,
+ *   and the lights run freely from here on
+ */
+void abandon_replay(GrantLog* log, int light, GrantKind kind);
+
+/*
+ * close_grant_log(GrantLog* log)
+ *
+ * write a recording to its file, or report how far a replay followed the recording, and free the log
+ * returns false (and logs the reason) when the recording cannot be written or the replay did not follow the recording
+ */
+bool close_grant_log(GrantLog* log);
+
+#endif
@@ -1,389 +1,2129 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
 #include <unistd.h>
-#include <errno.h>
 #include <pthread.h>
-#include <semaphore.h>
+#include <stdatomic.h>
+#include <time.h>
 
 #include "arrivals.h"
+#include "intersection.h"
 #include "intersection_time.h"
-#include "input.h"
+#include "lane_queue.h"
+#include "lock_profile.h"
+#include "log.h"
+#include "stats.h"
 
-/* 
- * curr_arrivals[][][]
+/*
+ * LightThread
+ *
+ * The argument of the thread of a traffic light: the intersection, and the index of the light in its topology
+ */
+typedef struct
+{
+  Intersection* intersection;
+  int light_index;
+} LightThread;
+
+/*
+ * LightState
  *
- * A 3D array that stores the arrivals that have occurred
- * The first two indices determine the entry lane: first index is Side, second index is Direction
- * curr_arrivals[s][d] returns an array of all arrivals for the entry lane on side s for direction d,
- *   ordered in the same order as they arrived
+ * What a traffic light of the threaded engine publishes to the others while it waits for its sections,
+ *   on its own cache line, as every light writes its own and reads those of all others
+ * priority: with a policy other than GREEDY_POLICY, the priority of the light, NO_PRIORITY when it does not wait
+ *     or has no priority under the policy
+ *   Each light publishes its own priority, and only claims its sections when no conflicting light has priority over it
+ * waiting_since: with platoon_wait, the arrival time of the car the light waits for, -1 when it does not wait
+ *   A light with a platoon ends it when a conflicting light has waited platoon_wait seconds
  */
-static Arrival curr_arrivals[4][3][20];
+typedef struct
+{
+  _Alignas(CACHE_LINE_SIZE) _Atomic long long priority;
+  _Atomic int waiting_since;
+} LightState;
 
 /*
- * semaphores[][]
+ * ArrivalWindow
  *
- * A 2D array that defines a semaphore for each entry lane,
- *   which are used to signal the corresponding traffic light that a car has arrived
- * The two indices determine the entry lane: first index is Side, second index is Direction
+ * The arrival times of the most recent cars in the lane of a traffic light, for the arrival rate of ADAPTIVE_POLICY
+ * Only the supplier writes it, count is the number of arrivals so far and times[] is a ring of the last of them
  */
-static sem_t semaphores[4][3];
+#define ARRIVAL_HISTORY 63
+
+typedef struct
+{
+  _Alignas(CACHE_LINE_SIZE) _Atomic unsigned count;
+  _Atomic int times[ARRIVAL_HISTORY];
+} ArrivalWindow;
 
 /*
- * mutexes[]
- * 
- * An array of mutexes that are used to lock the intersection
- * The mutexes are used to ensure that only one car can be in the intersection at a time
+ * Intersection
+ *
+ * topology: the lanes, sections and traffic lights, and the conflicts between the lights
+ * options: the engine, cross time and clock settings the intersection was created with
+ * clock: the time of this simulation, every thread of the intersection registers with it
+ * arrival_loader: the trace of arrivals that supply_arrivals reads from
+ *
+ * lanes[]: the queues that store the arrivals that have occurred and not yet passed the intersection
+ *   lanes[i] holds the arrivals for the entry lane of topology->lights[i], ordered in the same order as they arrived
+ *   The supplier pushes arrivals, and the traffic light of the lane pops them once they have passed
+ *
+ * sections_taken: the state of the whole intersection as a single atomic word
+ *   A bit is set while the corresponding section is claimed by a traffic light
+ *   Lights claim all of their sections at once with a compare-and-swap and release them with a fetch-and,
+ *     so no lock is needed to prevent deadlocks
+ *
+ * waiting_lights: a bitmask of the traffic lights (bit i for topology->lights[i]) that are waiting
+ *     for one of their sections to be released
+ *   Only lights in this mask are woken up, so releasing sections costs no system call when nobody waits
+ *
+ * light_states[]: what each traffic light of the threaded engine publishes to the others, see LightState
+ *
+ * parkers[]: a parker per traffic light, which the light waits on while its lane is empty or one of its sections is taken
+ *   The supplier grants the permit when a car arrives in the lane,
+ *     and a light that releases sections grants it to the waiting lights that need one of those sections
+ *
+ * arrival_windows[]: with ADAPTIVE_POLICY, the recent arrivals in the lane of each traffic light
+ * light_stats[]: the statistics of each traffic light, only written by the thread of the light
+ * supplier_lateness: in real time, how many microseconds of real time after the arrival time of a car the supplier
+ *   woke up to store it, only written by the supplier
+ * ingest_latency: for live arrivals, how many microseconds of real time after it was received a car was in its lane,
+ *   including any wait for its arrival time, only written by the supplier or the event engine
+ * scheduler_parker: the parker the scheduler of the batch engine waits on, the supplier grants its permit for every arrival
+ * arrivals_until: the time in seconds up to which the supplier has stored every arrival of the trace in its lane
+ *   In virtual time the scheduler of the batch engine waits for it to reach the current time before deciding,
+ *     so its decisions do not depend on which of the two the clock happened to wake first
+ * supplied: set once the supplier has stored every arrival of the trace, in a replay of the grants a light
+ *   that has the next grant and no car left then can never take it
+ * scheduler_cpu_time: the CPU time in nanoseconds used by the scheduler of the batch engine or by the event engine,
+ *   set when it stops
+ * event_time: the time in seconds of the event engine, which does not use the clock
+ * cpu_clocks[], num_cpu_clocks: the CPU time clocks of the traffic light threads or of the scheduler, set once they
+ *   are created and cleared before they are joined, so write_intersection_metrics can read their CPU time while they run
+ *
+ * cars_remaining: the number of cars that still have to pass the intersection, plus one while the supplier is still running
+ *   The supplier adds each car before storing it in its lane, and a light subtracts it once the car has passed
+ *   Whoever brings the count to zero signals all_handled, so the controller never has to poll the lights
+ * all_handled, all_handled_lock, all_handled_changed: set once cars_remaining reaches zero,
+ *   run_intersection waits for this with all_handled_changed
+ * stopping: set when all cars have been handled, the lights stop once their lane is empty
+ *
+ * running: set while the simulation runs, from the start of the clock until all threads stopped
+ * wall_start: the real time at which the clock started
+ * simulated_time, wall_time: the simulated and real time in seconds the run took
  */
-static pthread_mutex_t mutexes[9];
+struct Intersection
+{
+  const Topology* topology;
+  IntersectionOptions options;
+  Clock clock;
+  ArrivalLoader* arrival_loader;
+
+  LaneQueue* lanes;
+  Parker* parkers;
+  ArrivalWindow* arrival_windows;
+  LightStats* light_stats;
+  LightThread* light_threads;
+  uint64_t scheduler_cpu_time;
+  clockid_t cpu_clocks[MAX_LIGHTS];
+  _Atomic int num_cpu_clocks;
+
+  // written by every light while running, on cache lines apart from the fields above that are only read then
+  _Alignas(CACHE_LINE_SIZE) _Atomic SectionMask sections_taken;
+  _Atomic uint32_t waiting_lights;
+  LightState light_states[MAX_LIGHTS];
+  // only written by the supplier, or the scheduler and the event engine
+  _Alignas(CACHE_LINE_SIZE) Histogram supplier_lateness;
+  Histogram ingest_latency;
+  _Atomic int arrivals_until;
+  atomic_bool supplied;
+  _Atomic int event_time;
+  Parker scheduler_parker;
+
+  _Alignas(CACHE_LINE_SIZE) _Atomic long cars_remaining;
+  bool all_handled;
+  pthread_mutex_t all_handled_lock;
+  pthread_cond_t all_handled_changed;
+  atomic_bool stopping;
+
+  atomic_bool running;
+  struct timespec wall_start;
+  int simulated_time;
+  double wall_time;
+};
 
 /*
- * mutex lock
+ * car_handled(Intersection* intersection)
  *
- * A mutex that is locked when a light is claiming certain parts of the intersection
- * This is used to ensure that only one light can claim mutexes at the same time,
- * to prevent deadlocks
+ * Subtract a car (or the supplier) from cars_remaining, and signal the controller when none remain
  */
-static pthread_mutex_t mutex_lock = PTHREAD_MUTEX_INITIALIZER;
+static void car_handled(Intersection* intersection)
+{
+  if (atomic_fetch_sub(&intersection->cars_remaining, 1) == 1)
+  {
+    lock_mutex(&intersection->all_handled_lock, "all handled");
+    intersection->all_handled = true;
+    pthread_cond_signal(&intersection->all_handled_changed);
+    unlock_mutex(&intersection->all_handled_lock);
+  }
+}
 
 /*
- * lights[]
+ * supplied_until(Intersection* intersection, int time)
  *
- * An array of structs that define the traffic lights
+ * Publish that every arrival up to the time in seconds is stored in its lane, and wake up the scheduler
+ *   of the batch engine that may be waiting for it
  */
-static struct {Side side; Direction direction; int m1; int m2; int m3; int m4;} lights[9] =
+static void supplied_until(Intersection* intersection, int time)
 {
-  {NORTH, RIGHT, 1, 0, 0, 0},
-  {NORTH, STRAIGHT, 2, 8, 9, 0},
-  {EAST, RIGHT, 3, 0, 0, 0},
-  {EAST, STRAIGHT, 1, 2, 4, 0},
-  {EAST, LEFT, 5, 7, 9, 0},
-  {SOUTH, STRAIGHT, 3, 4, 5, 0},
-  {SOUTH, LEFT, 1, 2, 6, 7},
-  {WEST, RIGHT, 9, 0, 0, 0},
-  {WEST, LEFT, 3, 4, 6, 8}
-};
+  if (intersection->options.engine == BATCH_ENGINE && time > atomic_load(&intersection->arrivals_until))
+  {
+    atomic_store(&intersection->arrivals_until, time);
+    unpark_thread(&intersection->scheduler_parker);
+  }
+}
 
 /*
- * supply_arrivals()
+ * record_ingest(Intersection* intersection)
  *
- * A function for supplying arrivals to the intersection
+ * When the last arrival of the trace was received live, record how long it took to get it into its lane
+ */
+static void record_ingest(Intersection* intersection)
+{
+  long long received = arrival_received(intersection->arrival_loader);
+  if (received >= 0)
+  {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long passed = now.tv_sec * 1000000000LL + now.tv_nsec - received;
+    histogram_record(&intersection->ingest_latency, passed > 0 ? (uint64_t)(passed / 1000) : 0);
+  }
+}
+
+/*
+ * supply_arrivals(void* arg)
+ *
+ * A function for supplying arrivals to the intersection given as argument
+ * Arrivals are read one at a time from the arrival_loader of the intersection
  * This should be executed by a separate thread
  */
-static void* supply_arrivals()
+static void* supply_arrivals(void* arg)
 {
-  fprintf(stderr, "(Supplier):\t Started\n");
-  int t = 0;
-  int num_curr_arrivals[4][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+  Intersection* intersection = arg;
+  log_debug("(Supplier):\t Started\n");
+  use_precise_timers(&intersection->clock);
 
-  // for every arrival in the list
-  for (int i = 0; i < sizeof(input_arrivals)/sizeof(Arrival); i++)
+  // for every arrival in the trace, sleeping once for all arrivals with the same time
+  Arrival arrival;
+  int slept_until = -1;
+  while (next_arrival(intersection->arrival_loader, &arrival))
   {
-    // get the next arrival in the list
-    Arrival arrival = input_arrivals[i];
-    fprintf(stderr, "(Supplier):\t Next arrival (%d): %d / %d @ t%d\n", arrival.id, arrival.side, arrival.direction, arrival.time);
+    supplied_until(intersection, arrival.time - 1);
+    log_debug("(Supplier):\t Next arrival (%d): %d / %d @ t%d\n", arrival.id, arrival.side, arrival.direction, arrival.time);
+    int light_index = topology_light(intersection->topology, arrival.side, arrival.direction);
+    if (light_index < 0)
+    {
+      log_error("(Supplier):\t No traffic light for lane %d / %d, skipping car %d\n", arrival.side, arrival.direction, arrival.id);
+      continue;
+    }
     // wait until this arrival is supposed to arrive
-    sleep(arrival.time - t);
-    t = arrival.time;
-    // store the new arrival in curr_arrivals
-    curr_arrivals[arrival.side][arrival.direction][num_curr_arrivals[arrival.side][arrival.direction]] = arrival;
-    num_curr_arrivals[arrival.side][arrival.direction] += 1;
-    // increment the semaphore for the traffic light that the arrival is for
-    sem_post(&semaphores[arrival.side][arrival.direction]);
+    if (arrival.time > slept_until)
+    {
+      sleep_until_arrival(&intersection->clock, arrival.time);
+      slept_until = arrival.time;
+      if (!intersection->options.virtual_time)
+      {
+        long long late = get_time_passed_ns(&intersection->clock) - arrival.time * 1000000000LL;
+        histogram_record(&intersection->supplier_lateness, late > 0 ? (uint64_t)(late / intersection->options.time_scale / 1000) : 0);
+      }
+    }
+    // store the new arrival in the queue of its lane
+    atomic_fetch_add(&intersection->cars_remaining, 1);
+    if (!lane_push(&intersection->lanes[light_index], arrival))
+    {
+      log_error("(Supplier):\t Out of memory, dropping car %d\n", arrival.id);
+      car_handled(intersection);
+      continue;
+    }
+    record_ingest(intersection);
+    if (intersection->options.policy == ADAPTIVE_POLICY)
+    {
+      ArrivalWindow* window = &intersection->arrival_windows[light_index];
+      unsigned count = atomic_load_explicit(&window->count, memory_order_relaxed);
+      atomic_store_explicit(&window->times[count % ARRIVAL_HISTORY], arrival.time, memory_order_relaxed);
+      atomic_store_explicit(&window->count, count + 1, memory_order_release);
+    }
+    // wake up the traffic light that the arrival is for, or the scheduler that controls it
+    unpark_thread(intersection->options.engine == BATCH_ENGINE ? &intersection->scheduler_parker : &intersection->parkers[light_index]);
+  }
+
+  // the supplier no longer counts as remaining
+  supplied_until(intersection, INT_MAX);
+  atomic_store(&intersection->supplied, true);
+  if (intersection->options.grants != NULL)
+  {
+    // the lights check whether the light that has the next grant still has a car for it
+    for (int i = 0; i < intersection->topology->num_lights; i++)
+    {
+      unpark_thread(&intersection->parkers[i]);
+    }
   }
+  car_handled(intersection);
+  unregister_thread(&intersection->clock);
 
   return(0);
 }
 
 /*
- * print_traffic_light_change(Side side, Direction direction, bool green, int time, int for_car)
- * 
+ * print_traffic_light_change(Intersection* intersection, Side side, Direction direction, bool green, int time, int for_car)
+ *
  * A function that traffic lights may use to output their state changes
- * Prints a formatted message to stdout
+ * Writes the change to the output of the intersection, by default a formatted message to stdout
  * side: the side of the intersection that the traffic light is for
  * direction: the direction that the traffic light is for
  * green: whether the traffic light is green (true) or red (false)
  * time: the time at which the traffic light changes. Not used when not green
  */
-static void* print_traffic_light_change(Side side, Direction direction, bool green, int time, int for_car)
+static void* print_traffic_light_change(Intersection* intersection, Side side, Direction direction, bool green, int time, int for_car)
 {
-  if (green)
+  LightChange change = {time, green ? for_car : 0, side, direction, green};
+  if (intersection->options.output != NULL)
   {
-    fprintf(stdout, "traffic light %d %d turns green at time %d for car %d\n", side, direction, time, for_car);
+    intersection->options.output(&change, 1, intersection->options.output_arg);
   }
   else
   {
-    fprintf(stdout, "traffic light %d %d turns red at time %d\n", side, direction, time);
+    output_light_change(&change);
   }
   return(0);
 }
 
 /*
- * all_cars_handled()
+ * claim_sections(Intersection* intersection, SectionMask mask, SectionMask* conflicts)
  *
- * Returns whether all arrivals have been handled based on the semaphores and mutexes
+ * Tries to claim all sections in the mask with a single compare-and-swap
+ * Either all sections are claimed and true is returned,
+ *   or one of them is already taken, nothing is claimed, the taken sections of the mask are stored in conflicts
+ *   and false is returned
  */
-static bool all_cars_handled()
+static bool claim_sections(Intersection* intersection, SectionMask mask, SectionMask* conflicts)
 {
-  for (int i = 0; i < 4; i++)
+  SectionMask taken = atomic_load(&intersection->sections_taken);
+  while ((taken & mask) == 0)
   {
-    for (int j = 0; j < 3; j++)
+    // on failure taken is updated to the current state, so the check is repeated
+    if (atomic_compare_exchange_weak(&intersection->sections_taken, &taken, taken | mask))
     {
-      int sem_value;
-      sem_getvalue(&semaphores[i][j], &sem_value);
-      if (sem_value > 0)
-      {
-        fprintf(stderr, "(Controller):\t Semaphore %d:%d has value %d\n", i, j, sem_value);
-        return false;
-      }
+      return true;
     }
   }
-  fprintf(stderr, "(Controller):\t All semaphores empty\n");
-  pthread_mutex_lock(&mutex_lock);
-  fprintf(stderr, "(Controller):\t Section change lock locked\n");
-  for (int i = 0; i < sizeof(mutexes)/sizeof(mutexes[0]); i++)
+  *conflicts = taken & mask;
+  return false;
+}
+
+bool parse_policy(const char* name, Policy* policy, int* max_wait)
+{
+  if (strcmp(name, "greedy") == 0)
   {
-    // Try locking, but if they are already locked, unlock the other ones
-    int result = pthread_mutex_trylock(&mutexes[i]);
-    if (result == 0)
-    {
-      pthread_mutex_unlock(&mutexes[i]);
-    }
-    else if (result == EBUSY)
-    {
-      fprintf(stderr, "(Controller):\t Mutex %d is locked\n", i + 1);
-      pthread_mutex_unlock(&mutex_lock);
-      return false;
-    }
-    else
+    *policy = GREEDY_POLICY;
+  }
+  else if (strcmp(name, "fifo") == 0)
+  {
+    *policy = FIFO_POLICY;
+  }
+  else if (strcmp(name, "queue") == 0)
+  {
+    *policy = QUEUE_POLICY;
+  }
+  else if (strcmp(name, "adaptive") == 0)
+  {
+    *policy = ADAPTIVE_POLICY;
+  }
+  else if (strncmp(name, "aging", 5) == 0 && (name[5] == '\0' || (name[5] == ':' && atoi(name + 6) > 0)))
+  {
+    *policy = AGING_POLICY;
+    if (name[5] == ':')
     {
-      fprintf(stderr, "(Controller):\t Error checking mutexes: %d\n", result);
-      pthread_mutex_unlock(&mutex_lock);
-      return false;
+      *max_wait = atoi(name + 6);
     }
   }
-  fprintf(stderr, "(Controller):\t All mutexes unlocked\n");
-  pthread_mutex_unlock(&mutex_lock);
+  else
+  {
+    log_error("(Controller):\t Unknown policy %s\n", name);
+    return false;
+  }
   return true;
 }
 
 /*
- * manage_light(void* arg)
+ * NO_PRIORITY
  *
- * Description:
- * A function that implements the behavior of a traffic light.
- * Receives the index of the traffic light in the lights array as an argument.
- * While not all arrivals have been handled, repeatedly:
- * - Waits for an arrival using the semaphore for this traffic light.
- * - Locks the mutex(es) associated with the relevant intersection sections.
- * - Checks if all relevant intersection sections are unlocked; if yes, makes the traffic light turn green.
- * - Sleeps for CROSS_TIME seconds while the car passes.
- * - Makes the traffic light turn red and unlocks the relevant intersection section mutexes.
+ * The priority of a traffic light that has no waiting car, or whose car has no priority under the policy
  */
-static void* manage_light(void* arg)
-{
-  int light_index = (int)arg;
-  Side side = lights[light_index].side;
-  Direction direction = lights[light_index].direction;
-  int m1 = lights[light_index].m1;
-  int m2 = lights[light_index].m2;
-  int m3 = lights[light_index].m3;
-  int m4 = lights[light_index].m4;
-  fprintf(stderr, "(Light %d / %d):\t Started\n", side, direction);
+#define NO_PRIORITY LLONG_MIN
 
-  // keep track of how many cars have passed
-  int cars_passed = 0;
-
-  // work until controller kills the thread
-  while (true)
+/*
+ * light_priority(Intersection* intersection, int light_index, long long now)
+ *
+ * Returns the priority of a traffic light with a waiting car under the policy of the intersection at time now in ns,
+ *   a higher value goes first
+ */
+static long long light_priority(Intersection* intersection, int light_index, long long now)
+{
+  LaneQueue* lane = &intersection->lanes[light_index];
+  switch (intersection->options.policy)
   {
-    // wait for an arrival
-    sem_wait(&semaphores[side][direction]);
-
-    fprintf(stderr, "(Light %d / %d):\t Car %d arrived at light\n", side, direction, curr_arrivals[side][direction][cars_passed].id);
+    case FIFO_POLICY:
+      return -(long long)lane_front(lane)->time;
+    case QUEUE_POLICY:
+      return lane_size(lane);
+    case AGING_POLICY:
+    {
+      int arrival_time = lane_front(lane)->time;
+      return now >= (arrival_time + intersection->options.max_wait) * 1000000000LL ? -(long long)arrival_time : NO_PRIORITY;
+    }
+    default:
+      return NO_PRIORITY;
+  }
+}
 
-    // lock the section change lock
-    pthread_mutex_lock(&mutex_lock);
+/*
+ * light_demand(Intersection* intersection, int light_index, long long now)
+ *
+ * Returns the demand of a traffic light under ADAPTIVE_POLICY at time now in ns: the cars in its lane,
+ *   plus the cars expected to arrive while one car crosses at the arrival rate over the last ADAPTIVE_WINDOW seconds
+ * The arrival rate is counted over the last ARRIVAL_HISTORY arrivals at most, which any thread may read
+ */
+static double light_demand(Intersection* intersection, int light_index, long long now)
+{
+  ArrivalWindow* window = &intersection->arrival_windows[light_index];
+  unsigned count = atomic_load_explicit(&window->count, memory_order_acquire);
+  int now_s = (int)(now / 1000000000LL);
+  int window_s = now_s < ADAPTIVE_WINDOW ? (now_s > 0 ? now_s : 1) : ADAPTIVE_WINDOW;
+  int recent = 0;
+  while (recent < ARRIVAL_HISTORY && recent < (int)count
+    && atomic_load_explicit(&window->times[(count - recent - 1) % ARRIVAL_HISTORY], memory_order_relaxed) > now_s - window_s)
+  {
+    recent++;
+  }
+  return lane_size(&intersection->lanes[light_index]) + (double)recent / window_s * intersection->options.cross_time;
+}
 
-    fprintf(stderr, "(Light %d / %d):\t Section change lock locked\n", side, direction);
-    
-    // for each path_mutex check whether it is locked
-    int m1r, m2r, m3r, m4r;
+/*
+ * priority_conflicts(const Intersection* intersection, int light_index, long long priority, const long long* priorities)
+ *
+ * Returns the sections of the traffic light that it has to leave to conflicting lights with priority over it,
+ *   given its own priority and the priorities of all lights
+ */
+static SectionMask priority_conflicts(const Intersection* intersection, int light_index, long long priority, const long long* priorities)
+{
+  const Topology* topology = intersection->topology;
+  SectionMask conflicts = 0;
+  uint32_t conflicting = ~topology->tables.compatible[light_index] & ~(1u << light_index) & ((1ull << topology->num_lights) - 1);
+  for (; conflicting != 0; conflicting &= conflicting - 1)
+  {
+    int other = __builtin_ctz(conflicting);
+    long long other_priority = priorities[other];
+    if (other_priority != NO_PRIORITY && (other_priority > priority || (other_priority == priority && other < light_index)))
+    {
+      conflicts |= topology->lights[other].sections & topology->lights[light_index].sections;
+    }
+  }
+  return conflicts;
+}
 
-    m1r = m1 == 0 ? -2 : pthread_mutex_trylock(&mutexes[m1-1]);
-    m2r = m2 == 0 ? -2 : pthread_mutex_trylock(&mutexes[m2-1]);
-    m3r = m3 == 0 ? -2 : pthread_mutex_trylock(&mutexes[m3-1]);
-    m4r = m4 == 0 ? -2 : pthread_mutex_trylock(&mutexes[m4-1]);
+/*
+ * granted_next(Intersection* intersection, GrantKind* kind, long long* time)
+ *
+ * Returns the traffic light that a replay of the grants has next, and stores the kind of grant
+ *   and in virtual time the time in ns it was recorded at (otherwise -1), or returns -1 when the lights run freely
+ */
+static int granted_next(Intersection* intersection, GrantKind* kind, long long* time)
+{
+  return intersection->options.grants != NULL ? next_grant(intersection->options.grants, kind, time) : -1;
+}
 
-    // now we have 4 variables containing -2 if they're not relevant, -1 if they cannot be locked (already locked), and 0 if they were unlocked
-    fprintf(stderr, "(Light %d / %d):\t Path mutexes as follows: %d:%d, %d:%d, %d:%d, %d:%d\n", side, direction, m1, m1r, m2, m2r, m3, m3r, m4, m4r);
+/*
+ * stop_replay(Intersection* intersection, int light_index, GrantKind kind)
+ *
+ * Abandons a replay in which the traffic light that has the next grant wants another kind of grant,
+ *   or with light_index -1 has no car left for it, and wakes up every light that waits for its grant to run freely
+ */
+static void stop_replay(Intersection* intersection, int light_index, GrantKind kind)
+{
+  abandon_replay(intersection->options.grants, light_index, kind);
+  for (int i = 0; i < intersection->topology->num_lights; i++)
+  {
+    unpark_thread(&intersection->parkers[i]);
+  }
+}
 
-    // if all were successfully locked, then all_unlocked is true
-    // otherwise we need to unlock those that were locked successfully and try again later
+/*
+ * check_replay(Intersection* intersection)
+ *
+ * Stops a replay of the grants when the traffic light that has the next grant can never take it:
+ *   the supplier has finished and the light has no car left in its lane to claim or keep its sections for
+ * Returns whether the lights run freely now
+ */
+static bool check_replay(Intersection* intersection)
+{
+  GrantKind kind;
+  long long time;
+  int granted = granted_next(intersection, &kind, &time);
+  if (granted >= 0 && kind != GRANT_RELEASE && atomic_load(&intersection->supplied)
+    && lane_size(&intersection->lanes[granted]) == 0)
+  {
+    stop_replay(intersection, -1, kind);
+    return true;
+  }
+  return granted < 0;
+}
 
-    bool all_unlocked = true;
-    if (m1r != 0 && m1r != -2)
+/*
+ * wait_for_grant(Intersection* intersection, int light_index, GrantKind* kind)
+ *
+ * In a replay of the grants, parks the traffic light until it has the next grant, and stores the kind of it
+ * Returns whether it has the next grant, false when the lights run freely
+ */
+static bool wait_for_grant(Intersection* intersection, int light_index, GrantKind* kind)
+{
+  long long time;
+  int granted = granted_next(intersection, kind, &time);
+  while (granted >= 0 && granted != light_index)
+  {
+    if (check_replay(intersection))
     {
-      all_unlocked = false;
+      return false;
     }
-    if (m2r != 0 && m2r != -2)
+    park_thread(&intersection->parkers[light_index]);
+    granted = granted_next(intersection, kind, &time);
+  }
+  return granted == light_index;
+}
+
+/*
+ * try_claim(Intersection* intersection, int light_index, SectionMask* conflicts)
+ *
+ * Tries to claim all sections of the given traffic light, if no conflicting light has priority over it
+ * In a replay of the grants the light only claims when it has the next grant, and in virtual time not before
+ *   the time it was recorded at, the recording already decided the priorities then, the light takes the grant
+ *   when it turns green
+ * Returns true when claimed, otherwise stores the sections that are taken or left to other lights in conflicts
+ */
+static bool try_claim(Intersection* intersection, int light_index, SectionMask* conflicts)
+{
+  GrantKind kind;
+  long long grant_time;
+  int granted = granted_next(intersection, &kind, &grant_time);
+  if ((granted >= 0 && granted != light_index) || (granted == light_index && grant_time > get_time_passed_ns(&intersection->clock)))
+  {
+    *conflicts = 0;
+    return false;
+  }
+  if (granted == light_index && kind != GRANT_CLAIM)
+  {
+    stop_replay(intersection, light_index, GRANT_CLAIM);
+    granted = -1;
+  }
+  if (intersection->options.policy != GREEDY_POLICY && granted < 0)
+  {
+    long long now = intersection->options.policy == AGING_POLICY ? get_time_passed_ns(&intersection->clock) : 0;
+    long long priority = light_priority(intersection, light_index, now);
+    atomic_store(&intersection->light_states[light_index].priority, priority);
+    long long priorities[MAX_LIGHTS];
+    for (int i = 0; i < intersection->topology->num_lights; i++)
     {
-      all_unlocked = false;
+      priorities[i] = atomic_load(&intersection->light_states[i].priority);
     }
-    if (m3r != 0 && m3r != -2)
+    *conflicts = priority_conflicts(intersection, light_index, priority, priorities);
+    if (*conflicts != 0)
     {
-      all_unlocked = false;
+      return false;
     }
-    if (m4r != 0 && m4r != -2)
+  }
+  if (!claim_sections(intersection, intersection->topology->lights[light_index].sections, conflicts))
+  {
+    return false;
+  }
+  // a light that holds its sections no longer holds the conflicting lights back
+  if (intersection->options.policy != GREEDY_POLICY)
+  {
+    atomic_store(&intersection->light_states[light_index].priority, NO_PRIORITY);
+  }
+  return true;
+}
+
+/*
+ * extend_platoon(Intersection* intersection, int light_index, int passed, const int* waiting_since,
+ *   const long long* priorities, long long now)
+ *
+ * Returns whether a green traffic light that has passed `passed` cars keeps its sections for the next car of its lane:
+ *   as long as fewer than platoon cars have passed, the next car has arrived, no conflicting light has waited
+ *   platoon_wait seconds and no conflicting light has priority under the policy,
+ *   and with ADAPTIVE_POLICY no conflicting light with a waiting car has a higher demand than what is left of this one
+ * waiting_since[], priorities[]: the arrival time (or -1) and the priority of the car each light waits for at time now in ns
+ */
+static bool extend_platoon(Intersection* intersection, int light_index, int passed, const int* waiting_since,
+  const long long* priorities, long long now)
+{
+  if (passed >= intersection->options.platoon || lane_size(&intersection->lanes[light_index]) < 2)
+  {
+    return false;
+  }
+  const Topology* topology = intersection->topology;
+  bool adaptive = intersection->options.policy == ADAPTIVE_POLICY;
+  // the car that just passed is still in the lane
+  double demand = adaptive ? light_demand(intersection, light_index, now) - 1 : 0;
+  uint32_t conflicting = ~topology->tables.compatible[light_index] & ~(1u << light_index) & ((1ull << topology->num_lights) - 1);
+  for (; conflicting != 0; conflicting &= conflicting - 1)
+  {
+    int other = __builtin_ctz(conflicting);
+    if (priorities[other] != NO_PRIORITY)
     {
-      all_unlocked = false;
+      return false;
     }
-    if (!all_unlocked)
+    if (adaptive && lane_size(&intersection->lanes[other]) > 0 && light_demand(intersection, other, now) > demand)
     {
-      if (m1 != 0 && m1r == 0)
-      {
-        pthread_mutex_unlock(&mutexes[m1-1]);
-      }
-      if (m2 != 0 && m2r == 0)
-      {
-        pthread_mutex_unlock(&mutexes[m2-1]);
-      }
-      if (m3 != 0 && m3r == 0)
-      {
-        pthread_mutex_unlock(&mutexes[m3-1]);
-      }
-      if (m4 != 0 && m4r == 0)
-      {
-        pthread_mutex_unlock(&mutexes[m4-1]);
-      }
-      // increment the semaphore again so that the light can try again later when the section is unlocked
-      sem_post(&semaphores[side][direction]);
+      return false;
     }
-    else
+    if (intersection->options.platoon_wait > 0 && waiting_since[other] >= 0
+      && now >= (waiting_since[other] + intersection->options.platoon_wait) * 1000000000LL)
     {
-      // print the light change
-      print_traffic_light_change(side, direction, true, get_time_passed(), curr_arrivals[side][direction][cars_passed].id);
-
-      fprintf(stderr, "(Light %d / %d):\t Path mutexes locked\n", side, direction);
-
-      // unlock the section change lock
-      pthread_mutex_unlock(&mutex_lock);
-
-      fprintf(stderr, "(Light %d / %d):\t Section change lock unlocked\n", side, direction);
-
-      // sleep for CROSS_TIME seconds
-      sleep(CROSS_TIME);
-
-      fprintf(stderr, "(Light %d / %d):\t Car %d passed\n", side, direction, curr_arrivals[side][direction][cars_passed].id);
-
-      // print the light change
-      print_traffic_light_change(side, direction, false, get_time_passed(), 0);
-
-      // lock the section change lock
-      pthread_mutex_lock(&mutex_lock);
-
-      fprintf(stderr, "(Light %d / %d):\t Section change lock locked\n", side, direction);
-
-      // unlock the path_mutexes
-      if (m1 != 0)
-      {
-        pthread_mutex_unlock(&mutexes[m1-1]);
-      }
-      if (m2 != 0)
-      {
-        pthread_mutex_unlock(&mutexes[m2-1]);
-      }
-      if (m3 != 0)
-      {
-        pthread_mutex_unlock(&mutexes[m3-1]);
-      }
-      if (m4 != 0)
-      {
-        pthread_mutex_unlock(&mutexes[m4-1]);
-      }
-
-      fprintf(stderr, "(Light %d / %d):\t Path mutexes unlocked\n", side, direction);
-
-      // increment the number of cars passed
-      cars_passed += 1;
+      return false;
     }
-
-    // unlock the section change lock
-    pthread_mutex_unlock(&mutex_lock);
-
-    // sleep for a sec
-    sleep(0.1);
   }
-  return(0);
+  return true;
 }
 
-int main(int argc, char * argv[])
+/*
+ * keep_sections(Intersection* intersection, int light_index, int passed)
+ *
+ * Returns whether a green traffic light of the threaded engine that has passed `passed` cars
+ *   keeps its sections for the next car, with the waiting times and priorities the other lights published
+ * In a replay of the grants the light waits until it has the next grant and does what was recorded,
+ *   waiting for the next car when the sections were kept for one
+ */
+static bool keep_sections(Intersection* intersection, int light_index, int passed)
 {
-  // create semaphores to wait/signal for arrivals
-  for (int i = 0; i < 4; i++)
+  if (passed >= intersection->options.platoon)
+  {
+    return false;
+  }
+  GrantKind kind;
+  bool granted = wait_for_grant(intersection, light_index, &kind);
+  if (granted && kind != GRANT_CLAIM)
   {
-    for (int j = 0; j < 3; j++)
+    // the car the recording kept the sections for arrives at this time, it may not have been supplied yet
+    while (kind == GRANT_KEEP && lane_size(&intersection->lanes[light_index]) < 2)
     {
-      sem_init(&semaphores[i][j], 0, 0);
+      park_thread(&intersection->parkers[light_index]);
     }
+    return kind == GRANT_KEEP;
   }
 
-  // Initialize each mutex in the array
-  for (int i = 0; i < 8; ++i) {
-    pthread_mutex_init(&mutexes[i], NULL);
+  int waiting_since[MAX_LIGHTS];
+  long long priorities[MAX_LIGHTS];
+  for (int i = 0; i < intersection->topology->num_lights; i++)
+  {
+    waiting_since[i] = atomic_load(&intersection->light_states[i].waiting_since);
+    priorities[i] = atomic_load(&intersection->light_states[i].priority);
   }
-
-  // create a thread per traffic light that executes manage_light
-  pthread_t light_threads[8];
-  fprintf(stderr, "(Controller):\t Creating traffic light threads...\n");
-  for (int i = 0; i < sizeof(lights)/sizeof(lights[0]); i++)
+  bool timed = intersection->options.platoon_wait > 0 || intersection->options.policy == ADAPTIVE_POLICY;
+  long long now = timed ? get_time_passed_ns(&intersection->clock) : 0;
+  bool keep = extend_platoon(intersection, light_index, passed, waiting_since, priorities, now);
+  if (granted)
   {
-    pthread_create(&light_threads[i], NULL, manage_light, (void*)i);
+    stop_replay(intersection, light_index, keep ? GRANT_KEEP : GRANT_RELEASE);
   }
-  fprintf(stderr, "(Controller):\t Traffic light threads created\n");
-
-  // start the timer
-  fprintf(stderr, "(Controller):\t Starting timer...\n");
-  start_time();
-  fprintf(stderr, "(Controller):\t Timer started\n");
-
-  // create a thread that executes supply_arrivals
-  pthread_t arrival_thread;
-  fprintf(stderr, "(Controller):\t Creating arrival thread...\n");
-  pthread_create(&arrival_thread, NULL, supply_arrivals, NULL);
-  fprintf(stderr, "(Controller):\t Arrival thread created\n");
-
-  // wait for all arrivals to finish
-  fprintf(stderr, "(Controller):\t Waiting for threads to finish...\n");
-  pthread_join(arrival_thread, NULL);
-  fprintf(stderr, "(Controller):\t Arrival thread finished\n");
+  return keep;
+}
 
-  // wait for all cars to be handled
-  while (!all_cars_handled())
+/*
+ * record_conflict(LightStats* stats, SectionMask conflicts)
+ *
+ * Counts a failed claim of a traffic light, and the taken sections that made it fail
+ */
+static void record_conflict(LightStats* stats, SectionMask conflicts)
+{
+  counter_add(&stats->failed_claims, 1);
+  for (; conflicts != 0; conflicts &= conflicts - 1)
   {
-    sleep(1);
+    counter_add(&stats->section_conflicts[__builtin_ctz(conflicts)], 1);
   }
+}
 
-  fprintf(stderr, "(Controller):\t All cars handled\n");
+/*
+ * record_blocked(LightStats* stats, long long blocked)
+ *
+ * Adds the time in nanoseconds a car at the front of the lane of a traffic light was blocked by conflicting lights
+ */
+static void record_blocked(LightStats* stats, long long blocked)
+{
+  counter_add(&stats->blocked_time, blocked);
+  histogram_record(&stats->blocked, blocked / 1000);
+}
 
-  // kill all traffic light threads
-  fprintf(stderr, "(Controller):\t Killing traffic light threads...\n");
-  for (int i = 0; i < sizeof(lights)/sizeof(lights[0]); i++)
+/*
+ * wait_for_sections(Intersection* intersection, int light_index)
+ *
+ * Claims all sections of the given traffic light,
+ *   parking the light while one of them is taken or has to be left to a conflicting light with priority
+ * With AGING_POLICY the light also wakes up when its car has waited long enough to get priority
+ * Counts the failed claims and the time blocked in the statistics of the light
+ * Returns whether the sections were claimed without waiting
+ */
+static bool wait_for_sections(Intersection* intersection, int light_index)
+{
+  const Light* light = &intersection->topology->lights[light_index];
+  LightStats* stats = &intersection->light_stats[light_index];
+  uint64_t requested = profile_now();
+  SectionMask conflicts;
+  if (try_claim(intersection, light_index, &conflicts))
   {
-    pthread_cancel(light_threads[i]);
+    profile_sections_claimed(&intersection->sections_taken, light->sections, 0, requested);
+    return true;
   }
-  fprintf(stderr, "(Controller):\t Traffic light threads killed\n");
-
-  // destroy semaphores
-  for (int i = 0; i < 4; i++)
+  if (intersection->options.platoon_wait > 0)
+  {
+    atomic_store(&intersection->light_states[light_index].waiting_since, lane_front(&intersection->lanes[light_index])->time);
+  }
+  long long blocked_since = get_time_passed_ns(&intersection->clock);
+  SectionMask contended = 0;
+  do
   {
-    for (int j = 0; j < 3; j++)
+    record_conflict(stats, conflicts);
+    contended |= conflicts;
+    atomic_fetch_or(&intersection->waiting_lights, 1u << light_index);
+    // check again after announcing that we wait, a release in between would otherwise not wake us
+    bool claimed = try_claim(intersection, light_index, &conflicts);
+    if (!claimed)
+    {
+      // the same failed claim as above, its count is not repeated
+      contended |= conflicts;
+      log_debug("(Light %d / %d):\t Sections taken, waiting\n", light->side, light->direction);
+      // in a replay the light waits for its grant, which comes with a wake up, or for the time of its grant
+      GrantKind kind;
+      long long grant_time;
+      int granted = granted_next(intersection, &kind, &grant_time);
+      if (granted == light_index && grant_time > get_time_passed_ns(&intersection->clock))
+      {
+        park_thread_until(&intersection->parkers[light_index], grant_time);
+      }
+      else if (intersection->options.policy == AGING_POLICY && atomic_load(&intersection->light_states[light_index].priority) == NO_PRIORITY
+        && granted < 0)
+      {
+        int arrival_time = lane_front(&intersection->lanes[light_index])->time;
+        park_thread_until(&intersection->parkers[light_index], (arrival_time + intersection->options.max_wait) * 1000000000LL);
+      }
+      else
+      {
+        park_thread(&intersection->parkers[light_index]);
+      }
+    }
+    atomic_fetch_and(&intersection->waiting_lights, ~(1u << light_index));
+    if (claimed)
     {
-      sem_destroy(&semaphores[i][j]);
+      break;
     }
   }
-  // destroy mutexes
-  for (int i = 0; i < 8; ++i) {
-    pthread_mutex_destroy(&mutexes[i]);
+  while (!try_claim(intersection, light_index, &conflicts));
+  if (intersection->options.platoon_wait > 0)
+  {
+    atomic_store(&intersection->light_states[light_index].waiting_since, -1);
+  }
+  record_blocked(stats, get_time_passed_ns(&intersection->clock) - blocked_since);
+  profile_sections_claimed(&intersection->sections_taken, light->sections, contended, requested);
+  return false;
+}
+
+/*
+ * release_sections(Intersection* intersection, int light_index)
+ *
+ * Releases all sections of the given traffic light with a single fetch-and,
+ *   and wakes up every waiting traffic light that needs one of those sections
+ */
+static void release_sections(Intersection* intersection, int light_index)
+{
+  profile_sections_released(&intersection->sections_taken, intersection->topology->lights[light_index].sections);
+  atomic_fetch_and(&intersection->sections_taken, ~intersection->topology->lights[light_index].sections);
+  // only the waiting lights that are not compatible with this one need one of the released sections
+  uint32_t waiting = atomic_load(&intersection->waiting_lights) & ~intersection->topology->tables.compatible[light_index] & ~(1u << light_index);
+  while (waiting != 0)
+  {
+    int other = __builtin_ctz(waiting);
+    waiting &= waiting - 1;
+    unpark_thread(&intersection->parkers[other]);
+  }
+}
+
+/*
+ * change_light(Intersection* intersection, int light_index, GrantKind grant, int time, int for_car)
+ *
+ * Prints the change of a traffic light of the threaded engine, green for a claim or the next car of a platoon
+ *   and red for a release
+ * With a grant log the change is recorded in the order in which the changes are printed,
+ *   or in a replay the light takes its grant with the change and wakes up the light that has the next one
+ */
+static void change_light(Intersection* intersection, int light_index, GrantKind grant, int time, int for_car)
+{
+  const Light* light = &intersection->topology->lights[light_index];
+  GrantLog* grants = intersection->options.grants;
+  if (grants == NULL)
+  {
+    print_traffic_light_change(intersection, light->side, light->direction, grant != GRANT_RELEASE, time, for_car);
+    return;
+  }
+  GrantKind kind;
+  long long grant_time;
+  bool replaying = granted_next(intersection, &kind, &grant_time) >= 0;
+  begin_grant(grants);
+  print_traffic_light_change(intersection, light->side, light->direction, grant != GRANT_RELEASE, time, for_car);
+  int next = add_grant(grants, light_index, grant, get_time_passed_ns(&intersection->clock));
+  end_grant(grants);
+  if (next >= 0 && next != light_index)
+  {
+    unpark_thread(&intersection->parkers[next]);
+  }
+  else if (replaying && next < 0)
+  {
+    // the replay is over, the lights that wait for a grant run freely from here on
+    for (int i = 0; i < intersection->topology->num_lights; i++)
+    {
+      unpark_thread(&intersection->parkers[i]);
+    }
+  }
+}
+
+/*
+ * manage_light(void* arg)
+ *
+ * Description:
+ * A function that implements the behavior of a traffic light.
+ * Receives the LightThread with the intersection and the index of the traffic light as an argument.
+ * Until the controller stops the lights, repeatedly:
+ * - Waits for an arrival in the lane of this traffic light.
+ * - Claims the relevant intersection sections in one atomic step.
+ *   If one of them is taken, sleeps until a section it needs is released.
+ * - Makes the traffic light turn green.
+ * - Sleeps for cross_time seconds while the car passes.
+ * - With a platoon, keeps the sections and stays green for the next car in the lane, see extend_platoon.
+ * - Makes the traffic light turn red and releases the relevant intersection sections.
+ * - Removes the car from its lane and counts it as handled.
+ */
+static void* manage_light(void* arg)
+{
+  Intersection* intersection = ((LightThread*)arg)->intersection;
+  int light_index = ((LightThread*)arg)->light_index;
+  Side side = intersection->topology->lights[light_index].side;
+  Direction direction = intersection->topology->lights[light_index].direction;
+  log_debug("(Light %d / %d):\t Started\n", side, direction);
+
+  LaneQueue* lane = &intersection->lanes[light_index];
+  LightStats* stats = &intersection->light_stats[light_index];
+
+  use_precise_timers(&intersection->clock);
+
+  // work until the controller stops the lights
+  while (true)
+  {
+    // wait for an arrival
+    bool idle = lane_size(lane) == 0;
+    while (lane_size(lane) == 0)
+    {
+      if (atomic_load(&intersection->stopping))
+      {
+        counter_add(&stats->cpu_time, thread_cpu_time());
+        unregister_thread(&intersection->clock);
+        return(0);
+      }
+      // a light that had the next grant may have just passed its last car
+      if (intersection->options.grants != NULL)
+      {
+        check_replay(intersection);
+      }
+      park_thread(&intersection->parkers[light_index]);
+    }
+
+    // the car at the front of the lane is the next one to pass
+    const QueuedCar* car = lane_front(lane);
+
+    log_debug("(Light %d / %d):\t Car %d arrived at light\n", side, direction, car->id);
+
+    // claim all sections, waiting until the conflicting lights have released them
+    bool claimed_at_once = wait_for_sections(intersection, light_index);
+    long long held_since = get_time_passed_ns(&intersection->clock);
+    // a car that finds its light idle and the sections free is due to get green at its arrival time
+    if (idle && claimed_at_once && !intersection->options.virtual_time)
+    {
+      long long late = held_since - car->time * 1000000000LL;
+      histogram_record(&stats->latency, late > 0 ? (uint64_t)(late / intersection->options.time_scale / 1000) : 0);
+    }
+
+    log_debug("(Light %d / %d):\t Sections claimed\n", side, direction);
+    int passed = 0;
+    while (true)
+    {
+      // print the light change, and record how long the car waited for it
+      int green_time = get_time_passed(&intersection->clock);
+      change_light(intersection, light_index, passed == 0 ? GRANT_CLAIM : GRANT_KEEP, green_time, car->id);
+      histogram_record(&stats->waits, green_time > car->time ? green_time - car->time : 0);
+
+      // sleep for cross_time seconds
+      sleep_for(&intersection->clock, intersection->options.cross_time);
+      passed += 1;
+
+      log_debug("(Light %d / %d):\t Car %d passed\n", side, direction, car->id);
+
+      if (!keep_sections(intersection, light_index, passed))
+      {
+        break;
+      }
+      // the light stays green for the next car, which has already arrived
+      lane_pop(lane);
+      car_handled(intersection);
+      car = lane_front(lane);
+    }
+
+    // print the light change, in a replay once the light has the grant to
+    GrantKind kind;
+    if (wait_for_grant(intersection, light_index, &kind) && kind != GRANT_RELEASE)
+    {
+      stop_replay(intersection, light_index, GRANT_RELEASE);
+    }
+    change_light(intersection, light_index, GRANT_RELEASE, get_time_passed(&intersection->clock), 0);
+
+    // release the sections and wake up the lights waiting for them
+    release_sections(intersection, light_index);
+    counter_add(&stats->hold_time, get_time_passed_ns(&intersection->clock) - held_since);
+
+    log_debug("(Light %d / %d):\t Sections released\n", side, direction);
+
+    // remove the car from the lane, this also frees its place in the queue
+    lane_pop(lane);
+    car_handled(intersection);
+  }
+}
+
+/*
+ * choose_group(Intersection* intersection, uint32_t ready, long long now)
+ *
+ * Returns the group of lights (bit i for topology->lights[i]) to turn green out of the ready lights at time now in ns:
+ *   the largest group in which no two lights share a section, and of those groups the one with the most cars waiting,
+ *   or with ADAPTIVE_POLICY the group with the highest total demand
+ */
+static uint32_t choose_group(Intersection* intersection, uint32_t ready, long long now)
+{
+  if (intersection->options.policy == ADAPTIVE_POLICY)
+  {
+    double demands[MAX_LIGHTS];
+    for (uint32_t lights = ready; lights != 0; lights &= lights - 1)
+    {
+      int i = __builtin_ctz(lights);
+      demands[i] = light_demand(intersection, i, now);
+    }
+    return weighted_group(intersection->topology, ready, demands);
+  }
+  size_t cars[MAX_LIGHTS];
+  for (uint32_t lights = ready; lights != 0; lights &= lights - 1)
+  {
+    int i = __builtin_ctz(lights);
+    cars[i] = lane_size(&intersection->lanes[i]);
+  }
+  return busiest_group(intersection->topology, ready, cars);
+}
+
+/*
+ * Forecast
+ *
+ * With a lookahead, the arrivals the scheduler of the batch engine knows of before they happen,
+ *   read from the forecast loader of the intersection, which only the scheduler reads
+ * cars[]: a ring of the arrivals read that had not happened at the last update, as their light and time,
+ *   from first on, count of them, ending with the first one after the horizon unless the trace ended
+ * ended: set at the end of the trace, or when the ring ran out of memory and the forecast stops growing
+ */
+typedef struct
+{
+  int light;
+  int time;
+} ForecastCar;
+
+typedef struct
+{
+  ForecastCar* cars;
+  size_t first;
+  size_t count;
+  size_t capacity;
+  bool ended;
+} Forecast;
+
+/*
+ * update_forecast(Intersection* intersection, Forecast* forecast, int now)
+ *
+ * Drops the arrivals up to the time now in seconds, which the supplier has stored in their lanes,
+ *   and reads the arrivals up to the horizon after now
+ */
+static void update_forecast(Intersection* intersection, Forecast* forecast, int now)
+{
+  while (forecast->count > 0 && forecast->cars[forecast->first].time <= now)
+  {
+    forecast->first = (forecast->first + 1) % forecast->capacity;
+    forecast->count--;
+  }
+  int horizon = now + intersection->options.lookahead;
+  while (!forecast->ended
+    && (forecast->count == 0 || forecast->cars[(forecast->first + forecast->count - 1) % forecast->capacity].time <= horizon))
+  {
+    Arrival arrival;
+    if (!next_arrival(intersection->options.forecast, &arrival))
+    {
+      forecast->ended = true;
+      break;
+    }
+    int light_index = topology_light(intersection->topology, arrival.side, arrival.direction);
+    if (light_index < 0 || arrival.time <= now)
+    {
+      continue;
+    }
+    if (forecast->count == forecast->capacity)
+    {
+      // unroll the ring into the larger one
+      size_t capacity = forecast->capacity == 0 ? 256 : forecast->capacity * 2;
+      ForecastCar* cars = malloc(capacity * sizeof(ForecastCar));
+      if (cars == NULL)
+      {
+        log_error("(Scheduler):\t Out of memory, the lookahead stops at t%d\n", arrival.time);
+        forecast->ended = true;
+        break;
+      }
+      for (size_t i = 0; i < forecast->count; i++)
+      {
+        cars[i] = forecast->cars[(forecast->first + i) % forecast->capacity];
+      }
+      free(forecast->cars);
+      forecast->cars = cars;
+      forecast->first = 0;
+      forecast->capacity = capacity;
+    }
+    forecast->cars[(forecast->first + forecast->count) % forecast->capacity] = (ForecastCar){light_index, arrival.time};
+    forecast->count++;
+  }
+}
+
+/*
+ * group_weight(uint32_t group, const double* weights)
+ *
+ * Returns the total weight of the lights of the group
+ */
+static double group_weight(uint32_t group, const double* weights)
+{
+  double weight = 0;
+  for (; group != 0; group &= group - 1)
+  {
+    weight += weights[__builtin_ctz(group)];
+  }
+  return weight;
+}
+
+/*
+ * Plan
+ *
+ * The reservations of the batch engine with a lookahead, kept from one decision to the next
+ * reserved: the idle lights that reserved their sections for a car about to arrive
+ * held: the ready lights that stay red for those cars
+ * next: once the reserved cars arrived and turned green, the lights that were held for them,
+ *   which go before any other light that does not have priority
+ */
+typedef struct
+{
+  uint32_t reserved;
+  uint32_t held;
+  uint32_t next;
+} Plan;
+
+/*
+ * plan_group(Intersection* intersection, Forecast* forecast, Plan* plan, uint32_t ready, uint32_t idle,
+ *   const long long* priorities, long long now, SectionMask* reserved)
+ *
+ * Returns the group of lights to turn green out of the ready lights at time now in ns with a lookahead
+ * The idle lights, whose lanes are empty and sections free, may reserve their sections for a car that arrives
+ *   within the horizon and before a crossing started now would end, so the ready lights that conflict with them
+ *   stay red until those cars have crossed, and then go next
+ * The group without reservations, chosen as without a lookahead, is weighed against the best group with them
+ *   by the delay of the cars over the next two crossings of cross_time C:
+ * - without, the first car of each reserving light, arriving d seconds from now, waits C - d for the group,
+ *     and the cars of the ready lights left out of the group wait C
+ * - with, the cars of the ready lights that the reservations hold back wait d + C for the latest of them
+ *   and the reservations are only made when they save delay
+ * A ready light is never held back when it has priority under the policy (priorities[]),
+ *   or when its car would have waited the horizon before the reserved cars arrive,
+ *   so a car is passed over for cars yet to arrive for at most the horizon and a crossing
+ * Stores the sections that the idle lights of the group reserve in reserved
+ */
+static uint32_t plan_group(Intersection* intersection, Forecast* forecast, Plan* plan, uint32_t ready, uint32_t idle,
+  const long long* priorities, long long now, SectionMask* reserved)
+{
+  const Topology* topology = intersection->topology;
+  int now_s = (int)(now / 1000000000LL);
+  double cross_time = intersection->options.cross_time;
+  double until = now / 1e9 + cross_time;
+  update_forecast(intersection, forecast, now_s);
+  *reserved = 0;
+
+  // the ready lights that cannot be held back, and the time until which the others can
+  uint32_t kept = 0;
+  int horizon = now_s + intersection->options.lookahead;
+  double weights[MAX_LIGHTS] = {0};
+  for (uint32_t lights = ready; lights != 0; lights &= lights - 1)
+  {
+    int i = __builtin_ctz(lights);
+    LaneQueue* lane = &intersection->lanes[i];
+    weights[i] = lane_size(lane) * cross_time;
+    int waited_until = lane_front(lane)->time + intersection->options.lookahead;
+    if (priorities[i] != NO_PRIORITY || waited_until <= now_s)
+    {
+      kept |= 1u << i;
+    }
+    else if (waited_until < horizon)
+    {
+      horizon = waited_until;
+    }
+  }
+
+  // the reserved lights whose car arrived go first, then the lights they held back,
+  //   and the lights that conflict with them wait unless they are kept
+  if ((plan->reserved & ready) != 0)
+  {
+    plan->next = plan->held;
+  }
+  uint32_t first = (plan->reserved & ready) != 0 ? plan->reserved & ready : plan->next & ready;
+  plan->reserved = 0;
+  plan->held = 0;
+  for (uint32_t lights = first; lights != 0; lights &= lights - 1)
+  {
+    ready &= topology->tables.compatible[__builtin_ctz(lights)] | kept | first;
+  }
+  uint32_t group = choose_group(intersection, ready, now);
+  plan->next &= ~group;
+  if (plan->next != 0)
+  {
+    return group;
+  }
+
+  // the first car of every idle light that arrives before the horizon and before a crossing started now would end
+  double arrives[MAX_LIGHTS] = {0};
+  for (size_t i = 0; i < forecast->count; i++)
+  {
+    const ForecastCar* car = &forecast->cars[(forecast->first + i) % forecast->capacity];
+    if (car->time >= horizon || car->time >= until)
+    {
+      break;
+    }
+    if ((idle & (1u << car->light)) && weights[car->light] == 0)
+    {
+      weights[car->light] = until - car->time;
+      arrives[car->light] = car->time - now / 1e9;
+    }
+  }
+
+  // the idle lights reserve their sections only when compatible with the kept lights,
+  //   and when they conflict with the group without reservations, which they would otherwise wait for
+  uint32_t reserving = 0;
+  for (uint32_t lights = idle; lights != 0; lights &= lights - 1)
+  {
+    int i = __builtin_ctz(lights);
+    if (weights[i] > 0 && (topology->tables.compatible[i] & kept) == kept && (topology->tables.compatible[i] & group) != group)
+    {
+      reserving |= 1u << i;
+    }
+  }
+  if (reserving == 0)
+  {
+    return group;
+  }
+
+  uint32_t planned = weighted_group(topology, ready | reserving, weights);
+  double wait = 0;
+  for (uint32_t lights = planned & reserving; lights != 0; lights &= lights - 1)
+  {
+    int i = __builtin_ctz(lights);
+    wait = arrives[i] > wait ? arrives[i] : wait;
+  }
+  double held_back = 0;
+  for (uint32_t lights = group & ~planned; lights != 0; lights &= lights - 1)
+  {
+    held_back += lane_size(&intersection->lanes[__builtin_ctz(lights)]) * (wait + cross_time);
+  }
+  if ((planned & reserving) == 0 || group_weight(planned & ~group, weights) <= held_back)
+  {
+    return group;
+  }
+  log_debug("(Scheduler):\t Reserving the sections of lights %#x for the cars before t%d\n",
+    planned & reserving, (int)until);
+  plan->reserved = planned & reserving;
+  plan->held = group & ~planned;
+  for (uint32_t lights = plan->reserved; lights != 0; lights &= lights - 1)
+  {
+    *reserved |= topology->lights[__builtin_ctz(lights)].sections;
+  }
+  return planned & ready;
+}
+
+/*
+ * schedule_lights(void* arg)
+ *
+ * Description:
+ * A function that implements the batch engine, controlling all traffic lights of the intersection given as argument
+ *   from a single thread.
+ * At every decision point, which is an arrival or the end of a crossing:
+ * - Makes the lights whose car has passed turn red, and frees their sections.
+ * - Looks at all lights with a waiting car whose sections are free and that no conflicting waiting light
+ *     has priority over, and makes the largest group of them that do not conflict with each other turn green at once.
+ *   With a lookahead, the group may instead leave sections to the cars about to arrive, see plan_group.
+ * - Waits for the next arrival or the end of the first crossing,
+ *     or with AGING_POLICY until a waiting car has waited long enough to get priority.
+ * Stops when the controller stops the lights and no car is crossing anymore.
+ */
+static void* schedule_lights(void* arg)
+{
+  Intersection* intersection = arg;
+  const Light* lights = intersection->topology->lights;
+  const int num_lights = intersection->topology->num_lights;
+  Clock* clock = &intersection->clock;
+  log_debug("(Scheduler):\t Started\n");
+  long long crossing_end[MAX_LIGHTS];
+  // the time since which the car at the front of the lane was held up by conflicting lights, or -1
+  long long blocked_since[MAX_LIGHTS];
+  for (int i = 0; i < num_lights; i++)
+  {
+    blocked_since[i] = -1;
+  }
+  // the time each green light claimed its sections, and the number of cars it has passed since
+  long long green_since[MAX_LIGHTS];
+  int passed[MAX_LIGHTS];
+  long long cross_ns = intersection->options.cross_time * 1000000000LL;
+  uint32_t crossing = 0;
+  SectionMask taken = 0;
+  Forecast forecast = {NULL, 0, 0, 0, false};
+  Plan plan = {0, 0, 0};
+  use_precise_timers(clock);
+
+  // nothing happens before the first arrival, and the clock only starts once the threads are created
+  park_thread(&intersection->scheduler_parker);
+
+  while (true)
+  {
+    long long now = get_time_passed_ns(clock);
+
+    // in virtual time the supplier may not have run yet at this time, wait until it stored the arrivals of now
+    if (intersection->options.virtual_time && atomic_load(&intersection->arrivals_until) < now / 1000000000LL)
+    {
+      park_thread(&intersection->scheduler_parker);
+      continue;
+    }
+
+    // with platoons, the lights whose car has passed need to know who waits for them
+    int waiting_since[MAX_LIGHTS];
+    long long waiting_priorities[MAX_LIGHTS];
+    if (intersection->options.platoon > 1)
+    {
+      for (int i = 0; i < num_lights; i++)
+      {
+        bool waiting = !(crossing & (1u << i)) && lane_size(&intersection->lanes[i]) > 0;
+        waiting_since[i] = waiting ? lane_front(&intersection->lanes[i])->time : -1;
+        waiting_priorities[i] = waiting ? light_priority(intersection, i, now) : NO_PRIORITY;
+      }
+    }
+
+    // make the lights whose car has passed turn red, or green for the next car of their platoon
+    for (int i = 0; i < num_lights; i++)
+    {
+      if ((crossing & (1u << i)) && crossing_end[i] <= now)
+      {
+        LaneQueue* lane = &intersection->lanes[i];
+        log_debug("(Scheduler):\t Car %d passed light %d / %d\n", lane_front(lane)->id, lights[i].side, lights[i].direction);
+        passed[i] += 1;
+        if (intersection->options.platoon > 1 && extend_platoon(intersection, i, passed[i], waiting_since, waiting_priorities, now))
+        {
+          lane_pop(lane);
+          car_handled(intersection);
+          const QueuedCar* car = lane_front(lane);
+          int green_time = get_time_passed(clock);
+          print_traffic_light_change(intersection, lights[i].side, lights[i].direction, true, green_time, car->id);
+          histogram_record(&intersection->light_stats[i].waits, green_time > car->time ? green_time - car->time : 0);
+          crossing_end[i] = now + cross_ns;
+          continue;
+        }
+        print_traffic_light_change(intersection, lights[i].side, lights[i].direction, false, get_time_passed(clock), 0);
+        crossing &= ~(1u << i);
+        taken &= ~lights[i].sections;
+        counter_add(&intersection->light_stats[i].hold_time, now - green_since[i]);
+        lane_pop(lane);
+        car_handled(intersection);
+      }
+    }
+
+    // find the lights with a waiting car whose sections are free, and turn the best group of them green
+    uint32_t ready = 0;
+    uint32_t idle = 0;
+    for (int i = 0; i < num_lights; i++)
+    {
+      if (!(crossing & (1u << i)) && (lights[i].sections & taken) == 0)
+      {
+        if (lane_size(&intersection->lanes[i]) > 0)
+        {
+          ready |= 1u << i;
+        }
+        else
+        {
+          idle |= 1u << i;
+        }
+      }
+    }
+    // leave the sections of the waiting lights with priority to them, even when they are not ready yet
+    SectionMask held_back[MAX_LIGHTS] = {0};
+    long long priorities[MAX_LIGHTS];
+    for (int i = 0; i < num_lights; i++)
+    {
+      priorities[i] = NO_PRIORITY;
+    }
+    if (intersection->options.policy != GREEDY_POLICY)
+    {
+      for (int i = 0; i < num_lights; i++)
+      {
+        bool waiting = !(crossing & (1u << i)) && lane_size(&intersection->lanes[i]) > 0;
+        priorities[i] = waiting ? light_priority(intersection, i, now) : NO_PRIORITY;
+      }
+      for (uint32_t candidates = ready; candidates != 0; candidates &= candidates - 1)
+      {
+        int i = __builtin_ctz(candidates);
+        held_back[i] = priority_conflicts(intersection, i, priorities[i], priorities);
+        if (held_back[i] != 0)
+        {
+          ready &= ~(1u << i);
+        }
+      }
+    }
+    SectionMask reserved = 0;
+    uint32_t group = intersection->options.lookahead > 0
+      ? plan_group(intersection, &forecast, &plan, ready, idle, priorities, now, &reserved)
+      : choose_group(intersection, ready, now);
+    for (int i = 0; i < num_lights; i++)
+    {
+      if (group & (1u << i))
+      {
+        const QueuedCar* car = lane_front(&intersection->lanes[i]);
+        int green_time = get_time_passed(clock);
+        print_traffic_light_change(intersection, lights[i].side, lights[i].direction, true, green_time, car->id);
+        histogram_record(&intersection->light_stats[i].waits, green_time > car->time ? green_time - car->time : 0);
+        crossing |= 1u << i;
+        crossing_end[i] = now + cross_ns;
+        green_since[i] = now;
+        passed[i] = 0;
+        taken |= lights[i].sections;
+        if (blocked_since[i] >= 0)
+        {
+          record_blocked(&intersection->light_stats[i], now - blocked_since[i]);
+          blocked_since[i] = -1;
+        }
+      }
+    }
+
+    // the lights with a waiting car that stay red are held up by the sections of the lights that are green
+    //   or reserved for the cars about to arrive, a conflict is counted once when the car is first held back
+    for (int i = 0; i < num_lights; i++)
+    {
+      if (!(crossing & (1u << i)) && lane_size(&intersection->lanes[i]) > 0)
+      {
+        if (blocked_since[i] < 0)
+        {
+          record_conflict(&intersection->light_stats[i], (lights[i].sections & (taken | reserved)) | held_back[i]);
+          blocked_since[i] = now;
+        }
+      }
+    }
+
+    // wait for the next arrival, or the end of the first crossing
+    if (crossing == 0)
+    {
+      if (atomic_load(&intersection->stopping))
+      {
+        break;
+      }
+      park_thread(&intersection->scheduler_parker);
+    }
+    else
+    {
+      long long first_end = -1;
+      for (int i = 0; i < num_lights; i++)
+      {
+        if ((crossing & (1u << i)) && (first_end < 0 || crossing_end[i] < first_end))
+        {
+          first_end = crossing_end[i];
+        }
+      }
+      // a car that gets priority while waiting may have to hold back the next lights
+      if (intersection->options.policy == AGING_POLICY)
+      {
+        for (int i = 0; i < num_lights; i++)
+        {
+          if (!(crossing & (1u << i)) && lane_size(&intersection->lanes[i]) > 0)
+          {
+            long long priority_time = (lane_front(&intersection->lanes[i])->time + intersection->options.max_wait) * 1000000000LL;
+            if (priority_time > now && priority_time < first_end)
+            {
+              first_end = priority_time;
+            }
+          }
+        }
+      }
+      park_thread_until(&intersection->scheduler_parker, first_end);
+    }
+  }
+
+  free(forecast.cars);
+  intersection->scheduler_cpu_time = thread_cpu_time();
+  unregister_thread(clock);
+  return(0);
+}
+
+/*
+ * EventHeap
+ *
+ * The crossings in progress of the event engine, a binary min-heap of the green lights by the end of their crossing
+ * Ties go to the light that comes first in the topology, so the events of a time are handled in a fixed order
+ */
+typedef struct
+{
+  int lights[MAX_LIGHTS];
+  int count;
+  const int* crossing_end;
+} EventHeap;
+
+static bool event_before(const EventHeap* heap, int a, int b)
+{
+  return heap->crossing_end[a] < heap->crossing_end[b] || (heap->crossing_end[a] == heap->crossing_end[b] && a < b);
+}
+
+static void event_push(EventHeap* heap, int light_index)
+{
+  int i = heap->count++;
+  while (i > 0 && event_before(heap, light_index, heap->lights[(i - 1) / 2]))
+  {
+    heap->lights[i] = heap->lights[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  heap->lights[i] = light_index;
+}
+
+static int event_pop(EventHeap* heap)
+{
+  int first = heap->lights[0];
+  int last = heap->lights[--heap->count];
+  int i = 0;
+  while (2 * i + 1 < heap->count)
+  {
+    int child = 2 * i + 1;
+    if (child + 1 < heap->count && event_before(heap, heap->lights[child + 1], heap->lights[child]))
+    {
+      child++;
+    }
+    if (!event_before(heap, heap->lights[child], last))
+    {
+      break;
+    }
+    heap->lights[i] = heap->lights[child];
+    i = child;
+  }
+  heap->lights[i] = last;
+  return first;
+}
+
+/*
+ * event_change(Intersection* intersection, int light_index, GrantKind grant, int time, int for_car)
+ *
+ * Prints the change of a traffic light of the event engine, and records it as a grant when recording
+ */
+static void event_change(Intersection* intersection, int light_index, GrantKind grant, int time, int for_car)
+{
+  const Light* light = &intersection->topology->lights[light_index];
+  print_traffic_light_change(intersection, light->side, light->direction, grant != GRANT_RELEASE, time, for_car);
+  if (intersection->options.grants != NULL)
+  {
+    begin_grant(intersection->options.grants);
+    add_grant(intersection->options.grants, light_index, grant, time * 1000000000LL);
+    end_grant(intersection->options.grants);
+  }
+}
+
+/*
+ * simulate_events(Intersection* intersection)
+ *
+ * Description:
+ * A function that implements the event engine, simulating the traffic lights of the threaded engine in the calling thread.
+ * The events are the arrivals of the trace and the ends of the crossings, kept in an EventHeap,
+ *   the time jumps from one event to the next. At every time with an event:
+ * - Stores the cars that arrive in their lanes.
+ * - Handles the lights whose car has passed in the order of the heap: like keep_sections, a light with a platoon
+ *     turns green for the next car of its lane, the others turn red and free their sections.
+ * - Goes through the lights with a waiting car in the order of the topology, and like try_claim lets each claim
+ *     its sections and turn green when they are free and no conflicting waiting light has priority over it.
+ * The priorities and waiting times are those of the lights at that time, where the threaded engine uses
+ *   the ones the lights published when they last tried to claim.
+ * Stops once every car has passed.
+ */
+static void simulate_events(Intersection* intersection)
+{
+  const Light* lights = intersection->topology->lights;
+  const int num_lights = intersection->topology->num_lights;
+  const IntersectionOptions* options = &intersection->options;
+  int crossing_end[MAX_LIGHTS];
+  int green_since[MAX_LIGHTS];
+  int passed[MAX_LIGHTS];
+  // the time since which the car at the front of the lane was held up by conflicting lights, or -1
+  int blocked_since[MAX_LIGHTS];
+  for (int i = 0; i < num_lights; i++)
+  {
+    blocked_since[i] = -1;
+  }
+  EventHeap ends = {.count = 0, .crossing_end = crossing_end};
+  uint32_t crossing = 0;
+  SectionMask taken = 0;
+  uint64_t cpu_start = thread_cpu_time();
+
+  Arrival arrival;
+  bool arriving = next_arrival(intersection->arrival_loader, &arrival);
+  int now = 0;
+  while (arriving || ends.count > 0)
+  {
+    // move on to the next event, a car of the trace that is late arrives right away like with the supplier
+    int next = ends.count > 0 ? crossing_end[ends.lights[0]] : INT_MAX;
+    if (arriving && arrival.time < next)
+    {
+      next = arrival.time;
+    }
+    if (next > now)
+    {
+      now = next;
+      atomic_store_explicit(&intersection->event_time, now, memory_order_relaxed);
+    }
+    long long now_ns = now * 1000000000LL;
+
+    // store the cars that arrive now in their lanes
+    while (arriving && arrival.time <= now)
+    {
+      log_debug("(Events):\t Next arrival (%d): %d / %d @ t%d\n", arrival.id, arrival.side, arrival.direction, arrival.time);
+      int light_index = topology_light(intersection->topology, arrival.side, arrival.direction);
+      if (light_index < 0)
+      {
+        log_error("(Events):\t No traffic light for lane %d / %d, skipping car %d\n", arrival.side, arrival.direction, arrival.id);
+      }
+      else if (!lane_push(&intersection->lanes[light_index], arrival))
+      {
+        log_error("(Events):\t Out of memory, dropping car %d\n", arrival.id);
+      }
+      else
+      {
+        record_ingest(intersection);
+        if (options->policy == ADAPTIVE_POLICY)
+        {
+          ArrivalWindow* window = &intersection->arrival_windows[light_index];
+          unsigned count = atomic_load_explicit(&window->count, memory_order_relaxed);
+          atomic_store_explicit(&window->times[count % ARRIVAL_HISTORY], arrival.time, memory_order_relaxed);
+          atomic_store_explicit(&window->count, count + 1, memory_order_relaxed);
+        }
+      }
+      arriving = next_arrival(intersection->arrival_loader, &arrival);
+    }
+
+    // with platoons, the lights whose car has passed need to know who waits for them
+    int waiting_since[MAX_LIGHTS];
+    long long priorities[MAX_LIGHTS];
+    for (int i = 0; i < num_lights; i++)
+    {
+      bool waiting = !(crossing & (1u << i)) && lane_size(&intersection->lanes[i]) > 0;
+      waiting_since[i] = waiting ? lane_front(&intersection->lanes[i])->time : -1;
+      priorities[i] = waiting ? light_priority(intersection, i, now_ns) : NO_PRIORITY;
+    }
+
+    // make the lights whose car has passed turn green for the next car of their platoon, or red
+    while (ends.count > 0 && crossing_end[ends.lights[0]] <= now)
+    {
+      int i = event_pop(&ends);
+      LaneQueue* lane = &intersection->lanes[i];
+      log_debug("(Events):\t Car %d passed light %d / %d\n", lane_front(lane)->id, lights[i].side, lights[i].direction);
+      passed[i] += 1;
+      if (options->platoon > 1 && extend_platoon(intersection, i, passed[i], waiting_since, priorities, now_ns))
+      {
+        lane_pop(lane);
+        const QueuedCar* car = lane_front(lane);
+        event_change(intersection, i, GRANT_KEEP, now, car->id);
+        histogram_record(&intersection->light_stats[i].waits, now > car->time ? now - car->time : 0);
+        crossing_end[i] = now + options->cross_time;
+        event_push(&ends, i);
+        continue;
+      }
+      event_change(intersection, i, GRANT_RELEASE, now, 0);
+      crossing &= ~(1u << i);
+      taken &= ~lights[i].sections;
+      counter_add(&intersection->light_stats[i].hold_time, (now - green_since[i]) * 1000000000LL);
+      lane_pop(lane);
+    }
+
+    // let the lights with a waiting car claim their sections in the order of the topology
+    for (int i = 0; i < num_lights; i++)
+    {
+      bool waiting = !(crossing & (1u << i)) && lane_size(&intersection->lanes[i]) > 0;
+      priorities[i] = waiting ? light_priority(intersection, i, now_ns) : NO_PRIORITY;
+    }
+    for (int i = 0; i < num_lights; i++)
+    {
+      if ((crossing & (1u << i)) || lane_size(&intersection->lanes[i]) == 0)
+      {
+        continue;
+      }
+      SectionMask conflicts = lights[i].sections & taken;
+      if (options->policy != GREEDY_POLICY)
+      {
+        conflicts |= priority_conflicts(intersection, i, priorities[i], priorities);
+      }
+      if (conflicts != 0)
+      {
+        // counted once when the car is first held back, like a failed claim of the threaded engine
+        if (blocked_since[i] < 0)
+        {
+          record_conflict(&intersection->light_stats[i], conflicts);
+          blocked_since[i] = now;
+        }
+        continue;
+      }
+      // a light that holds its sections no longer holds the conflicting lights back
+      priorities[i] = NO_PRIORITY;
+      const QueuedCar* car = lane_front(&intersection->lanes[i]);
+      event_change(intersection, i, GRANT_CLAIM, now, car->id);
+      histogram_record(&intersection->light_stats[i].waits, now > car->time ? now - car->time : 0);
+      crossing |= 1u << i;
+      taken |= lights[i].sections;
+      crossing_end[i] = now + options->cross_time;
+      green_since[i] = now;
+      passed[i] = 0;
+      event_push(&ends, i);
+      if (blocked_since[i] >= 0)
+      {
+        record_blocked(&intersection->light_stats[i], (now - blocked_since[i]) * 1000000000LL);
+        blocked_since[i] = -1;
+      }
+    }
+  }
+
+  intersection->scheduler_cpu_time = thread_cpu_time() - cpu_start;
+}
+
+Intersection* create_intersection(const Topology* topology, const IntersectionOptions* options)
+{
+  if (options->grants != NULL)
+  {
+    if (options->engine == BATCH_ENGINE)
+    {
+      log_error("(Controller):\t Grants are only recorded and replayed with the threaded engine, the batch engine decides alone\n");
+      return NULL;
+    }
+    // the event engine always simulates time, and so records the times of a run in virtual time
+    GrantSettings settings = {topology->num_lights, options->cross_time, options->policy, options->max_wait,
+      options->platoon, options->platoon_wait, options->virtual_time || options->engine == EVENT_ENGINE};
+    if (options->engine == EVENT_ENGINE && next_grant(options->grants, &(GrantKind){0}, &(long long){0}) >= 0)
+    {
+      log_error("(Controller):\t The event engine only records grants, replay them with the threaded engine\n");
+      return NULL;
+    }
+    if (!use_grant_settings(options->grants, &settings))
+    {
+      return NULL;
+    }
+  }
+  if (options->lookahead > 0 && (options->engine != BATCH_ENGINE || options->forecast == NULL))
+  {
+    log_error("(Controller):\t A lookahead plans the groups of the batch engine, and needs a forecast of the trace\n");
+    return NULL;
+  }
+  Intersection* intersection = aligned_alloc(CACHE_LINE_SIZE, sizeof(Intersection));
+  if (intersection == NULL)
+  {
+    log_error("(Controller):\t Out of memory\n");
+    return NULL;
+  }
+  memset(intersection, 0, sizeof(Intersection));
+  intersection->topology = topology;
+  intersection->options = *options;
+  init_clock(&intersection->clock);
+  if (options->virtual_time)
+  {
+    use_virtual_time(&intersection->clock);
+  }
+  set_time_scale(&intersection->clock, options->time_scale);
+  atomic_init(&intersection->sections_taken, 0);
+  atomic_init(&intersection->waiting_lights, 0);
+  for (int i = 0; i < MAX_LIGHTS; i++)
+  {
+    atomic_init(&intersection->light_states[i].priority, NO_PRIORITY);
+    atomic_init(&intersection->light_states[i].waiting_since, -1);
+  }
+  atomic_init(&intersection->cars_remaining, 1);
+  atomic_init(&intersection->stopping, false);
+  atomic_init(&intersection->running, false);
+  pthread_mutex_init(&intersection->all_handled_lock, NULL);
+  pthread_cond_init(&intersection->all_handled_changed, NULL);
+  init_parker(&intersection->scheduler_parker, &intersection->clock);
+  atomic_init(&intersection->arrivals_until, -1);
+  atomic_init(&intersection->supplied, false);
+  atomic_init(&intersection->event_time, 0);
+  atomic_init(&intersection->num_cpu_clocks, 0);
+
+  // create the queue of arrivals, the parker and the statistics of every traffic light,
+  //   each on their own cache lines so the lights do not slow each other down
+  int num_lights = topology->num_lights;
+  intersection->lanes = aligned_alloc(CACHE_LINE_SIZE, num_lights * sizeof(LaneQueue));
+  intersection->light_stats = aligned_alloc(CACHE_LINE_SIZE, num_lights * sizeof(LightStats));
+  intersection->arrival_windows = aligned_alloc(CACHE_LINE_SIZE, num_lights * sizeof(ArrivalWindow));
+  intersection->parkers = aligned_alloc(CACHE_LINE_SIZE, num_lights * sizeof(Parker));
+  intersection->light_threads = calloc(num_lights, sizeof(LightThread));
+  if (intersection->lanes == NULL || intersection->light_stats == NULL || intersection->arrival_windows == NULL
+    || intersection->parkers == NULL || intersection->light_threads == NULL)
+  {
+    log_error("(Controller):\t Out of memory\n");
+    free(intersection->lanes);
+    free(intersection->light_stats);
+    free(intersection->arrival_windows);
+    free(intersection->parkers);
+    free(intersection->light_threads);
+    destroy_parker(&intersection->scheduler_parker);
+    pthread_mutex_destroy(&intersection->all_handled_lock);
+    pthread_cond_destroy(&intersection->all_handled_changed);
+    destroy_clock(&intersection->clock);
+    free(intersection);
+    return NULL;
+  }
+  memset(intersection->light_stats, 0, num_lights * sizeof(LightStats));
+  memset(intersection->arrival_windows, 0, num_lights * sizeof(ArrivalWindow));
+  memset(intersection->lanes, 0, num_lights * sizeof(LaneQueue));
+  for (int i = 0; i < num_lights; i++)
+  {
+    init_parker(&intersection->parkers[i], &intersection->clock);
+    intersection->light_threads[i].intersection = intersection;
+    intersection->light_threads[i].light_index = i;
+  }
+  for (int i = 0; i < num_lights; i++)
+  {
+    if (!lane_init(&intersection->lanes[i]))
+    {
+      log_error("(Controller):\t Out of memory\n");
+      destroy_intersection(intersection);
+      return NULL;
+    }
+  }
+  return intersection;
+}
+
+/*
+ * stop_lights(Intersection* intersection, pthread_t* threads, int num_threads)
+ *
+ * Stops the traffic light threads once their lanes are empty, and waits for them
+ */
+static void stop_lights(Intersection* intersection, pthread_t* threads, int num_threads)
+{
+  atomic_store(&intersection->num_cpu_clocks, 0);
+  atomic_store(&intersection->stopping, true);
+  unpark_thread(&intersection->scheduler_parker);
+  for (int i = 0; i < intersection->topology->num_lights; i++)
+  {
+    unpark_thread(&intersection->parkers[i]);
+  }
+  for (int i = 0; i < num_threads; i++)
+  {
+    pthread_join(threads[i], NULL);
+  }
+}
+
+/*
+ * create_thread(Intersection* intersection, pthread_t* thread, bool supplier, int index, void* (*run)(void*), void* arg)
+ *
+ * Creates the supplier, or the traffic light thread or scheduler with the given index,
+ *   on the CPUs and with the priority the placement of the intersection gives it
+ * Returns the error of pthread_create, 0 when the thread runs
+ */
+static int create_thread(Intersection* intersection, pthread_t* thread, bool supplier, int index, void* (*run)(void*), void* arg)
+{
+  const ThreadPlacement* placement = intersection->options.placement;
+  if (placement == NULL)
+  {
+    return pthread_create(thread, NULL, run, arg);
+  }
+  pthread_attr_t attr;
+  placement_attr(supplier ? &placement->supplier : &placement->lights, placement->priority, index, &attr);
+  int error = pthread_create(thread, &attr, run, arg);
+  pthread_attr_destroy(&attr);
+  return error;
+}
+
+/*
+ * wall_time_since(const struct timespec* start)
+ *
+ * Returns the real time in seconds since start
+ */
+static double wall_time_since(const struct timespec* start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+bool run_intersection(Intersection* intersection, ArrivalLoader* loader)
+{
+  Clock* clock = &intersection->clock;
+  intersection->arrival_loader = loader;
+
+  // the event engine needs no threads and no clock
+  if (intersection->options.engine == EVENT_ENGINE)
+  {
+    log_info("(Controller):\t Simulating the events...\n");
+    clock_gettime(CLOCK_MONOTONIC, &intersection->wall_start);
+    atomic_store(&intersection->running, true);
+    simulate_events(intersection);
+    log_info("(Controller):\t All cars handled\n");
+    intersection->simulated_time = atomic_load(&intersection->event_time);
+    intersection->wall_time = wall_time_since(&intersection->wall_start);
+    atomic_store(&intersection->running, false);
+    return true;
+  }
+
+  // create a thread per traffic light that executes manage_light, or a single thread that executes schedule_lights
+  pthread_t light_threads[MAX_LIGHTS];
+  int num_light_threads = intersection->options.engine == BATCH_ENGINE ? 1 : intersection->topology->num_lights;
+  log_info("(Controller):\t Creating traffic light threads...\n");
+  for (int i = 0; i < num_light_threads; i++)
+  {
+    register_thread(clock);
+    int error = intersection->options.engine == BATCH_ENGINE
+      ? create_thread(intersection, &light_threads[i], false, i, schedule_lights, intersection)
+      : create_thread(intersection, &light_threads[i], false, i, manage_light, &intersection->light_threads[i]);
+    if (error != 0)
+    {
+      log_error("(Controller):\t Cannot create traffic light thread %d: %s\n", i, strerror(error));
+      unregister_thread(clock);
+      stop_lights(intersection, light_threads, i);
+      return false;
+    }
+    pthread_getcpuclockid(light_threads[i], &intersection->cpu_clocks[i]);
+  }
+  atomic_store(&intersection->num_cpu_clocks, num_light_threads);
+  log_info("(Controller):\t Traffic light threads created\n");
+
+  // start the timer
+  log_info("(Controller):\t Starting timer...\n");
+  start_time(clock);
+  clock_gettime(CLOCK_MONOTONIC, &intersection->wall_start);
+  atomic_store(&intersection->running, true);
+  log_info("(Controller):\t Timer started\n");
+
+  // create a thread that executes supply_arrivals
+  pthread_t arrival_thread;
+  log_info("(Controller):\t Creating arrival thread...\n");
+  register_thread(clock);
+  int error = create_thread(intersection, &arrival_thread, true, 0, supply_arrivals, intersection);
+  if (error != 0)
+  {
+    log_error("(Controller):\t Cannot create arrival thread: %s\n", strerror(error));
+    unregister_thread(clock);
+    stop_lights(intersection, light_threads, num_light_threads);
+    atomic_store(&intersection->running, false);
+    return false;
+  }
+  log_info("(Controller):\t Arrival thread created\n");
+
+  // wait for all arrivals to finish
+  log_info("(Controller):\t Waiting for threads to finish...\n");
+  pthread_join(arrival_thread, NULL);
+  log_info("(Controller):\t Arrival thread finished\n");
+
+  // wait for all cars to be handled, signalled by whoever handles the last one
+  lock_mutex(&intersection->all_handled_lock, "all handled");
+  while (!intersection->all_handled)
+  {
+    wait_condition(&intersection->all_handled_changed, &intersection->all_handled_lock, "all handled");
+  }
+  unlock_mutex(&intersection->all_handled_lock);
+
+  log_info("(Controller):\t All cars handled\n");
+
+  // stop all traffic light threads
+  log_info("(Controller):\t Stopping traffic light threads...\n");
+  stop_lights(intersection, light_threads, num_light_threads);
+  log_info("(Controller):\t Traffic light threads stopped\n");
+
+  intersection->simulated_time = get_time_passed(clock);
+  intersection->wall_time = wall_time_since(&intersection->wall_start);
+  atomic_store(&intersection->running, false);
+  return true;
+}
+
+/*
+ * print_light_conflicts(const Light* light, const LightStats* stats)
+ *
+ * Prints how often and how long the traffic light was held up by conflicting lights, and on which sections
+ */
+static void print_light_conflicts(const Light* light, const LightStats* stats)
+{
+  const Histogram* blocked = &stats->blocked;
+  fprintf(stderr, "(Stats):\t lane %d / %d: failed claims %lu, blocked %.3f s (p50 %lu us, p99 %lu us), held %.3f s",
+    light->side, light->direction, stats->failed_claims, stats->blocked_time / 1e9,
+    histogram_percentile(blocked, 50), histogram_percentile(blocked, 99), stats->hold_time / 1e9);
+  const char* separator = ", conflicts on sections ";
+  for (int section = 0; section < 32; section++)
+  {
+    if (stats->section_conflicts[section] > 0)
+    {
+      fprintf(stderr, "%s%d: %lu", separator, section + 1, stats->section_conflicts[section]);
+      separator = ", ";
+    }
+  }
+  fprintf(stderr, "\n");
+}
+
+void print_intersection_stats(Intersection* intersection)
+{
+  const Topology* topology = intersection->topology;
+  bool running = atomic_load(&intersection->running);
+  double wall_time = running ? wall_time_since(&intersection->wall_start) : intersection->wall_time;
+  int simulated_time = !running ? intersection->simulated_time
+    : intersection->options.engine == EVENT_ENGINE ? atomic_load(&intersection->event_time) : get_time_passed(&intersection->clock);
+  // copy the counters first, the lights may still be updating them
+  LightStats* light_stats = aligned_alloc(CACHE_LINE_SIZE, topology->num_lights * sizeof(LightStats));
+  if (light_stats == NULL)
+  {
+    log_error("(Stats):\t Out of memory\n");
+    return;
+  }
+  uint64_t cars = 0;
+  for (int i = 0; i < topology->num_lights; i++)
+  {
+    light_stats_snapshot(&light_stats[i], &intersection->light_stats[i]);
+    cars += light_stats[i].waits.count;
+  }
+  fprintf(stderr, "(Stats):\t cars %lu, simulated time %d s, wall time %.6f s\n", cars, simulated_time, wall_time);
+  fprintf(stderr, "(Stats):\t throughput %.3f cars/s simulated, %.1f cars/s wall\n",
+    simulated_time > 0 ? cars / (double)simulated_time : 0.0, wall_time > 0 ? cars / wall_time : 0.0);
+  for (int i = 0; i < topology->num_lights; i++)
+  {
+    const Histogram* waits = &light_stats[i].waits;
+    fprintf(stderr, "(Stats):\t lane %d / %d: cars %lu, wait mean %.2f s, p50 %lu s, p99 %lu s, max %lu s, cpu %.3f ms\n",
+      topology->lights[i].side, topology->lights[i].direction, waits->count, waits->count > 0 ? waits->sum / (double)waits->count : 0.0,
+      histogram_percentile(waits, 50), histogram_percentile(waits, 99), waits->max, light_stats[i].cpu_time / 1e6);
+    print_light_conflicts(&topology->lights[i], &light_stats[i]);
+  }
+  if (!intersection->options.virtual_time && intersection->options.engine == THREADED_ENGINE)
+  {
+    Histogram latency = {0};
+    for (int i = 0; i < topology->num_lights; i++)
+    {
+      histogram_merge(&latency, &light_stats[i].latency);
+    }
+    const Histogram* lateness = &intersection->supplier_lateness;
+    fprintf(stderr, "(Stats):\t arrival to green for %lu cars at a free light: p50 %lu us, p99 %lu us, max %lu us, "
+      "supplier late p50 %lu us, p99 %lu us, max %lu us\n", latency.count, histogram_percentile(&latency, 50),
+      histogram_percentile(&latency, 99), latency.max, histogram_percentile(lateness, 50), histogram_percentile(lateness, 99), lateness->max);
+  }
+  const Histogram* ingest = &intersection->ingest_latency;
+  if (ingest->count > 0)
+  {
+    fprintf(stderr, "(Stats):\t receipt to lane for %lu live arrivals: p50 %lu us, p99 %lu us, max %lu us\n", ingest->count,
+      histogram_percentile(ingest, 50), histogram_percentile(ingest, 99), ingest->max);
+  }
+  free(light_stats);
+  // the scheduler only sets its CPU time when it stops
+  if (intersection->options.engine != THREADED_ENGINE && !running)
+  {
+    fprintf(stderr, "(Stats):\t %s: cpu %.3f ms\n", intersection->options.engine == BATCH_ENGINE ? "scheduler" : "events",
+      intersection->scheduler_cpu_time / 1e6);
+  }
+}
+
+/*
+ * write_summary(FILE* out, const char* name, const char* labels, const Histogram* histogram, double unit)
+ *
+ * Writes the samples of a metric of type summary with the labels, the 50th, 90th and 99th percentile,
+ *   the sum and the count of the histogram, whose values are converted to seconds by multiplying with unit
+ */
+static void write_summary(FILE* out, const char* name, const char* labels, const Histogram* histogram, double unit)
+{
+  static const double quantiles[] = {50, 90, 99};
+  for (int q = 0; q < 3; q++)
+  {
+    fprintf(out, "%s{%s%squantile=\"%g\"} %g\n", name, labels, labels[0] != '\0' ? "," : "", quantiles[q] / 100,
+      histogram_percentile(histogram, quantiles[q]) * unit);
+  }
+  const char* open = labels[0] != '\0' ? "{" : "";
+  const char* close = labels[0] != '\0' ? "}" : "";
+  fprintf(out, "%s_sum%s%s%s %g\n", name, open, labels, close, histogram->sum * unit);
+  fprintf(out, "%s_count%s%s%s %lu\n", name, open, labels, close, histogram->count);
+}
+
+void write_intersection_metrics(Intersection* intersection, FILE* out)
+{
+  const Topology* topology = intersection->topology;
+  int num_lights = topology->num_lights;
+  bool running = atomic_load(&intersection->running);
+  int simulated_time = !running ? intersection->simulated_time
+    : intersection->options.engine == EVENT_ENGINE ? atomic_load(&intersection->event_time) : get_time_passed(&intersection->clock);
+  LightStats* light_stats = aligned_alloc(CACHE_LINE_SIZE, num_lights * sizeof(LightStats));
+  if (light_stats == NULL)
+  {
+    log_error("(Stats):\t Out of memory\n");
+    return;
+  }
+  char labels[MAX_LIGHTS][32];
+  for (int i = 0; i < num_lights; i++)
+  {
+    light_stats_snapshot(&light_stats[i], &intersection->light_stats[i]);
+    snprintf(labels[i], sizeof(labels[i]), "side=\"%d\",direction=\"%d\"", topology->lights[i].side, topology->lights[i].direction);
+  }
+
+  fprintf(out, "# HELP intersection_running Whether the simulation runs.\n# TYPE intersection_running gauge\n");
+  fprintf(out, "intersection_running %d\n", running);
+  fprintf(out, "# HELP intersection_simulated_seconds The simulated time.\n# TYPE intersection_simulated_seconds gauge\n");
+  fprintf(out, "intersection_simulated_seconds %d\n", simulated_time);
+  fprintf(out, "# HELP intersection_queue_depth The cars waiting or crossing in the lane.\n# TYPE intersection_queue_depth gauge\n");
+  for (int i = 0; i < num_lights; i++)
+  {
+    fprintf(out, "intersection_queue_depth{%s} %zu\n", labels[i], lane_size(&intersection->lanes[i]));
+  }
+  fprintf(out, "# HELP intersection_greens_total The times the light turned green, one per car.\n# TYPE intersection_greens_total counter\n");
+  for (int i = 0; i < num_lights; i++)
+  {
+    fprintf(out, "intersection_greens_total{%s} %lu\n", labels[i], light_stats[i].waits.count);
+  }
+  fprintf(out, "# HELP intersection_wait_seconds The time from the arrival of a car to its green light.\n# TYPE intersection_wait_seconds summary\n");
+  for (int i = 0; i < num_lights; i++)
+  {
+    write_summary(out, "intersection_wait_seconds", labels[i], &light_stats[i].waits, 1);
+  }
+  fprintf(out, "# HELP intersection_blocked_seconds The time a car at the front of the lane waited for conflicting lights.\n"
+    "# TYPE intersection_blocked_seconds summary\n");
+  for (int i = 0; i < num_lights; i++)
+  {
+    write_summary(out, "intersection_blocked_seconds", labels[i], &light_stats[i].blocked, 1e-6);
+  }
+  fprintf(out, "# HELP intersection_failed_claims_total The claims of the light that found a section taken or left to a light with priority.\n"
+    "# TYPE intersection_failed_claims_total counter\n");
+  for (int i = 0; i < num_lights; i++)
+  {
+    fprintf(out, "intersection_failed_claims_total{%s} %lu\n", labels[i], light_stats[i].failed_claims);
+  }
+  fprintf(out, "# HELP intersection_section_conflicts_total The failed claims of the light that found the section taken.\n"
+    "# TYPE intersection_section_conflicts_total counter\n");
+  for (int i = 0; i < num_lights; i++)
+  {
+    for (SectionMask sections = topology->lights[i].sections; sections != 0; sections &= sections - 1)
+    {
+      int section = __builtin_ctz(sections);
+      fprintf(out, "intersection_section_conflicts_total{%s,section=\"%d\"} %lu\n", labels[i], section + 1,
+        light_stats[i].section_conflicts[section]);
+    }
+  }
+  fprintf(out, "# HELP intersection_hold_seconds_total The simulated time the light held its sections.\n"
+    "# TYPE intersection_hold_seconds_total counter\n");
+  for (int i = 0; i < num_lights; i++)
+  {
+    fprintf(out, "intersection_hold_seconds_total{%s} %g\n", labels[i], light_stats[i].hold_time / 1e9);
+  }
+
+  // the threads that still run are asked for their CPU time, the others stored it when they stopped
+  fprintf(out, "# HELP intersection_cpu_seconds_total The CPU time of the threads of the engine.\n"
+    "# TYPE intersection_cpu_seconds_total counter\n");
+  int num_cpu_clocks = atomic_load(&intersection->num_cpu_clocks);
+  if (intersection->options.engine == THREADED_ENGINE)
+  {
+    for (int i = 0; i < num_lights; i++)
+    {
+      struct timespec time;
+      double cpu_time = i < num_cpu_clocks && clock_gettime(intersection->cpu_clocks[i], &time) == 0
+        ? time.tv_sec + time.tv_nsec / 1e9 : light_stats[i].cpu_time / 1e9;
+      fprintf(out, "intersection_cpu_seconds_total{thread=\"light\",%s} %g\n", labels[i], cpu_time);
+    }
+  }
+  else
+  {
+    struct timespec time;
+    double cpu_time = num_cpu_clocks > 0 && clock_gettime(intersection->cpu_clocks[0], &time) == 0
+      ? time.tv_sec + time.tv_nsec / 1e9 : intersection->scheduler_cpu_time / 1e9;
+    fprintf(out, "intersection_cpu_seconds_total{thread=\"%s\"} %g\n",
+      intersection->options.engine == BATCH_ENGINE ? "scheduler" : "events", cpu_time);
+  }
+
+  if (!intersection->options.virtual_time && intersection->options.engine == THREADED_ENGINE)
+  {
+    Histogram latency = {0};
+    for (int i = 0; i < num_lights; i++)
+    {
+      histogram_merge(&latency, &light_stats[i].latency);
+    }
+    fprintf(out, "# HELP intersection_green_latency_seconds The real time from the arrival of a car at a free light to its green light.\n"
+      "# TYPE intersection_green_latency_seconds summary\n");
+    write_summary(out, "intersection_green_latency_seconds", "", &latency, 1e-6);
+    fprintf(out, "# HELP intersection_supplier_lateness_seconds How late the supplier woke up for an arrival.\n"
+      "# TYPE intersection_supplier_lateness_seconds summary\n");
+    write_summary(out, "intersection_supplier_lateness_seconds", "", &intersection->supplier_lateness, 1e-6);
+  }
+  if (intersection->ingest_latency.count > 0)
+  {
+    fprintf(out, "# HELP intersection_ingest_latency_seconds The real time from the receipt of a live arrival to its car in its lane.\n"
+      "# TYPE intersection_ingest_latency_seconds summary\n");
+    write_summary(out, "intersection_ingest_latency_seconds", "", &intersection->ingest_latency, 1e-6);
+  }
+  free(light_stats);
+}
+
+void summarize_intersection(Intersection* intersection, IntersectionSummary* summary)
+{
+  Histogram waits = {0};
+  memset(summary, 0, sizeof(IntersectionSummary));
+  for (int i = 0; i < intersection->topology->num_lights; i++)
+  {
+    const LightStats* stats = &intersection->light_stats[i];
+    histogram_merge(&waits, &stats->waits);
+    summary->failed_claims += stats->failed_claims;
+    summary->blocked_time += stats->blocked_time / 1e9;
+    summary->cpu_time += stats->cpu_time / 1e9;
+  }
+  if (intersection->options.engine != THREADED_ENGINE)
+  {
+    summary->cpu_time += intersection->scheduler_cpu_time / 1e9;
+  }
+  summary->cars = waits.count;
+  summary->simulated_time = intersection->simulated_time;
+  summary->wall_time = intersection->wall_time;
+  summary->wait_mean = waits.count > 0 ? waits.sum / (double)waits.count : 0.0;
+  summary->wait_p50 = histogram_percentile(&waits, 50);
+  summary->wait_p99 = histogram_percentile(&waits, 99);
+  summary->wait_max = waits.max;
+}
+
+void destroy_intersection(Intersection* intersection)
+{
+  for (int i = 0; i < intersection->topology->num_lights; i++)
+  {
+    lane_destroy(&intersection->lanes[i]);
+    destroy_parker(&intersection->parkers[i]);
   }
+  destroy_parker(&intersection->scheduler_parker);
+  pthread_mutex_destroy(&intersection->all_handled_lock);
+  pthread_cond_destroy(&intersection->all_handled_changed);
+  destroy_clock(&intersection->clock);
+  free(intersection->lanes);
+  free(intersection->light_stats);
+  free(intersection->arrival_windows);
+  free(intersection->parkers);
+  free(intersection->light_threads);
+  free(intersection);
 }
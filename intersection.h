@@ -0,0 +1,195 @@
+#ifndef INTERSECTION_H
+#define INTERSECTION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "arrival_loader.h"
+#include "grant_log.h"
+#include "output.h"
+#include "placement.h"
+#include "topology.h"
+
+/*
+ * Engine
+ *
+ * How the traffic lights are controlled:
+ * THREADED_ENGINE: a thread per traffic light, each claiming its own sections (manage_light)
+ * BATCH_ENGINE: a single scheduler that greens the largest group of compatible lights at once (schedule_lights)
+ * EVENT_ENGINE: no threads, the calling thread simulates the lights of the threaded engine from a queue of events
+ *   (simulate_events), always in simulated time, the output is that of the threaded engine where the lights
+ *   that are ready at the same time claim their sections in the order of the topology
+ */
+typedef enum {THREADED_ENGINE, BATCH_ENGINE, EVENT_ENGINE} Engine;
+
+/*
+ * Policy
+ *
+ * Which traffic light goes first when lights with a waiting car conflict
+ * A light only turns green when no conflicting light with a waiting car has priority over it,
+ *   so the waiting light with the highest priority can never be starved by the lights around it
+ * GREEDY_POLICY: no priority, the first light to claim its sections wins (the largest group in the batch engine)
+ * FIFO_POLICY: the light whose car arrived first, across all lanes
+ * QUEUE_POLICY: the light with the longest queue
+ * AGING_POLICY: like GREEDY_POLICY until a car has waited max_wait seconds, from then on its light has priority,
+ *   the car that arrived first if several have, so a car waits at most max_wait plus the crossings of the cars
+ *   that had claimed its sections or that got priority before it
+ * ADAPTIVE_POLICY: no priority, but the lights adapt to the live load: the demand of a light is its queue length
+ *   plus the cars expected to arrive during a crossing, from its arrival rate over the last ADAPTIVE_WINDOW seconds
+ *   The batch engine greens the group with the highest total demand instead of the largest group,
+ *     and with platoons a green light only keeps its sections while its own demand is at least that of every
+ *     conflicting waiting light, so green time follows the load
+ * Ties go to the light that comes first in the topology
+ */
+typedef enum {GREEDY_POLICY, FIFO_POLICY, QUEUE_POLICY, AGING_POLICY, ADAPTIVE_POLICY} Policy;
+
+// the time in seconds over which ADAPTIVE_POLICY measures the arrival rate of each lane
+#define ADAPTIVE_WINDOW 60
+
+// the default time in seconds after which a waiting car gets priority with AGING_POLICY
+#define MAX_WAIT 30
+
+// the most cars a light passes per green with ADAPTIVE_POLICY, unless a platoon is given
+#define ADAPTIVE_PLATOON 16
+
+/*
+ * parse_policy(const char* name, Policy* policy, int* max_wait)
+ *
+ * get the policy with the name greedy, fifo, queue, adaptive or aging[:max_wait],
+ *   and for the latter store max_wait when it is given
+ * returns false (and logs the reason) for an unknown name
+ */
+bool parse_policy(const char* name, Policy* policy, int* max_wait);
+
+/*
+ * IntersectionOptions
+ *
+ * How an intersection is simulated
+ * engine: how the traffic lights are controlled
+ * cross_time: the time in seconds it takes a car to cross the intersection
+ * policy: which light goes first when lights conflict
+ * max_wait: with AGING_POLICY, the time in seconds after which a waiting car gets priority
+ * platoon: the most cars a light passes per green, it keeps its sections for the next car in its lane
+ *   until platoon cars have passed, the lane is empty or a conflicting light goes first, 1 for a car per green
+ * platoon_wait: when more than 0, a platoon also ends once a car of a conflicting light has waited this many seconds
+ * virtual_time: simulate time instead of waiting in real time, with the same output
+ * time_scale: how many times as fast as real time the simulation runs, 1 for real time
+ * output: called with every light change, or NULL to write them to the output chosen in output.h
+ * output_arg: passed to output
+ * grants: with the threaded engine, a log to record the order in which the lights claim their sections in,
+ *   or to replay that order from so that the run repeats a recorded one, NULL to let the lights run freely
+ *   The event engine can record a log, which the threaded engine replays with the same output
+ * placement: the CPUs and the SCHED_FIFO priority of the supplier and the traffic light threads,
+ *   NULL to create them with the default attributes
+ * lookahead: with the batch engine, the horizon in seconds over which the scheduler plans its groups with the cars
+ *   that have yet to arrive, 0 to only look at the cars that have arrived
+ *   A light may then stay red for a car that arrives before a crossing started now would end,
+ *     when the group of that car passes more cars within the horizon, see schedule_lights
+ * forecast: with a lookahead, a second loader of the same trace as the one given to run_intersection,
+ *   which the scheduler reads ahead of the supplier to know the coming arrivals
+ */
+typedef struct
+{
+  Engine engine;
+  int cross_time;
+  Policy policy;
+  int max_wait;
+  int platoon;
+  int platoon_wait;
+  bool virtual_time;
+  double time_scale;
+  LightChangeCallback output;
+  void* output_arg;
+  GrantLog* grants;
+  const ThreadPlacement* placement;
+  int lookahead;
+  ArrivalLoader* forecast;
+} IntersectionOptions;
+
+/*
+ * Intersection
+ *
+ * One simulation of an intersection: its lanes, sections and traffic lights, its own clock and its statistics
+ * Intersections share no state, so any number of them can run in one process at the same time
+ */
+typedef struct Intersection Intersection;
+
+/*
+ * create_intersection(const Topology* topology, const IntersectionOptions* options)
+ *
+ * create an intersection with the given layout, which has to stay valid until the intersection is destroyed
+ * returns NULL (and logs the reason) when out of memory, when the grants cannot be replayed with these options,
+ *   or when a lookahead is given without the batch engine or a forecast
+ */
+Intersection* create_intersection(const Topology* topology, const IntersectionOptions* options);
+
+/*
+ * run_intersection(Intersection* intersection, ArrivalLoader* loader)
+ *
+ * simulate the intersection until every arrival of the trace has passed, can only be called once
+ * the event engine runs in the calling thread
+ * returns false (and logs the reason) when the threads of the simulation cannot be created,
+ *   for example when the process may not use SCHED_FIFO
+ */
+bool run_intersection(Intersection* intersection, ArrivalLoader* loader);
+
+/*
+ * print_intersection_stats(Intersection* intersection)
+ *
+ * print the throughput, the wait times per lane, the CPU time per traffic light,
+ *   and how often, how long and on which sections each light was held up by conflicting lights, to stderr
+ * may be called while the intersection runs, for example from a signal handling thread,
+ *   the counters are then read while the lights update them and only approximately consistent
+ */
+void print_intersection_stats(Intersection* intersection);
+
+/*
+ * write_intersection_metrics(Intersection* intersection, FILE* out)
+ *
+ * write the queue depth, greens, wait and blocked time quantiles, failed claims and conflicts per section,
+ *   and the CPU time of every traffic light, in the Prometheus text format
+ * may be called while the intersection runs, it only reads the counters the lights keep, like print_intersection_stats
+ */
+void write_intersection_metrics(Intersection* intersection, FILE* out);
+
+/*
+ * IntersectionSummary
+ *
+ * The totals of a run of an intersection over all lanes, print_intersection_stats has them per lane
+ * cars: the number of cars that got green
+ * simulated_time, wall_time: the simulated and real time in seconds the run took
+ * wait_mean, wait_p50, wait_p99, wait_max: the times in seconds between the arrival of a car and its green light
+ * failed_claims: the number of times a light found one of its sections taken or left to a light with priority
+ * blocked_time: the total simulated time in seconds cars at the front of their lane were held up by conflicting lights
+ * cpu_time: the CPU time in seconds used by the traffic light threads, the scheduler or the event engine
+ */
+typedef struct
+{
+  uint64_t cars;
+  int simulated_time;
+  double wall_time;
+  double wait_mean;
+  uint64_t wait_p50;
+  uint64_t wait_p99;
+  uint64_t wait_max;
+  uint64_t failed_claims;
+  double blocked_time;
+  double cpu_time;
+} IntersectionSummary;
+
+/*
+ * summarize_intersection(Intersection* intersection, IntersectionSummary* summary)
+ *
+ * store the totals of the intersection once run_intersection returned
+ */
+void summarize_intersection(Intersection* intersection, IntersectionSummary* summary);
+
+/*
+ * destroy_intersection(Intersection* intersection)
+ *
+ * free the intersection
+ */
+void destroy_intersection(Intersection* intersection);
+
+#endif
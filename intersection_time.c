@@ -1,33 +1,386 @@
 #include <stdlib.h>
+#include <errno.h>
 #include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #define __USE_POSIX199309 1
 
 #include <time.h>
 
 #include "intersection_time.h"
+#include "lock_profile.h"
 
+#define NANOSECONDS_PER_SECOND 1000000000LL
 
-struct timespec begin_time;
+
+/*
+ * Sleeper
+ *
+ * A thread that sleeps until some virtual time, in the list of sleepers of its clock
+ */
+typedef struct Sleeper
+{
+  long long wake_time;
+  pthread_cond_t* wakeup;
+  Parker* parker;           // the parker the thread is parked on until wake_time, or NULL
+  struct Sleeper* next;
+} Sleeper;
+
+
+/*
+ * advance_clock(Clock* clock)
+ *
+ * when every registered thread waits, jump to the earliest wake time and wake up the threads sleeping until then
+ * should only be called while holding clock_lock
+ */
+static void advance_clock(Clock* clock)
+{
+  if (clock->running_threads > 0 || clock->sleepers == NULL)
+  {
+    return;
+  }
+  long long next_time = clock->sleepers->wake_time;
+  for (Sleeper* sleeper = clock->sleepers->next; sleeper != NULL; sleeper = sleeper->next)
+  {
+    if (sleeper->wake_time < next_time)
+    {
+      next_time = sleeper->wake_time;
+    }
+  }
+  clock->virtual_now = next_time;
+  Sleeper** link = &clock->sleepers;
+  while (*link != NULL)
+  {
+    Sleeper* sleeper = *link;
+    if (sleeper->wake_time <= clock->virtual_now)
+    {
+      // the woken thread counts as running from now on, before it actually runs
+      *link = sleeper->next;
+      clock->running_threads += 1;
+      if (sleeper->parker != NULL)
+      {
+        sleeper->parker->parked = false;
+        sleeper->parker->sleeper = NULL;
+      }
+      pthread_cond_signal(sleeper->wakeup);
+    }
+    else
+    {
+      link = &sleeper->next;
+    }
+  }
+}
 
 
-void start_time()
+/*
+ * real_deadline(Clock* clock, long long wake_time, struct timespec* deadline)
+ *
+ * get the time on CLOCK_MONOTONIC at which the simulated wake_time happens
+ * rounds up, so that the simulated time has passed wake_time at the deadline
+ */
+static void real_deadline(Clock* clock, long long wake_time, struct timespec* deadline)
 {
-  clock_gettime(CLOCK_REALTIME, &begin_time);
+  long long real_wait = (long long)((double)wake_time / clock->time_scale);
+  if ((double)real_wait * clock->time_scale < (double)wake_time)
+  {
+    real_wait += 1;
+  }
+  *deadline = clock->begin_time;
+  deadline->tv_sec += real_wait / NANOSECONDS_PER_SECOND;
+  deadline->tv_nsec += real_wait % NANOSECONDS_PER_SECOND;
+  if (deadline->tv_nsec >= NANOSECONDS_PER_SECOND)
+  {
+    deadline->tv_sec += 1;
+    deadline->tv_nsec -= NANOSECONDS_PER_SECOND;
+  }
 }
 
 
-void sleep_until_arrival(int timestamp)
+/*
+ * remove_sleeper(Clock* clock, Sleeper* sleeper)
+ *
+ * remove a sleeper from the list of sleepers of the clock
+ * should only be called while holding clock_lock
+ */
+static void remove_sleeper(Clock* clock, Sleeper* sleeper)
 {
-  struct timespec wait_time = begin_time;
-  wait_time.tv_sec += timestamp;
-  clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &wait_time, NULL);
+  for (Sleeper** link = &clock->sleepers; *link != NULL; link = &(*link)->next)
+  {
+    if (*link == sleeper)
+    {
+      *link = sleeper->next;
+      return;
+    }
+  }
 }
 
 
-int get_time_passed()
+void sleep_until_ns(Clock* clock, long long wake_time)
 {
+  if (!clock->virtual_time)
+  {
+    struct timespec deadline;
+    real_deadline(clock, wake_time, &deadline);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) != 0)
+    {
+      // interrupted by a signal, keep sleeping until the wake time
+    }
+    return;
+  }
+
+  lock_mutex(&clock->clock_lock, "clock");
+  if (wake_time > clock->virtual_now)
+  {
+    pthread_cond_t wakeup = PTHREAD_COND_INITIALIZER;
+    Sleeper self = {wake_time, &wakeup, NULL, clock->sleepers};
+    clock->sleepers = &self;
+    clock->running_threads -= 1;
+    advance_clock(clock);
+    while (clock->virtual_now < wake_time)
+    {
+      wait_condition(&wakeup, &clock->clock_lock, "clock");
+    }
+    pthread_cond_destroy(&wakeup);
+  }
+  unlock_mutex(&clock->clock_lock);
+}
+
+
+long long get_time_passed_ns(Clock* clock)
+{
+  if (clock->virtual_time)
+  {
+    lock_mutex(&clock->clock_lock, "clock");
+    long long now = clock->virtual_now;
+    unlock_mutex(&clock->clock_lock);
+    return now;
+  }
   struct timespec new_time;
-  clock_gettime(CLOCK_REALTIME, &new_time);
-  return (int)new_time.tv_sec - begin_time.tv_sec;
+  clock_gettime(CLOCK_MONOTONIC, &new_time);
+  long long real_time = (new_time.tv_sec - clock->begin_time.tv_sec) * NANOSECONDS_PER_SECOND + (new_time.tv_nsec - clock->begin_time.tv_nsec);
+  return clock->time_scale == 1.0 ? real_time : (long long)((double)real_time * clock->time_scale);
+}
+
+
+void init_clock(Clock* clock)
+{
+  clock_gettime(CLOCK_MONOTONIC, &clock->begin_time);
+  clock->time_scale = 1.0;
+  clock->virtual_time = false;
+  pthread_mutex_init(&clock->clock_lock, NULL);
+  clock->virtual_now = 0;
+  clock->running_threads = 0;
+  clock->sleepers = NULL;
+}
+
+
+void destroy_clock(Clock* clock)
+{
+  pthread_mutex_destroy(&clock->clock_lock);
+}
+
+
+void use_virtual_time(Clock* clock)
+{
+  clock->virtual_time = true;
+}
+
+
+void set_time_scale(Clock* clock, double scale)
+{
+  clock->time_scale = scale;
+}
+
+
+void start_time(Clock* clock)
+{
+  clock_gettime(CLOCK_MONOTONIC, &clock->begin_time);
+  lock_mutex(&clock->clock_lock, "clock");
+  clock->virtual_now = 0;
+  unlock_mutex(&clock->clock_lock);
+}
+
+
+void register_thread(Clock* clock)
+{
+  lock_mutex(&clock->clock_lock, "clock");
+  clock->running_threads += 1;
+  unlock_mutex(&clock->clock_lock);
+}
+
+
+void unregister_thread(Clock* clock)
+{
+  lock_mutex(&clock->clock_lock, "clock");
+  clock->running_threads -= 1;
+  advance_clock(clock);
+  unlock_mutex(&clock->clock_lock);
+}
+
+
+void use_precise_timers(Clock* clock)
+{
+  if (!clock->virtual_time)
+  {
+    // the slack is in nanoseconds, 0 would restore the default
+    prctl(PR_SET_TIMERSLACK, 1UL, 0, 0, 0);
+  }
+}
+
+
+void sleep_until_arrival(Clock* clock, int timestamp)
+{
+  sleep_until_ns(clock, timestamp * NANOSECONDS_PER_SECOND);
+}
+
+
+void sleep_for(Clock* clock, int duration)
+{
+  sleep_for_ns(clock, duration * NANOSECONDS_PER_SECOND);
+}
+
+
+void sleep_for_ns(Clock* clock, long long duration)
+{
+  sleep_until_ns(clock, get_time_passed_ns(clock) + duration);
+}
+
+
+int get_time_passed(Clock* clock)
+{
+  return (int)(get_time_passed_ns(clock) / NANOSECONDS_PER_SECOND);
+}
+
+
+long long get_time_passed_ms(Clock* clock)
+{
+  return get_time_passed_ns(clock) / 1000000;
+}
+
+
+void init_parker(Parker* parker, Clock* clock)
+{
+  parker->clock = clock;
+  atomic_init(&parker->state, 0);
+  parker->permit = false;
+  parker->parked = false;
+  parker->sleeper = NULL;
+  pthread_cond_init(&parker->wakeup, NULL);
+}
+
+
+void destroy_parker(Parker* parker)
+{
+  pthread_cond_destroy(&parker->wakeup);
+}
+
+
+/*
+ * park(Parker* parker, bool timed, long long wake_time)
+ *
+ * wait until a permit is granted and consume it, or when timed until wake_time has passed
+ * returns whether a permit was consumed
+ */
+static bool park(Parker* parker, bool timed, long long wake_time)
+{
+  Clock* clock = parker->clock;
+  if (clock->virtual_time)
+  {
+    lock_mutex(&clock->clock_lock, "clock");
+    if (!parker->permit && (!timed || wake_time > clock->virtual_now))
+    {
+      Sleeper self = {wake_time, &parker->wakeup, parker, clock->sleepers};
+      if (timed)
+      {
+        clock->sleepers = &self;
+        parker->sleeper = &self;
+      }
+      parker->parked = true;
+      clock->running_threads -= 1;
+      advance_clock(clock);
+      while (parker->parked)
+      {
+        wait_condition(&parker->wakeup, &clock->clock_lock, "clock");
+      }
+    }
+    bool permit = parker->permit;
+    parker->permit = false;
+    unlock_mutex(&clock->clock_lock);
+    return permit;
+  }
+
+  struct timespec deadline;
+  if (timed)
+  {
+    real_deadline(clock, wake_time, &deadline);
+  }
+  while (true)
+  {
+    // consume a granted permit
+    uint32_t state = 1;
+    if (atomic_compare_exchange_strong(&parker->state, &state, 0))
+    {
+      return true;
+    }
+    // announce that we wait, unless a permit was granted in between
+    if (state == 0 && !atomic_compare_exchange_strong(&parker->state, &state, 2))
+    {
+      continue;
+    }
+    // with a bitset the timeout is an absolute time on CLOCK_MONOTONIC
+    if (syscall(SYS_futex, &parker->state, FUTEX_WAIT_BITSET_PRIVATE, 2, timed ? &deadline : NULL, NULL, FUTEX_BITSET_MATCH_ANY) != 0 && errno == ETIMEDOUT)
+    {
+      // stop waiting, unless a permit was granted just now
+      state = 2;
+      if (atomic_compare_exchange_strong(&parker->state, &state, 0))
+      {
+        return false;
+      }
+    }
+  }
+}
+
+
+void park_thread(Parker* parker)
+{
+  park(parker, false, 0);
+}
+
+
+bool park_thread_until(Parker* parker, long long wake_time)
+{
+  return park(parker, true, wake_time);
+}
+
+
+void unpark_thread(Parker* parker)
+{
+  Clock* clock = parker->clock;
+  if (clock->virtual_time)
+  {
+    lock_mutex(&clock->clock_lock, "clock");
+    parker->permit = true;
+    if (parker->parked)
+    {
+      // the woken thread counts as running from now on, before it actually runs
+      parker->parked = false;
+      clock->running_threads += 1;
+      if (parker->sleeper != NULL)
+      {
+        remove_sleeper(clock, parker->sleeper);
+        parker->sleeper = NULL;
+      }
+      pthread_cond_signal(&parker->wakeup);
+    }
+    unlock_mutex(&clock->clock_lock);
+    return;
+  }
+
+  // only make a system call when the owner is actually waiting
+  if (atomic_exchange(&parker->state, 1) == 2)
+  {
+    syscall(SYS_futex, &parker->state, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+  }
 }
@@ -1,26 +1,182 @@
 #ifndef INTERSECTION_TIME_H
 #define INTERSECTION_TIME_H
 
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "cache_line.h"
+
+struct Sleeper;
+
+/*
+ * Clock
+ *
+ * The time of one simulation: the moment it started, and how simulated time relates to real time
+ * Every simulation has its own clock, so several simulations can run in one process at the same time
+ * In virtual time the fields below clock_lock are protected by it:
+ *   virtual_now is the simulated time in nanoseconds since the start,
+ *   running_threads the number of registered threads that are not sleeping or parked,
+ *   and sleepers the threads that sleep until some virtual time
+ */
+typedef struct
+{
+  struct timespec begin_time;
+  double time_scale;        // the number of simulated nanoseconds per real nanosecond
+  bool virtual_time;
+  pthread_mutex_t clock_lock;
+  long long virtual_now;
+  int running_threads;
+  struct Sleeper* sleepers;
+} Clock;
+
+/*
+ * Parker
+ *
+ * A permit that a single thread waits for with park_thread, and other threads grant with unpark_thread
+ * A permit granted while the thread is not waiting is kept, so the next park_thread returns immediately
+ * Threads that block on something else than the clock should use a Parker,
+ *   so that in virtual time the clock knows when every thread is waiting
+ * Each parker starts on its own cache line, as both its owner and the threads that wake it write its state
+ */
+typedef struct
+{
+  _Alignas(CACHE_LINE_SIZE) Clock* clock;   // the clock that the owner waits with
+  _Atomic uint32_t state;   // real time: 0 no permit, 1 permit granted, 2 owner is waiting
+  bool permit;              // virtual time: whether a permit was granted
+  bool parked;              // virtual time: whether the owner is waiting
+  struct Sleeper* sleeper;  // virtual time: set while the owner waits with a wake time
+  pthread_cond_t wakeup;    // virtual time: signalled when the owner may continue
+} Parker;
+
+/*
+ * init_clock(Clock* clock), destroy_clock(Clock* clock)
+ *
+ * initialize a clock that runs at real time, and free its resources
+ */
+void init_clock(Clock* clock);
+void destroy_clock(Clock* clock);
+
+/*
+ * use_virtual_time(Clock* clock)
+ *
+ * simulate time instead of using the real clock, should be called before start_time
+ * in virtual time the clock jumps straight to the next time a thread sleeps until,
+ *   as soon as every registered thread is sleeping or parked
+ */
+void use_virtual_time(Clock* clock);
+
+/*
+ * set_time_scale(Clock* clock, double scale)
+ *
+ * let the simulated time run scale times as fast as real time, for example 1000 to simulate a second per millisecond
+ * should be called before start_time, has no effect in virtual time
+ */
+void set_time_scale(Clock* clock, double scale);
+
 /*
- * start_time()
+ * start_time(Clock* clock)
  *
  * store the current time to use as the starting time of the simulation of the intersection
+ * all times are simulated times: real time elapsed since the start multiplied by the time scale,
+ *   measured on CLOCK_MONOTONIC so that changes to the system clock do not affect the simulation
+ */
+void start_time(Clock* clock);
+
+/*
+ * register_thread(Clock* clock)
+ *
+ * register a thread that sleeps and parks using this clock
+ * must be called by the creator before the thread is created,
+ *   so the clock does not move on before the thread had a chance to run
+ */
+void register_thread(Clock* clock);
+
+/*
+ * unregister_thread(Clock* clock)
+ *
+ * called by a registered thread when it stops using the clock
  */
-void start_time();
+void unregister_thread(Clock* clock);
 
 /*
- * sleep_until_arrival(int timestamp)
+ * use_precise_timers(Clock* clock)
+ *
+ * in real time, let the kernel wake the calling thread at its deadlines without the default timer slack,
+ *   which otherwise adds up to 50 us to every sleep and timed park
+ */
+void use_precise_timers(Clock* clock);
+
+/*
+ * sleep_until_arrival(Clock* clock, int timestamp)
  *
  * sleep until the timestamp happens, using the starting time as base
  * should only be used by supply_arrivals
  */
-void sleep_until_arrival(int timestamp);
+void sleep_until_arrival(Clock* clock, int timestamp);
+
+/*
+ * sleep_until_ns(Clock* clock, long long timestamp)
+ *
+ * sleep until the timestamp in nanoseconds happens, using the starting time as base
+ */
+void sleep_until_ns(Clock* clock, long long timestamp);
+
+/*
+ * sleep_for(Clock* clock, int duration), sleep_for_ns(Clock* clock, long long duration)
+ *
+ * sleep for the duration in seconds or nanoseconds
+ */
+void sleep_for(Clock* clock, int duration);
+void sleep_for_ns(Clock* clock, long long duration);
 
 /*
- * get_time_passed()
+ * get_time_passed(Clock* clock)
  *
  * get the time in seconds that passed since the starting time
  */
-int get_time_passed();
+int get_time_passed(Clock* clock);
+
+/*
+ * get_time_passed_ms(Clock* clock), get_time_passed_ns(Clock* clock)
+ *
+ * get the time in milliseconds or nanoseconds that passed since the starting time
+ */
+long long get_time_passed_ms(Clock* clock);
+long long get_time_passed_ns(Clock* clock);
+
+/*
+ * init_parker(Parker* parker, Clock* clock), destroy_parker(Parker* parker)
+ *
+ * initialize a parker without a permit for a thread registered with the clock, and free its resources
+ */
+void init_parker(Parker* parker, Clock* clock);
+void destroy_parker(Parker* parker);
+
+/*
+ * park_thread(Parker* parker)
+ *
+ * wait until a permit is granted, and consume it
+ * should only be used by the thread that owns the parker
+ */
+void park_thread(Parker* parker);
+
+/*
+ * park_thread_until(Parker* parker, long long wake_time)
+ *
+ * wait until a permit is granted, or until the timestamp wake_time in nanoseconds happens
+ * returns whether a permit was consumed
+ * should only be used by the thread that owns the parker
+ */
+bool park_thread_until(Parker* parker, long long wake_time);
+
+/*
+ * unpark_thread(Parker* parker)
+ *
+ * grant the permit of the parker, waking up its owner when it is waiting
+ */
+void unpark_thread(Parker* parker);
 
 #endif
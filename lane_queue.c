@@ -0,0 +1,105 @@
+#include <stdlib.h>
+
+#include "lane_queue.h"
+
+
+struct LaneSegment
+{
+  LaneSegment* _Atomic next;
+  QueuedCar cars[LANE_SEGMENT_SIZE];
+};
+
+
+static LaneSegment* new_segment()
+{
+  LaneSegment* segment = malloc(sizeof(LaneSegment));
+  if (segment != NULL)
+  {
+    atomic_init(&segment->next, NULL);
+  }
+  return segment;
+}
+
+
+bool lane_init(LaneQueue* queue)
+{
+  LaneSegment* segment = new_segment();
+  if (segment == NULL)
+  {
+    return false;
+  }
+  queue->tail_segment = segment;
+  queue->head_segment = segment;
+  queue->head_segment_start = 0;
+  atomic_init(&queue->pushed, 0);
+  atomic_init(&queue->popped, 0);
+  return true;
+}
+
+
+void lane_destroy(LaneQueue* queue)
+{
+  LaneSegment* segment = queue->head_segment;
+  while (segment != NULL)
+  {
+    LaneSegment* next = atomic_load(&segment->next);
+    free(segment);
+    segment = next;
+  }
+  queue->head_segment = NULL;
+  queue->tail_segment = NULL;
+}
+
+
+bool lane_push(LaneQueue* queue, Arrival arrival)
+{
+  size_t pushed = atomic_load_explicit(&queue->pushed, memory_order_relaxed);
+  size_t index = pushed % LANE_SEGMENT_SIZE;
+  if (index == 0 && pushed != 0)
+  {
+    // the tail segment is full, link a new one
+    LaneSegment* segment = new_segment();
+    if (segment == NULL)
+    {
+      return false;
+    }
+    atomic_store_explicit(&queue->tail_segment->next, segment, memory_order_release);
+    queue->tail_segment = segment;
+  }
+  queue->tail_segment->cars[index] = (QueuedCar){arrival.id, arrival.time};
+  // publish the arrival (and the new segment) to the consumer
+  atomic_store_explicit(&queue->pushed, pushed + 1, memory_order_release);
+  return true;
+}
+
+
+const QueuedCar* lane_front(LaneQueue* queue)
+{
+  size_t popped = atomic_load_explicit(&queue->popped, memory_order_relaxed);
+  if (popped - queue->head_segment_start == LANE_SEGMENT_SIZE)
+  {
+    // all arrivals of the head segment have passed, and the producer linked the next one before pushing
+    LaneSegment* next = atomic_load_explicit(&queue->head_segment->next, memory_order_acquire);
+    free(queue->head_segment);
+    queue->head_segment = next;
+    queue->head_segment_start = popped;
+  }
+  // pair with the release in lane_push so that the arrival is visible
+  atomic_load_explicit(&queue->pushed, memory_order_acquire);
+  return &queue->head_segment->cars[popped - queue->head_segment_start];
+}
+
+
+void lane_pop(LaneQueue* queue)
+{
+  size_t popped = atomic_load_explicit(&queue->popped, memory_order_relaxed);
+  atomic_store_explicit(&queue->popped, popped + 1, memory_order_release);
+}
+
+
+size_t lane_size(LaneQueue* queue)
+{
+  size_t popped = atomic_load_explicit(&queue->popped, memory_order_acquire);
+  size_t pushed = atomic_load_explicit(&queue->pushed, memory_order_acquire);
+  return pushed - popped;
+}
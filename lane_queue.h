@@ -0,0 +1,93 @@
+#ifndef LANE_QUEUE_H
+#define LANE_QUEUE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "arrivals.h"
+#include "cache_line.h"
+
+// the number of arrivals stored in one segment of a lane queue
+#define LANE_SEGMENT_SIZE 64
+
+typedef struct LaneSegment LaneSegment;
+
+/*
+ * QueuedCar
+ *
+ * A car waiting in a lane: its arrival without the side and direction, which are those of the lane,
+ *   so that a cache line holds twice as many cars as it would hold arrivals
+ */
+typedef struct
+{
+  int id;
+  int time;
+} QueuedCar;
+
+/*
+ * LaneQueue
+ *
+ * A single-producer/single-consumer queue of the arrivals waiting in an entry lane
+ * The supplier pushes arrivals, the traffic light of the lane reads and pops them
+ * The queue is a linked list of fixed size segments: it grows a segment at a time when the lane fills up,
+ *   and the light frees a segment once all of its arrivals have passed
+ * The producer and consumer side are on separate cache lines, and each queue starts on its own cache line
+ */
+typedef struct
+{
+  // only written by the producer
+  _Alignas(CACHE_LINE_SIZE) LaneSegment* tail_segment;
+  _Atomic size_t pushed;          // the number of arrivals pushed so far
+  // only written by the consumer
+  _Alignas(CACHE_LINE_SIZE) LaneSegment* head_segment;
+  size_t head_segment_start;      // the index of the first arrival in head_segment
+  _Atomic size_t popped;          // the number of arrivals popped so far
+} LaneQueue;
+
+/*
+ * lane_init(LaneQueue* queue)
+ *
+ * initialize an empty lane queue, returns false when out of memory
+ */
+bool lane_init(LaneQueue* queue);
+
+/*
+ * lane_destroy(LaneQueue* queue)
+ *
+ * free all memory of the lane queue
+ */
+void lane_destroy(LaneQueue* queue);
+
+/*
+ * lane_push(LaneQueue* queue, Arrival arrival)
+ *
+ * add the car of an arrival in the lane to the back of the queue, growing it if needed
+ * should only be used by the producer, returns false when out of memory
+ */
+bool lane_push(LaneQueue* queue, Arrival arrival);
+
+/*
+ * lane_front(LaneQueue* queue)
+ *
+ * get the car at the front of the queue
+ * should only be used by the consumer, and only when the queue is not empty
+ */
+const QueuedCar* lane_front(LaneQueue* queue);
+
+/*
+ * lane_pop(LaneQueue* queue)
+ *
+ * remove the arrival at the front of the queue
+ * should only be used by the consumer, and only when the queue is not empty
+ */
+void lane_pop(LaneQueue* queue);
+
+/*
+ * lane_size(LaneQueue* queue)
+ *
+ * get the number of arrivals in the queue, may be used by any thread
+ */
+size_t lane_size(LaneQueue* queue);
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include <stdint.h>
+
+#include "arrivals.h"
+
+/*
+ * SectionMask
+ *
+ * A bitmask of intersection sections: bit n-1 is set when section n is part of the mask
+ */
+typedef uint32_t SectionMask;
+
+#define SECTION(n) ((SectionMask)1 << ((n) - 1))
+
+/*
+ * Light
+ *
+ * A traffic light, for the entry lane on side side for direction direction
+ * sections is the mask of the intersection sections that the path of the light crosses
+ * In a topology loaded at startup the side is the index of the approach and the direction the index of the lane
+ */
+typedef struct
+{
+  Side side;
+  Direction direction;
+  SectionMask sections;
+} Light;
+
+/*
+ * default_lights[]
+ *
+ * The default geometry of the intersection: the traffic lights and the sections their paths cross,
+ *   for 4 approaches of 3 lanes each and 9 sections
+ * The conflict tables in conflicts.h are generated from it, other geometries can be loaded at startup (see topology.h)
+ */
+#define DEFAULT_APPROACHES 4
+#define DEFAULT_LANES 3
+#define DEFAULT_SECTIONS 9
+#define NUM_DEFAULT_LIGHTS 9
+
+static const Light default_lights[NUM_DEFAULT_LIGHTS] =
+{
+  {NORTH, RIGHT, SECTION(1)},
+  {NORTH, STRAIGHT, SECTION(2) | SECTION(8) | SECTION(9)},
+  {EAST, RIGHT, SECTION(3)},
+  {EAST, STRAIGHT, SECTION(1) | SECTION(2) | SECTION(4)},
+  {EAST, LEFT, SECTION(5) | SECTION(7) | SECTION(9)},
+  {SOUTH, STRAIGHT, SECTION(3) | SECTION(4) | SECTION(5)},
+  {SOUTH, LEFT, SECTION(1) | SECTION(2) | SECTION(6) | SECTION(7)},
+  {WEST, RIGHT, SECTION(9)},
+  {WEST, LEFT, SECTION(3) | SECTION(4) | SECTION(6) | SECTION(8)}
+};
+
+#endif
@@ -0,0 +1,384 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#define __USE_POSIX199309 1
+
+#include <time.h>
+
+#include "lock_profile.h"
+#include "log.h"
+#include "stats.h"
+
+// the most acquisitions recorded per thread, later ones are only counted as dropped
+#define LOCK_TRACE_MAX_EVENTS (1 << 22)
+
+// the most locks a thread can hold at the same time while being recorded
+#define LOCK_TRACE_MAX_HELD 64
+
+// the most distinct locks (mutex names and sections) in the summary
+#define LOCK_SUMMARY_MAX 64
+
+/*
+ * LockEvent
+ *
+ * One acquisition of a lock by a thread, times in nanoseconds of lock_profile_time
+ * index is the section for the sections of a word lock, -1 for a mutex
+ * released is 0 while the lock is held
+ */
+typedef struct
+{
+  const void* lock;
+  const char* name;
+  int index;
+  bool contended;
+  uint64_t requested;
+  uint64_t acquired;
+  uint64_t released;
+} LockEvent;
+
+/*
+ * LockTrace
+ *
+ * The acquisitions recorded by one thread, only written by that thread
+ */
+typedef struct LockTrace
+{
+  LockEvent* events;
+  size_t num_events;
+  size_t capacity;
+  size_t dropped;
+  size_t held[LOCK_TRACE_MAX_HELD];  // the events of the locks the thread holds now
+  int num_held;
+  int thread;                        // the tid in the trace
+  struct LockTrace* next;            // the next trace in the list of all traces
+} LockTrace;
+
+// the trace of the calling thread, registered on its first acquisition
+static __thread LockTrace* thread_trace = NULL;
+
+// the list of the traces of all threads, and the number of them
+static LockTrace* _Atomic all_traces = NULL;
+static atomic_int num_traces = 0;
+
+
+uint64_t lock_profile_time()
+{
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+
+/*
+ * get_trace()
+ *
+ * get the trace of the calling thread, registering it on the first call
+ * returns NULL when out of memory, the acquisitions of the thread are then not recorded
+ */
+static LockTrace* get_trace()
+{
+  if (thread_trace == NULL)
+  {
+    LockTrace* trace = calloc(1, sizeof(LockTrace));
+    if (trace == NULL)
+    {
+      return NULL;
+    }
+    trace->thread = atomic_fetch_add(&num_traces, 1);
+    trace->next = atomic_load(&all_traces);
+    while (!atomic_compare_exchange_weak(&all_traces, &trace->next, trace))
+    {
+      // another thread registered at the same time, retry with the new head
+    }
+    thread_trace = trace;
+  }
+  return thread_trace;
+}
+
+
+/*
+ * record_acquired(const void* lock, const char* name, int index, bool contended, uint64_t requested)
+ *
+ * record that the calling thread acquired the lock, and remember it as held until record_released
+ */
+static void record_acquired(const void* lock, const char* name, int index, bool contended, uint64_t requested)
+{
+  uint64_t now = lock_profile_time();
+  LockTrace* trace = get_trace();
+  if (trace == NULL)
+  {
+    return;
+  }
+  if (trace->num_events == trace->capacity)
+  {
+    size_t capacity = trace->capacity == 0 ? 1024 : trace->capacity * 2;
+    LockEvent* events = capacity <= LOCK_TRACE_MAX_EVENTS ? realloc(trace->events, capacity * sizeof(LockEvent)) : NULL;
+    if (events == NULL)
+    {
+      trace->dropped += 1;
+      return;
+    }
+    trace->events = events;
+    trace->capacity = capacity;
+  }
+  if (trace->num_held == LOCK_TRACE_MAX_HELD)
+  {
+    trace->dropped += 1;
+    return;
+  }
+  trace->events[trace->num_events] = (LockEvent){lock, name, index, contended, requested, now, 0};
+  trace->held[trace->num_held++] = trace->num_events++;
+}
+
+
+/*
+ * record_released(const void* lock, int index)
+ *
+ * record that the calling thread released the lock, the last one it acquired with this index
+ * a release of a lock whose acquisition was dropped is ignored
+ */
+static void record_released(const void* lock, int index)
+{
+  uint64_t now = lock_profile_time();
+  LockTrace* trace = thread_trace;
+  if (trace == NULL)
+  {
+    return;
+  }
+  for (int i = trace->num_held - 1; i >= 0; i--)
+  {
+    LockEvent* event = &trace->events[trace->held[i]];
+    if (event->lock == lock && event->index == index)
+    {
+      event->released = now;
+      memmove(&trace->held[i], &trace->held[i + 1], (trace->num_held - i - 1) * sizeof(size_t));
+      trace->num_held -= 1;
+      return;
+    }
+  }
+}
+
+
+void profiled_lock(pthread_mutex_t* mutex, const char* name)
+{
+  uint64_t requested = lock_profile_time();
+  bool contended = pthread_mutex_trylock(mutex) != 0;
+  if (contended)
+  {
+    pthread_mutex_lock(mutex);
+  }
+  record_acquired(mutex, name, -1, contended, requested);
+}
+
+
+void profiled_unlock(pthread_mutex_t* mutex)
+{
+  // record first, the hold time ends when another thread can take the mutex
+  record_released(mutex, -1);
+  pthread_mutex_unlock(mutex);
+}
+
+
+void profiled_wait(pthread_cond_t* condition, pthread_mutex_t* mutex, const char* name)
+{
+  record_released(mutex, -1);
+  pthread_cond_wait(condition, mutex);
+  // the time waiting for the condition is not time waiting for the mutex, so it is not counted as such
+  record_acquired(mutex, name, -1, false, lock_profile_time());
+}
+
+
+void profiled_claim(const void* lock, uint32_t sections, uint32_t contended, uint64_t requested)
+{
+  for (; sections != 0; sections &= sections - 1)
+  {
+    int section = __builtin_ctz(sections);
+    bool section_contended = (contended & (1u << section)) != 0;
+    record_acquired(lock, "section", section + 1, section_contended, section_contended ? requested : lock_profile_time());
+  }
+}
+
+
+void profiled_release(const void* lock, uint32_t sections)
+{
+  for (; sections != 0; sections &= sections - 1)
+  {
+    record_released(lock, __builtin_ctz(sections) + 1);
+  }
+}
+
+
+/*
+ * LockSummary
+ *
+ * The acquisitions of one lock by all threads, wait and hold times in nanoseconds
+ */
+typedef struct
+{
+  const char* name;
+  int index;
+  uint64_t acquisitions;
+  uint64_t contended;
+  Histogram wait;
+  Histogram hold;
+} LockSummary;
+
+
+/*
+ * summarise(LockSummary* summaries, int* num_summaries, const LockEvent* event)
+ *
+ * add an acquisition to the summary of its lock, mutexes are summarised by name so that
+ *   the same lock of several intersections is counted together
+ */
+static void summarise(LockSummary* summaries, int* num_summaries, const LockEvent* event)
+{
+  int i = 0;
+  while (i < *num_summaries && (strcmp(summaries[i].name, event->name) != 0 || summaries[i].index != event->index))
+  {
+    i++;
+  }
+  if (i == *num_summaries)
+  {
+    if (i == LOCK_SUMMARY_MAX)
+    {
+      return;
+    }
+    summaries[i].name = event->name;
+    summaries[i].index = event->index;
+    *num_summaries += 1;
+  }
+  LockSummary* summary = &summaries[i];
+  summary->acquisitions += 1;
+  summary->contended += event->contended ? 1 : 0;
+  histogram_record(&summary->wait, event->acquired - event->requested);
+  if (event->released != 0)
+  {
+    histogram_record(&summary->hold, event->released - event->acquired);
+  }
+}
+
+
+/*
+ * print_lock_name(FILE* out, const char* name, int index)
+ *
+ * print the name of a lock, with the section for the sections of a word lock
+ */
+static void print_lock_name(FILE* out, const char* name, int index)
+{
+  if (index >= 0)
+  {
+    fprintf(out, "%s %d", name, index);
+  }
+  else
+  {
+    fprintf(out, "%s", name);
+  }
+}
+
+
+/*
+ * write_trace_event(FILE* out, const LockTrace* trace, const LockEvent* event, uint64_t begin, bool* first)
+ *
+ * write the acquisition as complete events of the Chrome trace format, one for the wait if it was contended
+ *   and one for the hold, with times in microseconds since begin
+ */
+static void write_trace_event(FILE* out, const LockTrace* trace, const LockEvent* event, uint64_t begin, bool* first)
+{
+  if (event->contended)
+  {
+    fprintf(out, "%s\n{\"name\":\"wait ", *first ? "" : ",");
+    print_lock_name(out, event->name, event->index);
+    fprintf(out, "\",\"cat\":\"wait\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":%d}",
+      (event->requested - begin) / 1e3, (event->acquired - event->requested) / 1e3, trace->thread);
+    *first = false;
+  }
+  if (event->released != 0)
+  {
+    fprintf(out, "%s\n{\"name\":\"", *first ? "" : ",");
+    print_lock_name(out, event->name, event->index);
+    fprintf(out, "\",\"cat\":\"hold\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":%d,\"args\":{\"wait_us\":%.3f,\"contended\":%s}}",
+      (event->acquired - begin) / 1e3, (event->released - event->acquired) / 1e3, trace->thread,
+      (event->acquired - event->requested) / 1e3, event->contended ? "true" : "false");
+    *first = false;
+  }
+}
+
+
+const char* lock_profile_path()
+{
+  const char* path = getenv("LOCK_PROFILE");
+  return path != NULL && path[0] != '\0' ? path : LOCK_PROFILE_FILE;
+}
+
+
+void write_lock_trace(const char* path)
+{
+  LockSummary* summaries = calloc(LOCK_SUMMARY_MAX, sizeof(LockSummary));
+  if (summaries == NULL)
+  {
+    log_error("(Locks):\t Out of memory\n");
+    return;
+  }
+  int num_summaries = 0;
+  uint64_t begin = UINT64_MAX;
+  size_t dropped = 0;
+  for (LockTrace* trace = atomic_load(&all_traces); trace != NULL; trace = trace->next)
+  {
+    for (size_t i = 0; i < trace->num_events; i++)
+    {
+      summarise(summaries, &num_summaries, &trace->events[i]);
+      begin = trace->events[i].requested < begin ? trace->events[i].requested : begin;
+    }
+    dropped += trace->dropped;
+  }
+
+  for (int i = 0; i < num_summaries; i++)
+  {
+    const LockSummary* summary = &summaries[i];
+    fprintf(stderr, "(Locks):\t ");
+    print_lock_name(stderr, summary->name, summary->index);
+    fprintf(stderr, ": acquisitions %lu, contended %lu (%.1f%%), wait p50 %.3f us, p99 %.3f us, max %.3f us, hold p50 %.3f us, p99 %.3f us, max %.3f us\n",
+      summary->acquisitions, summary->contended, 100.0 * summary->contended / summary->acquisitions,
+      histogram_percentile(&summary->wait, 50) / 1e3, histogram_percentile(&summary->wait, 99) / 1e3, summary->wait.max / 1e3,
+      histogram_percentile(&summary->hold, 50) / 1e3, histogram_percentile(&summary->hold, 99) / 1e3, summary->hold.max / 1e3);
+  }
+  if (dropped > 0)
+  {
+    fprintf(stderr, "(Locks):\t %zu acquisitions dropped\n", dropped);
+  }
+  free(summaries);
+
+  FILE* out = fopen(path, "w");
+  if (out == NULL)
+  {
+    log_error("(Locks):\t Cannot write the lock trace to %s\n", path);
+  }
+  else
+  {
+    bool first = true;
+    fprintf(out, "{\"traceEvents\":[");
+    for (LockTrace* trace = atomic_load(&all_traces); trace != NULL; trace = trace->next)
+    {
+      for (size_t i = 0; i < trace->num_events; i++)
+      {
+        write_trace_event(out, trace, &trace->events[i], begin, &first);
+      }
+    }
+    fprintf(out, "\n],\"displayTimeUnit\":\"ns\"}\n");
+    fclose(out);
+    fprintf(stderr, "(Locks):\t Trace written to %s\n", path);
+  }
+
+  // the traces are only freed here, after all profiled threads have finished
+  LockTrace* trace = atomic_exchange(&all_traces, NULL);
+  while (trace != NULL)
+  {
+    LockTrace* next = trace->next;
+    free(trace->events);
+    free(trace);
+    trace = next;
+  }
+  thread_trace = NULL;
+}
@@ -0,0 +1,90 @@
+#ifndef LOCK_PROFILE_H
+#define LOCK_PROFILE_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * PROFILE_LOCKS
+ *
+ * compile with -DPROFILE_LOCKS (make profile) to record every acquisition of the mutexes and the sections
+ *   of the simulation, with how long the thread waited for it, whether another thread held it and how long it was held
+ * when the program ends the acquisitions are summarised per lock on stderr and written as a Chrome trace
+ *   (chrome://tracing, Perfetto or speedscope) to the file named by the environment variable LOCK_PROFILE,
+ *   or LOCK_PROFILE_FILE in the current directory when it is not set
+ * without it the macros below are the plain pthread calls, and nothing is recorded
+ */
+#ifndef LOCK_PROFILE_FILE
+#define LOCK_PROFILE_FILE "lock_profile.json"
+#endif
+
+#ifdef PROFILE_LOCKS
+#define lock_mutex(mutex, name) profiled_lock(mutex, name)
+#define unlock_mutex(mutex) profiled_unlock(mutex)
+#define wait_condition(condition, mutex, name) profiled_wait(condition, mutex, name)
+#define profile_now() lock_profile_time()
+#define profile_sections_claimed(lock, sections, contended, requested) profiled_claim(lock, sections, contended, requested)
+#define profile_sections_released(lock, sections) profiled_release(lock, sections)
+#define write_lock_profile() write_lock_trace(lock_profile_path())
+#else
+#define lock_mutex(mutex, name) pthread_mutex_lock(mutex)
+#define unlock_mutex(mutex) pthread_mutex_unlock(mutex)
+#define wait_condition(condition, mutex, name) pthread_cond_wait(condition, mutex)
+#define profile_now() 0
+#define profile_sections_claimed(lock, sections, contended, requested) ((void)(contended), (void)(requested))
+#define profile_sections_released(lock, sections) ((void)0)
+#define write_lock_profile() ((void)0)
+#endif
+
+/*
+ * lock_profile_time()
+ *
+ * get the time in nanoseconds used for the lock profile, a monotonic wall clock time also with virtual time
+ */
+uint64_t lock_profile_time();
+
+/*
+ * profiled_lock(pthread_mutex_t* mutex, const char* name), profiled_unlock(pthread_mutex_t* mutex)
+ *
+ * lock and unlock the mutex, and record the acquisition under the name, which has to be a string constant
+ * a failed trylock first counts the acquisition as contended
+ */
+void profiled_lock(pthread_mutex_t* mutex, const char* name);
+void profiled_unlock(pthread_mutex_t* mutex);
+
+/*
+ * profiled_wait(pthread_cond_t* condition, pthread_mutex_t* mutex, const char* name)
+ *
+ * wait for the condition, recording the mutex as released while waiting and as acquired again after
+ */
+void profiled_wait(pthread_cond_t* condition, pthread_mutex_t* mutex, const char* name);
+
+/*
+ * profiled_claim(const void* lock, uint32_t sections, uint32_t contended, uint64_t requested),
+ *   profiled_release(const void* lock, uint32_t sections)
+ *
+ * record the claim and the release of sections of the word lock, as an acquisition of each section
+ * contended are the sections that were found taken by another light while claiming since requested
+ * a light has to release its sections on the thread that claimed them
+ */
+void profiled_claim(const void* lock, uint32_t sections, uint32_t contended, uint64_t requested);
+void profiled_release(const void* lock, uint32_t sections);
+
+/*
+ * lock_profile_path()
+ *
+ * get the file the lock profile is written to, LOCK_PROFILE from the environment or else LOCK_PROFILE_FILE
+ */
+const char* lock_profile_path();
+
+/*
+ * write_lock_trace(const char* path)
+ *
+ * print the acquisitions, contended acquisitions and the wait and hold time percentiles per lock to stderr,
+ *   and write all recorded acquisitions as a Chrome trace to the file
+ * all profiled threads have to be finished
+ */
+void write_lock_trace(const char* path);
+
+#endif
@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define __USE_POSIX199309 1
+
+#include <time.h>
+
+#include "log.h"
+
+// the number of messages a thread can have waiting, and the maximum length of a message
+#define LOG_RING_SIZE 1024
+#define LOG_MESSAGE_SIZE 128
+
+// how long the writer sleeps at most when no messages are waiting
+#define LOG_IDLE_NANOSECONDS 100000000
+
+// the number of waiting messages of a thread at which it wakes up the writer
+#define LOG_WAKE_THRESHOLD (LOG_RING_SIZE / 4)
+
+int log_level = LOG_LEVEL;
+
+/*
+ * LogRing
+ *
+ * A single-producer/single-consumer ring of messages of one thread, drained by the writer
+ */
+typedef struct LogRing
+{
+  _Atomic size_t written;                         // only changed by the thread that owns the ring
+  _Atomic size_t read;                            // only changed by the writer
+  _Atomic size_t dropped;                         // only changed by the thread that owns the ring
+  size_t dropped_reported;                        // only used by the writer
+  struct LogRing* next;                           // the next ring in the list of all rings
+  char messages[LOG_RING_SIZE][LOG_MESSAGE_SIZE];
+} LogRing;
+
+// the ring of the calling thread, registered on its first message and never freed
+static __thread LogRing* thread_ring = NULL;
+
+// the list of the rings of all threads
+static LogRing* _Atomic all_rings = NULL;
+
+static pthread_t writer_thread;
+static atomic_bool writer_running = false;
+static atomic_bool writer_stopping = false;
+
+// set while the writer sleeps, a futex word that threads use to wake it up
+static _Atomic uint32_t writer_sleeping = 0;
+
+
+/*
+ * drain_rings(FILE* out)
+ *
+ * write all waiting messages, returns whether any message was written
+ */
+static bool drain_rings(FILE* out)
+{
+  bool wrote = false;
+  for (LogRing* ring = atomic_load(&all_rings); ring != NULL; ring = ring->next)
+  {
+    size_t read = atomic_load_explicit(&ring->read, memory_order_relaxed);
+    size_t written = atomic_load_explicit(&ring->written, memory_order_acquire);
+    for (; read != written; read++)
+    {
+      fputs(ring->messages[read % LOG_RING_SIZE], out);
+      wrote = true;
+    }
+    atomic_store_explicit(&ring->read, read, memory_order_release);
+    size_t dropped = atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    if (dropped != ring->dropped_reported)
+    {
+      fprintf(out, "(Log):\t\t %zu messages dropped\n", dropped - ring->dropped_reported);
+      ring->dropped_reported = dropped;
+      wrote = true;
+    }
+  }
+  return wrote;
+}
+
+
+static void* write_log()
+{
+  while (!atomic_load(&writer_stopping))
+  {
+    if (drain_rings(stderr))
+    {
+      fflush(stderr);
+      continue;
+    }
+    struct timespec timeout = {0, LOG_IDLE_NANOSECONDS};
+    atomic_store(&writer_sleeping, 1);
+    syscall(SYS_futex, &writer_sleeping, FUTEX_WAIT_PRIVATE, 1, &timeout, NULL, 0);
+    atomic_store(&writer_sleeping, 0);
+  }
+  drain_rings(stderr);
+  fflush(stderr);
+  return(0);
+}
+
+
+void start_logging()
+{
+  atomic_store(&writer_stopping, false);
+  if (pthread_create(&writer_thread, NULL, write_log, NULL) == 0)
+  {
+    atomic_store(&writer_running, true);
+  }
+}
+
+
+void stop_logging()
+{
+  if (!atomic_load(&writer_running))
+  {
+    return;
+  }
+  atomic_store(&writer_stopping, true);
+  if (atomic_exchange(&writer_sleeping, 0) == 1)
+  {
+    syscall(SYS_futex, &writer_sleeping, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+  }
+  pthread_join(writer_thread, NULL);
+  atomic_store(&writer_running, false);
+  // anything logged from now on is written directly, the rings stay registered until the process exits
+  //   since other threads still point to theirs, and the next start_logging drains them again
+}
+
+
+/*
+ * get_thread_ring()
+ *
+ * get the ring of the calling thread, registering a new one when needed
+ */
+static LogRing* get_thread_ring()
+{
+  if (thread_ring == NULL)
+  {
+    LogRing* ring = calloc(1, sizeof(LogRing));
+    if (ring == NULL)
+    {
+      return NULL;
+    }
+    ring->next = atomic_load(&all_rings);
+    while (!atomic_compare_exchange_weak(&all_rings, &ring->next, ring))
+    {
+      // another thread registered its ring first, ring->next was updated to it
+    }
+    thread_ring = ring;
+  }
+  return thread_ring;
+}
+
+
+void log_message(const char* format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  LogRing* ring = atomic_load(&writer_running) ? get_thread_ring() : NULL;
+  if (ring == NULL)
+  {
+    vfprintf(stderr, format, args);
+    va_end(args);
+    return;
+  }
+
+  size_t written = atomic_load_explicit(&ring->written, memory_order_relaxed);
+  if (written - atomic_load_explicit(&ring->read, memory_order_acquire) == LOG_RING_SIZE)
+  {
+    atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+    va_end(args);
+    return;
+  }
+  char* message = ring->messages[written % LOG_RING_SIZE];
+  if (vsnprintf(message, LOG_MESSAGE_SIZE, format, args) >= LOG_MESSAGE_SIZE)
+  {
+    // keep truncated messages on their own line
+    message[LOG_MESSAGE_SIZE - 2] = '\n';
+  }
+  va_end(args);
+  atomic_store(&ring->written, written + 1);
+
+  // the writer picks up messages when its sleep times out, it is only woken up early
+  //   (with a system call) when the ring starts filling up
+  if (written + 1 - atomic_load_explicit(&ring->read, memory_order_relaxed) >= LOG_WAKE_THRESHOLD
+      && atomic_load(&writer_sleeping) == 1 && atomic_exchange(&writer_sleeping, 0) == 1)
+  {
+    syscall(SYS_futex, &writer_sleeping, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+  }
+}
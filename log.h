@@ -0,0 +1,63 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdbool.h>
+
+// the levels of log messages
+#define LOG_ERROR 0
+#define LOG_INFO 1
+#define LOG_DEBUG 2
+
+/*
+ * LOG_LEVEL
+ *
+ * the highest level of messages compiled into the program, compile with -DLOG_LEVEL=LOG_INFO
+ *   to remove the debug traces from the hot path completely
+ */
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_DEBUG
+#endif
+
+/*
+ * log_level
+ *
+ * the highest level of messages that is written at runtime, at most LOG_LEVEL
+ */
+extern int log_level;
+
+/*
+ * log_error(...), log_info(...), log_debug(...)
+ *
+ * write a printf style message to stderr, if its level is enabled
+ */
+#define log_at(level, ...) do { if (LOG_LEVEL >= (level) && log_level >= (level)) log_message(__VA_ARGS__); } while (0)
+#define log_error(...) log_at(LOG_ERROR, __VA_ARGS__)
+#define log_info(...) log_at(LOG_INFO, __VA_ARGS__)
+#define log_debug(...) log_at(LOG_DEBUG, __VA_ARGS__)
+
+/*
+ * start_logging()
+ *
+ * start the background thread that writes log messages
+ * until then, and after stop_logging, messages are written directly
+ */
+void start_logging();
+
+/*
+ * stop_logging()
+ *
+ * write all remaining messages and stop the background thread
+ * the message rings of the threads are kept, logging can be started again
+ */
+void stop_logging();
+
+/*
+ * log_message(const char* format, ...)
+ *
+ * format a message into the log ring of the calling thread, without taking locks or making system calls
+ * the background thread writes the messages of each thread in order, messages of different threads may interleave
+ * when the ring of a thread is full the message is dropped, and the number of dropped messages is reported
+ */
+void log_message(const char* format, ...) __attribute__((format(printf, 1, 2)));
+
+#endif
@@ -0,0 +1,431 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "arrivals.h"
+#include "lights.h"
+#include "conflicts.h"
+#include "topology.h"
+#include "intersection.h"
+#include "arrival_loader.h"
+#include "arrival_stream.h"
+#include "lock_profile.h"
+#include "log.h"
+#include "metrics.h"
+#include "network.h"
+#include "output.h"
+#include "input.h"
+
+/*
+ * stop_dumping
+ *
+ * Set when the simulation is done, so dump_stats_on_signal stops at the next signal
+ */
+static atomic_bool stop_dumping = false;
+
+/*
+ * dump_stats_on_signal(void* arg)
+ *
+ * Prints the statistics of the intersection given as argument every time the process receives SIGUSR1
+ * SIGUSR1 is blocked in all threads, this thread takes it with sigwait so the printing is not limited to
+ *   what is safe in a signal handler
+ */
+static void* dump_stats_on_signal(void* arg)
+{
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGUSR1);
+  while (true)
+  {
+    int signal;
+    sigwait(&signals, &signal);
+    if (atomic_load(&stop_dumping))
+    {
+      return(0);
+    }
+    print_intersection_stats(arg);
+  }
+}
+
+/*
+ * usage(const char* program)
+ *
+ * Prints the command line options
+ */
+static void usage(const char* program)
+{
+  fprintf(stderr, "usage: %s [-a cpus] [-b output] [-c cross_time] [-e engine] [-F priority] [-l log_level] [-L horizon] [-m address] [-n rowsxcols] [-p policy] [-P platoon] [-r grants] [-R grants] [-s scale] [-S] [-t topology] [-T travel_time] [-v] [-w workers] [trace]\n", program);
+  fprintf(stderr, "  -a cpus        pin the supplier and the light threads, supplier/lights or one list for both, each a comma\n");
+  fprintf(stderr, "                 separated list of CPUs, ranges and NUMA nodes, for example 0/1-4 or node0/node1,\n");
+  fprintf(stderr, "                 the light threads take the CPUs or nodes of their list in turn\n");
+  fprintf(stderr, "  -b output      write the light changes as binary records to the output file instead of stdout\n");
+  fprintf(stderr, "  -c cross_time  time in seconds it takes a car to cross (default %d)\n", CROSS_TIME);
+  fprintf(stderr, "  -e engine      threads: a thread per light (default), batch: one scheduler greening compatible lights together,\n");
+  fprintf(stderr, "                 event: the threaded engine simulated in a single thread, always in simulated time\n");
+  fprintf(stderr, "  -F priority    run the supplier and the light threads under SCHED_FIFO with the priority, which needs privileges\n");
+  fprintf(stderr, "  -l log_level   0 for errors, 1 for progress, 2 for debug traces (default %d)\n", LOG_LEVEL);
+  fprintf(stderr, "  -L horizon     with -e batch, plan the groups with the arrivals of the next horizon seconds of the trace,\n");
+  fprintf(stderr, "                 which is read twice and cannot be stdin or live\n");
+  fprintf(stderr, "  -m address     serve live metrics in the Prometheus text format over HTTP while running,\n");
+  fprintf(stderr, "                 on a Unix socket path or [host]:port\n");
+  fprintf(stderr, "  -n rowsxcols   simulate a grid of intersections instead of one, for example 10x10,\n");
+  fprintf(stderr, "                 whose junctions green the largest group of compatible lights like -e batch\n");
+  fprintf(stderr, "  -p policy      which conflicting light goes first: greedy (default), fifo by arrival, queue by length,\n");
+  fprintf(stderr, "                 aging[:max_wait], priority for cars that waited max_wait seconds (default %d),\n", MAX_WAIT);
+  fprintf(stderr, "                 or adaptive, green groups and platoons (default -P %d) follow queue lengths and arrival rates\n", ADAPTIVE_PLATOON);
+  fprintf(stderr, "  -P platoon     cars[:wait], a green light passes up to cars queued cars before turning red,\n");
+  fprintf(stderr, "                 or until a conflicting car has waited wait seconds (default 1, a car per green)\n");
+  fprintf(stderr, "  -r grants      record the order in which the traffic lights claim their sections to the file\n");
+  fprintf(stderr, "  -R grants      replay a recorded order, so the run repeats the recorded one for the same trace and options,\n");
+  fprintf(stderr, "                 a trace other than the recorded one is refused\n");
+  fprintf(stderr, "  -s scale       run time scale times as fast as real time, for example 1000\n");
+  fprintf(stderr, "  -S             print throughput, wait and blocked times, and CPU time per light when done, or on SIGUSR1\n");
+  fprintf(stderr, "  -t topology    file describing the approaches, lanes, sections and lights (default: lights.h)\n");
+  fprintf(stderr, "  -T travel_time with -n, time in seconds from one intersection to the next (default 1)\n");
+  fprintf(stderr, "  -v             simulate time instead of waiting in real time, with the same output\n");
+  fprintf(stderr, "  -w workers     with -n, the number of threads simulating the intersections (default: one per core)\n");
+  fprintf(stderr, "  trace          file with arrivals, - for stdin, or tcp:[host]:port, udp:[host]:port or unix:path\n");
+  fprintf(stderr, "                 to receive live arrivals on (default: input_arrivals from input.h)\n");
+}
+
+int main(int argc, char * argv[])
+{
+  const char* binary_output = NULL;
+  const char* topology_file = NULL;
+  const char* record_file = NULL;
+  const char* replay_file = NULL;
+  const char* metrics_address = NULL;
+  bool show_stats = false;
+  bool platoon_set = false;
+  IntersectionOptions options = {THREADED_ENGINE, CROSS_TIME, GREEDY_POLICY, MAX_WAIT, 1, 0, false, 1.0, NULL, NULL, NULL, NULL, 0, NULL};
+  ThreadPlacement placement = {.supplier.count = 0, .lights.count = 0, .priority = 0};
+  NetworkOptions network = {0, 0, (int)sysconf(_SC_NPROCESSORS_ONLN), CROSS_TIME, 1};
+  int option;
+  while ((option = getopt(argc, argv, "a:b:c:e:F:l:L:m:n:p:P:r:R:s:St:T:vw:h")) != -1)
+  {
+    switch (option)
+    {
+      case 'a':
+        if (!parse_placement(optarg, &placement))
+        {
+          return 1;
+        }
+        options.placement = &placement;
+        break;
+      case 'b':
+        binary_output = optarg;
+        break;
+      case 'c':
+        options.cross_time = atoi(optarg);
+        if (options.cross_time < 0)
+        {
+          log_error("(Controller):\t Invalid cross time %s\n", optarg);
+          return 1;
+        }
+        break;
+      case 'e':
+        if (strcmp(optarg, "threads") == 0)
+        {
+          options.engine = THREADED_ENGINE;
+        }
+        else if (strcmp(optarg, "batch") == 0)
+        {
+          options.engine = BATCH_ENGINE;
+        }
+        else if (strcmp(optarg, "event") == 0)
+        {
+          options.engine = EVENT_ENGINE;
+        }
+        else
+        {
+          log_error("(Controller):\t Unknown engine %s\n", optarg);
+          return 1;
+        }
+        break;
+      case 'F':
+        if (!parse_priority(optarg, &placement))
+        {
+          return 1;
+        }
+        options.placement = &placement;
+        break;
+      case 'l':
+        log_level = atoi(optarg);
+        break;
+      case 'L':
+        options.lookahead = atoi(optarg);
+        if (options.lookahead < 1)
+        {
+          log_error("(Controller):\t Invalid lookahead %s, has to be at least 1\n", optarg);
+          return 1;
+        }
+        break;
+      case 'm':
+        metrics_address = optarg;
+        break;
+      case 'n':
+        if (sscanf(optarg, "%dx%d", &network.rows, &network.cols) != 2 || network.rows <= 0 || network.cols <= 0)
+        {
+          log_error("(Controller):\t Invalid network size %s, expected rowsxcols\n", optarg);
+          return 1;
+        }
+        break;
+      case 'p':
+        if (!parse_policy(optarg, &options.policy, &options.max_wait))
+        {
+          return 1;
+        }
+        break;
+      case 'P':
+      {
+        int fields = sscanf(optarg, "%d:%d", &options.platoon, &options.platoon_wait);
+        if (fields < 1 || options.platoon < 1 || (fields == 2 && options.platoon_wait < 1))
+        {
+          log_error("(Controller):\t Invalid platoon %s, expected cars or cars:wait\n", optarg);
+          return 1;
+        }
+        platoon_set = true;
+        break;
+      }
+      case 'r':
+        record_file = optarg;
+        break;
+      case 'R':
+        replay_file = optarg;
+        break;
+      case 's':
+        options.time_scale = atof(optarg);
+        if (options.time_scale <= 0)
+        {
+          log_error("(Controller):\t Invalid time scale %s\n", optarg);
+          return 1;
+        }
+        break;
+      case 'S':
+        show_stats = true;
+        break;
+      case 't':
+        topology_file = optarg;
+        break;
+      case 'T':
+        network.travel_time = atoi(optarg);
+        if (network.travel_time < 1)
+        {
+          log_error("(Controller):\t Invalid travel time %s, has to be at least 1\n", optarg);
+          return 1;
+        }
+        break;
+      case 'v':
+        options.virtual_time = true;
+        break;
+      case 'w':
+        network.workers = atoi(optarg);
+        if (network.workers <= 0)
+        {
+          log_error("(Controller):\t Invalid number of workers %s\n", optarg);
+          return 1;
+        }
+        break;
+      default:
+        usage(argv[0]);
+        return option == 'h' ? 0 : 1;
+    }
+  }
+  if (optind < argc - 1)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+  if ((record_file != NULL || replay_file != NULL) && (network.rows > 0 || (record_file != NULL && replay_file != NULL)))
+  {
+    log_error("(Controller):\t Grants are recorded or replayed for a single intersection, one of -r and -R\n");
+    return 1;
+  }
+  if ((options.lookahead > 0 || metrics_address != NULL) && network.rows > 0)
+  {
+    log_error("(Controller):\t A lookahead and metrics are for a single intersection\n");
+    return 1;
+  }
+  // the junctions of a network always run the batch rules, greening the largest group of compatible lights with a car
+  if (network.rows > 0 && (options.policy != GREEDY_POLICY || platoon_set || options.engine != THREADED_ENGINE))
+  {
+    log_error("(Controller):\t The junctions of a network run the batch rules, -p, -P and -e are for a single intersection\n");
+    return 1;
+  }
+  if (options.policy == ADAPTIVE_POLICY && !platoon_set)
+  {
+    options.platoon = ADAPTIVE_PLATOON;
+  }
+
+  // set up the layout of the intersection, the default one comes with precomputed conflict tables
+  Topology topology;
+  bool topology_loaded = topology_file != NULL
+    ? load_topology(&topology, topology_file)
+    : init_topology(&topology, DEFAULT_APPROACHES, DEFAULT_LANES, DEFAULT_SECTIONS, default_lights, NUM_DEFAULT_LIGHTS, &default_tables);
+  if (!topology_loaded)
+  {
+    return 1;
+  }
+  log_info("(Controller):\t %d approaches, %d lanes per approach, %d sections, %d lights\n",
+    topology.num_approaches, topology.num_lanes, topology.num_sections, topology.num_lights);
+
+  // open the trace of arrivals
+  ArrivalLoader* arrival_loader;
+  if (optind < argc)
+  {
+    arrival_loader = open_arrivals(argv[optind]);
+  }
+  else
+  {
+    arrival_loader = open_arrivals_array(input_arrivals, sizeof(input_arrivals)/sizeof(Arrival));
+  }
+  if (arrival_loader == NULL)
+  {
+    return 1;
+  }
+  // the scheduler reads the trace a second time, ahead of the supplier
+  if (options.lookahead > 0)
+  {
+    if (optind < argc && (strcmp(argv[optind], "-") == 0 || is_stream_address(argv[optind])))
+    {
+      log_error("(Controller):\t A lookahead reads the trace twice, it cannot be stdin or live arrivals\n");
+      return 1;
+    }
+    options.forecast = optind < argc
+      ? open_arrivals(argv[optind])
+      : open_arrivals_array(input_arrivals, sizeof(input_arrivals)/sizeof(Arrival));
+    if (options.forecast == NULL)
+    {
+      return 1;
+    }
+  }
+
+  // a network of intersections is simulated on a pool of workers, and only reports a summary
+  if (network.rows > 0)
+  {
+    network.cross_time = options.cross_time;
+    start_logging();
+    bool ran = run_network(&topology, arrival_loader, &network);
+    close_arrivals(arrival_loader);
+    stop_logging();
+    write_lock_profile();
+    free_topology(&topology);
+    return ran ? 0 : 1;
+  }
+
+  // choose where the light changes are written
+  if (binary_output != NULL)
+  {
+    if (!use_binary_output(binary_output))
+    {
+      return 1;
+    }
+  }
+  else
+  {
+    use_text_output();
+  }
+
+  if (record_file != NULL || replay_file != NULL)
+  {
+    options.grants = record_file != NULL ? record_grants(record_file) : replay_grants(replay_file);
+    if (options.grants == NULL)
+    {
+      return 1;
+    }
+  }
+  // a replay of another trace cannot follow the grants, which is checked with a first pass over the trace
+  if (replay_file != NULL)
+  {
+    if (optind < argc && (strcmp(argv[optind], "-") == 0 || is_stream_address(argv[optind])))
+    {
+      log_error("(Controller):\t A replay reads the trace twice, it cannot be stdin or live arrivals\n");
+      return 1;
+    }
+    ArrivalLoader* trace = optind < argc
+      ? open_arrivals(argv[optind])
+      : open_arrivals_array(input_arrivals, sizeof(input_arrivals)/sizeof(Arrival));
+    if (trace == NULL)
+    {
+      return 1;
+    }
+    Arrival arrival;
+    while (next_arrival(trace, &arrival));
+    TraceFingerprint fingerprint;
+    arrival_fingerprint(trace, &fingerprint);
+    close_arrivals(trace);
+    if (!use_grant_trace(options.grants, &fingerprint))
+    {
+      return 1;
+    }
+  }
+  Intersection* intersection = create_intersection(&topology, &options);
+  if (intersection == NULL)
+  {
+    return 1;
+  }
+
+  // print the statistics on SIGUSR1 from a thread of its own, every thread created from here on blocks the signal
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGUSR1);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+  pthread_t dump_thread;
+  bool dumping = pthread_create(&dump_thread, NULL, dump_stats_on_signal, intersection) == 0;
+  MetricsServer* metrics = NULL;
+  if (metrics_address != NULL)
+  {
+    metrics = start_metrics(metrics_address, intersection);
+    if (metrics == NULL)
+    {
+      return 1;
+    }
+  }
+
+  // from here on, log messages are written by a background thread
+  start_logging();
+  bool ran = run_intersection(intersection, arrival_loader);
+  if (metrics != NULL)
+  {
+    stop_metrics(metrics);
+  }
+  if (dumping)
+  {
+    atomic_store(&stop_dumping, true);
+    pthread_kill(dump_thread, SIGUSR1);
+    pthread_join(dump_thread, NULL);
+  }
+  // a recording keeps the fingerprint of the trace it ran
+  if (record_file != NULL)
+  {
+    TraceFingerprint fingerprint;
+    arrival_fingerprint(arrival_loader, &fingerprint);
+    use_grant_trace(options.grants, &fingerprint);
+  }
+  close_arrivals(arrival_loader);
+  if (options.forecast != NULL)
+  {
+    close_arrivals(options.forecast);
+  }
+  close_output();
+  stop_logging();
+  if (options.grants != NULL && !close_grant_log(options.grants))
+  {
+    ran = false;
+  }
+
+  if (ran && show_stats)
+  {
+    print_intersection_stats(intersection);
+  }
+  write_lock_profile();
+
+  destroy_intersection(intersection);
+  free_topology(&topology);
+  return ran ? 0 : 1;
+}
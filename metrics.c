@@ -0,0 +1,193 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include "metrics.h"
+#include "sockets.h"
+#include "log.h"
+
+// the most bytes of a request that are read, the request line is all that matters
+#define MAX_REQUEST 4096
+
+/*
+ * MetricsServer
+ *
+ * listener: the listening socket, shut down by stop_metrics to end the accept of the thread
+ * path: the path of the Unix socket, NULL for TCP
+ */
+struct MetricsServer
+{
+  Intersection* intersection;
+  int listener;
+  char* path;
+  pthread_t thread;
+};
+
+
+/*
+ * send_all(int connection, const char* data, size_t size)
+ *
+ * write all of the data, returns false when the client went away
+ */
+static bool send_all(int connection, const char* data, size_t size)
+{
+  while (size > 0)
+  {
+    // a client that closed the connection must not kill the simulation with SIGPIPE
+    ssize_t sent = send(connection, data, size, MSG_NOSIGNAL);
+    if (sent < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (sent <= 0)
+    {
+      return false;
+    }
+    data += sent;
+    size -= sent;
+  }
+  return true;
+}
+
+
+/*
+ * serve_request(MetricsServer* server, int connection)
+ *
+ * read a request and answer a GET with the metrics, anything else with an error
+ */
+static void serve_request(MetricsServer* server, int connection)
+{
+  // a client that sends nothing only holds up the next scrape, never the lights
+  struct timeval timeout = {1, 0};
+  setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  char request[MAX_REQUEST + 1];
+  size_t length = 0;
+  while (length < MAX_REQUEST)
+  {
+    ssize_t received = recv(connection, request + length, MAX_REQUEST - length, 0);
+    if (received <= 0)
+    {
+      break;
+    }
+    length += received;
+    request[length] = '\0';
+    if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL)
+    {
+      break;
+    }
+  }
+  request[length] = '\0';
+  if (strncmp(request, "GET ", 4) != 0)
+  {
+    static const char bad_request[] = "HTTP/1.0 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    send_all(connection, bad_request, sizeof(bad_request) - 1);
+    return;
+  }
+
+  char* body = NULL;
+  size_t body_size = 0;
+  FILE* out = open_memstream(&body, &body_size);
+  if (out == NULL)
+  {
+    log_error("(Metrics):\t Out of memory\n");
+    return;
+  }
+  write_intersection_metrics(server->intersection, out);
+  if (fclose(out) != 0)
+  {
+    log_error("(Metrics):\t Out of memory\n");
+    free(body);
+    return;
+  }
+  char header[256];
+  int header_size = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+    "Content-Length: %zu\r\nConnection: close\r\n\r\n", body_size);
+  if (send_all(connection, header, header_size))
+  {
+    send_all(connection, body, body_size);
+  }
+  free(body);
+}
+
+
+/*
+ * serve_metrics(void* arg)
+ *
+ * The thread of the server given as argument, answers one connection at a time until the listener is shut down
+ */
+static void* serve_metrics(void* arg)
+{
+  MetricsServer* server = arg;
+  while (true)
+  {
+    int connection = accept4(server->listener, NULL, NULL, SOCK_CLOEXEC);
+    if (connection < 0)
+    {
+      if (errno == EINTR || errno == ECONNABORTED)
+      {
+        continue;
+      }
+      // stop_metrics shut the listener down
+      break;
+    }
+    serve_request(server, connection);
+    close(connection);
+  }
+  return(0);
+}
+
+
+MetricsServer* start_metrics(const char* address, Intersection* intersection)
+{
+  MetricsServer* server = calloc(1, sizeof(MetricsServer));
+  if (server == NULL)
+  {
+    log_error("(Metrics):\t Out of memory\n");
+    return NULL;
+  }
+  server->intersection = intersection;
+  server->listener = open_listener(address, SOCK_STREAM, "(Metrics)", &server->path);
+  if (server->listener < 0)
+  {
+    free(server);
+    return NULL;
+  }
+  int error = pthread_create(&server->thread, NULL, serve_metrics, server);
+  if (error != 0)
+  {
+    log_error("(Metrics):\t Cannot create the metrics thread: %s\n", strerror(error));
+    close(server->listener);
+    if (server->path != NULL)
+    {
+      unlink(server->path);
+      free(server->path);
+    }
+    free(server);
+    return NULL;
+  }
+  log_info("(Metrics):\t Serving metrics on %s\n", address);
+  return server;
+}
+
+
+void stop_metrics(MetricsServer* server)
+{
+  // shutting the listener down makes the accept of the thread fail, a request being answered is finished first
+  shutdown(server->listener, SHUT_RDWR);
+  pthread_join(server->thread, NULL);
+  close(server->listener);
+  if (server->path != NULL)
+  {
+    unlink(server->path);
+    free(server->path);
+  }
+  free(server);
+}
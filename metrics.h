@@ -0,0 +1,33 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "intersection.h"
+
+/*
+ * MetricsServer
+ *
+ * A thread that serves the metrics of an intersection (write_intersection_metrics) in the Prometheus text format
+ *   over HTTP, to every GET request on a Unix socket or a TCP port, one connection at a time
+ * A scrape only reads the counters that the threads of the intersection keep anyway and takes none of their locks,
+ *   so it does not slow the lights down, whatever the rate of scrapes
+ */
+typedef struct MetricsServer MetricsServer;
+
+/*
+ * start_metrics(const char* address, Intersection* intersection)
+ *
+ * serve the metrics of the intersection on the address: a path for a Unix socket, for example
+ *   curl --unix-socket /tmp/intersection.sock http://localhost/metrics, or [host]:port for TCP
+ * a socket file left at the path by an earlier run is replaced
+ * returns NULL (and logs the reason) when the address cannot be listened on or the thread cannot be created
+ */
+MetricsServer* start_metrics(const char* address, Intersection* intersection);
+
+/*
+ * stop_metrics(MetricsServer* server)
+ *
+ * stop serving, remove the Unix socket and free the server, before the intersection is destroyed
+ */
+void stop_metrics(MetricsServer* server);
+
+#endif
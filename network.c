@@ -0,0 +1,596 @@
+#define __USE_POSIX199309 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+
+#include "network.h"
+#include "thread_pool.h"
+#include "lane_queue.h"
+#include "stats.h"
+#include "log.h"
+
+// the time of a junction without events
+#define NO_EVENT INT_MAX
+
+
+/*
+ * NetworkCar
+ *
+ * A car in the network: its id, the lane (side and direction) it waits in at its current junction,
+ *   and the time it reached the stop line there
+ * hops is the number of junctions it passed before, at most rows + cols
+ * The lane and hops are narrowed so that a car takes 12 bytes, not 20, in the queues, heaps and deliveries of large networks
+ */
+typedef struct
+{
+  int id;
+  int time;
+  uint8_t side;
+  uint8_t direction;
+  uint16_t hops;
+} NetworkCar;
+
+/*
+ * CarQueue
+ *
+ * A growing ring of the cars waiting in a lane of a junction
+ * A junction is simulated by one worker at a time, so the queue needs no synchronization
+ */
+typedef struct
+{
+  NetworkCar* cars;
+  int head;
+  int count;
+  int capacity;
+} CarQueue;
+
+/*
+ * CarHeap
+ *
+ * The cars on their way to the stop line of a junction, a binary min-heap by arrival time
+ * Ties are broken by id and lane, so the order does not depend on which worker delivered a car
+ */
+typedef struct
+{
+  NetworkCar* cars;
+  int count;
+  int capacity;
+} CarHeap;
+
+/*
+ * Junction
+ *
+ * The state of one intersection in the network, each on its own cache lines
+ * next_event is the time of the next arrival at the stop line or end of a crossing, NO_EVENT if there is none
+ */
+typedef struct
+{
+  _Alignas(CACHE_LINE_SIZE) int row;
+  int col;
+  int next_event;
+  uint32_t crossing;
+  SectionMask taken;
+  int crossing_end[MAX_LIGHTS];
+  CarQueue* lanes;
+  CarHeap pending;
+} Junction;
+
+/*
+ * Delivery
+ *
+ * A car that left a junction during a step, for the pending heap of its next junction
+ */
+typedef struct
+{
+  int junction;
+  NetworkCar car;
+} Delivery;
+
+/*
+ * NetworkWorker
+ *
+ * The statistics and deliveries of one worker of the pool, merged by the driver after every step
+ */
+typedef struct
+{
+  _Alignas(CACHE_LINE_SIZE) Histogram waits;
+  uint64_t passages;
+  uint64_t exited;
+  uint64_t dropped;
+  Delivery* deliveries;
+  int num_deliveries;
+  int capacity;
+} NetworkWorker;
+
+/*
+ * Network
+ *
+ * The state of the whole simulation, the context of the tasks of a step
+ * side_lights[s] lists the lights of the entry lanes on side s, side_counts[s] their number
+ */
+typedef struct
+{
+  const Topology* topology;
+  const NetworkOptions* options;
+  int num_junctions;
+  Junction* junctions;
+  NetworkWorker* workers;
+  int now;
+  int side_lights[4][MAX_LIGHTS];
+  int side_counts[4];
+} Network;
+
+
+static bool queue_push(CarQueue* queue, const NetworkCar* car)
+{
+  if (queue->count == queue->capacity)
+  {
+    int capacity = queue->capacity > 0 ? queue->capacity * 2 : 16;
+    NetworkCar* cars = malloc(capacity * sizeof(NetworkCar));
+    if (cars == NULL)
+    {
+      return false;
+    }
+    // unwrap the ring into the new buffer
+    for (int i = 0; i < queue->count; i++)
+    {
+      cars[i] = queue->cars[(queue->head + i) % queue->capacity];
+    }
+    free(queue->cars);
+    queue->cars = cars;
+    queue->head = 0;
+    queue->capacity = capacity;
+  }
+  queue->cars[(queue->head + queue->count) % queue->capacity] = *car;
+  queue->count += 1;
+  return true;
+}
+
+
+static NetworkCar queue_pop(CarQueue* queue)
+{
+  NetworkCar car = queue->cars[queue->head];
+  queue->head = (queue->head + 1) % queue->capacity;
+  queue->count -= 1;
+  return car;
+}
+
+
+/*
+ * car_before(const NetworkCar* a, const NetworkCar* b)
+ *
+ * returns whether car a reaches the stop line before car b
+ */
+static bool car_before(const NetworkCar* a, const NetworkCar* b)
+{
+  if (a->time != b->time)
+  {
+    return a->time < b->time;
+  }
+  if (a->id != b->id)
+  {
+    return a->id < b->id;
+  }
+  if (a->side != b->side)
+  {
+    return a->side < b->side;
+  }
+  return a->direction < b->direction;
+}
+
+
+static bool heap_push(CarHeap* heap, const NetworkCar* car)
+{
+  if (heap->count == heap->capacity)
+  {
+    int capacity = heap->capacity > 0 ? heap->capacity * 2 : 16;
+    NetworkCar* cars = realloc(heap->cars, capacity * sizeof(NetworkCar));
+    if (cars == NULL)
+    {
+      return false;
+    }
+    heap->cars = cars;
+    heap->capacity = capacity;
+  }
+  int position = heap->count;
+  heap->count += 1;
+  while (position > 0 && car_before(car, &heap->cars[(position - 1) / 2]))
+  {
+    heap->cars[position] = heap->cars[(position - 1) / 2];
+    position = (position - 1) / 2;
+  }
+  heap->cars[position] = *car;
+  return true;
+}
+
+
+static NetworkCar heap_pop(CarHeap* heap)
+{
+  NetworkCar first = heap->cars[0];
+  heap->count -= 1;
+  NetworkCar last = heap->cars[heap->count];
+  int position = 0;
+  while (true)
+  {
+    int child = 2 * position + 1;
+    if (child >= heap->count)
+    {
+      break;
+    }
+    if (child + 1 < heap->count && car_before(&heap->cars[child + 1], &heap->cars[child]))
+    {
+      child += 1;
+    }
+    if (!car_before(&heap->cars[child], &last))
+    {
+      break;
+    }
+    heap->cars[position] = heap->cars[child];
+    position = child;
+  }
+  heap->cars[position] = last;
+  return first;
+}
+
+
+/*
+ * route_hash(int id, int hops)
+ *
+ * get a well mixed number for the choice of lane of a car at its next junction
+ */
+static uint32_t route_hash(int id, int hops)
+{
+  uint32_t hash = (uint32_t)id * 0x9e3779b9u + (uint32_t)hops * 0x85ebca6bu;
+  hash ^= hash >> 16;
+  hash *= 0x7feb352du;
+  hash ^= hash >> 15;
+  return hash;
+}
+
+
+/*
+ * deliver(Network* network, NetworkWorker* worker, const Junction* junction, int light, NetworkCar car)
+ *
+ * send a car that crossed the junction at the light to the neighbour on the side its lane turns to,
+ *   or count it as having left the network
+ */
+static void deliver(Network* network, NetworkWorker* worker, const Junction* junction, int light, NetworkCar car)
+{
+  const Light* from = &network->topology->lights[light];
+  // turning left, going straight or turning right leaves a quarter, half or three quarters clockwise of the entry side
+  int exit_side = (from->side + (from->direction == LEFT ? 1 : from->direction == STRAIGHT ? 2 : 3)) % 4;
+  int row = junction->row + (exit_side == SOUTH) - (exit_side == NORTH);
+  int col = junction->col + (exit_side == EAST) - (exit_side == WEST);
+  int entry_side = (exit_side + 2) % 4;
+  const NetworkOptions* options = network->options;
+  car.hops += 1;
+  if (row < 0 || row >= options->rows || col < 0 || col >= options->cols
+    || car.hops >= options->rows + options->cols || network->side_counts[entry_side] == 0)
+  {
+    worker->exited += 1;
+    return;
+  }
+
+  if (worker->num_deliveries == worker->capacity)
+  {
+    int capacity = worker->capacity > 0 ? worker->capacity * 2 : 64;
+    Delivery* deliveries = realloc(worker->deliveries, capacity * sizeof(Delivery));
+    if (deliveries == NULL)
+    {
+      log_error("(Network):\t Out of memory, dropping car %d\n", car.id);
+      worker->dropped += 1;
+      return;
+    }
+    worker->deliveries = deliveries;
+    worker->capacity = capacity;
+  }
+  int next_light = network->side_lights[entry_side][route_hash(car.id, car.hops) % network->side_counts[entry_side]];
+  car.side = network->topology->lights[next_light].side;
+  car.direction = network->topology->lights[next_light].direction;
+  car.time = network->now + options->travel_time;
+  Delivery* delivery = &worker->deliveries[worker->num_deliveries];
+  delivery->junction = row * options->cols + col;
+  delivery->car = car;
+  worker->num_deliveries += 1;
+}
+
+
+/*
+ * step_junction(void* context, int index, int worker_index)
+ *
+ * simulate one junction at the current time of the network, a task of the pool:
+ * - makes the lights whose car has passed turn red, and sends the cars on to the next junction
+ * - moves the cars that reached the stop line into their lanes
+ * - makes the largest group of compatible lights with a waiting car turn green
+ */
+static void step_junction(void* context, int index, int worker_index)
+{
+  Network* network = context;
+  const Topology* topology = network->topology;
+  Junction* junction = &network->junctions[index];
+  NetworkWorker* worker = &network->workers[worker_index];
+  int now = network->now;
+
+  // make the lights whose car has passed turn red
+  for (uint32_t lights = junction->crossing; lights != 0; lights &= lights - 1)
+  {
+    int i = __builtin_ctz(lights);
+    if (junction->crossing_end[i] <= now)
+    {
+      NetworkCar car = queue_pop(&junction->lanes[i]);
+      log_debug("(Junction %d):\t Car %d passed light %d / %d @ t%d\n", index, car.id, topology->lights[i].side,
+        topology->lights[i].direction, now);
+      junction->crossing &= ~(1u << i);
+      junction->taken &= ~topology->lights[i].sections;
+      worker->passages += 1;
+      deliver(network, worker, junction, i, car);
+    }
+  }
+
+  // the cars that reached the stop line join the back of their lane
+  while (junction->pending.count > 0 && junction->pending.cars[0].time <= now)
+  {
+    NetworkCar car = heap_pop(&junction->pending);
+    int light = topology_light(topology, car.side, car.direction);
+    if (!queue_push(&junction->lanes[light], &car))
+    {
+      log_error("(Junction %d):\t Out of memory, dropping car %d\n", index, car.id);
+      worker->dropped += 1;
+    }
+  }
+
+  // turn the best group of the lights with a waiting car whose sections are free green
+  uint32_t ready = 0;
+  for (int i = 0; i < topology->num_lights; i++)
+  {
+    if (!(junction->crossing & (1u << i)) && (topology->lights[i].sections & junction->taken) == 0 && junction->lanes[i].count > 0)
+    {
+      ready |= 1u << i;
+    }
+  }
+  uint32_t group = best_group(topology, ready);
+  for (uint32_t lights = group; lights != 0; lights &= lights - 1)
+  {
+    int i = __builtin_ctz(lights);
+    const NetworkCar* car = &junction->lanes[i].cars[junction->lanes[i].head];
+    log_debug("(Junction %d):\t Light %d / %d green for car %d @ t%d\n", index, topology->lights[i].side,
+      topology->lights[i].direction, car->id, now);
+    histogram_record(&worker->waits, now - car->time);
+    junction->crossing |= 1u << i;
+    junction->crossing_end[i] = now + network->options->cross_time;
+    junction->taken |= topology->lights[i].sections;
+  }
+
+  // the next arrival at the stop line or end of a crossing
+  junction->next_event = junction->pending.count > 0 ? junction->pending.cars[0].time : NO_EVENT;
+  for (uint32_t lights = junction->crossing; lights != 0; lights &= lights - 1)
+  {
+    int i = __builtin_ctz(lights);
+    if (junction->crossing_end[i] < junction->next_event)
+    {
+      junction->next_event = junction->crossing_end[i];
+    }
+  }
+}
+
+
+/*
+ * enter_car(Junction* junction, const NetworkCar* car, uint64_t* dropped)
+ *
+ * add a car to the pending heap of the junction, and move its next event forward if needed
+ */
+static void enter_car(Junction* junction, const NetworkCar* car, uint64_t* dropped)
+{
+  if (!heap_push(&junction->pending, car))
+  {
+    log_error("(Network):\t Out of memory, dropping car %d\n", car->id);
+    *dropped += 1;
+    return;
+  }
+  if (car->time < junction->next_event)
+  {
+    junction->next_event = car->time;
+  }
+}
+
+
+bool run_network(const Topology* topology, ArrivalLoader* loader, const NetworkOptions* options)
+{
+  if (topology->num_approaches != 4 || topology->num_lanes != 3)
+  {
+    log_error("(Network):\t Cars are routed by the turn of their lane, which needs 4 approaches of 3 lanes\n");
+    return false;
+  }
+  // the hops of a car are counted up to rows + cols in 16 bits
+  if (options->rows <= 0 || options->cols <= 0 || options->rows + options->cols > UINT16_MAX || options->workers <= 0
+    || options->travel_time < 1 || options->cross_time < 0)
+  {
+    log_error("(Network):\t Invalid network options\n");
+    return false;
+  }
+
+  Network network;
+  memset(&network, 0, sizeof(network));
+  network.topology = topology;
+  network.options = options;
+  network.num_junctions = options->rows * options->cols;
+  for (int i = 0; i < topology->num_lights; i++)
+  {
+    int side = topology->lights[i].side;
+    network.side_lights[side][network.side_counts[side]] = i;
+    network.side_counts[side] += 1;
+  }
+
+  network.junctions = aligned_alloc(CACHE_LINE_SIZE, network.num_junctions * sizeof(Junction));
+  network.workers = aligned_alloc(CACHE_LINE_SIZE, options->workers * sizeof(NetworkWorker));
+  int* due = malloc(network.num_junctions * sizeof(int));
+  ThreadPool* pool = NULL;
+  if (network.junctions != NULL)
+  {
+    memset(network.junctions, 0, network.num_junctions * sizeof(Junction));
+  }
+  if (network.workers != NULL)
+  {
+    memset(network.workers, 0, options->workers * sizeof(NetworkWorker));
+  }
+  bool ok = network.junctions != NULL && network.workers != NULL && due != NULL;
+  if (ok)
+  {
+    for (int i = 0; i < network.num_junctions && ok; i++)
+    {
+      network.junctions[i].row = i / options->cols;
+      network.junctions[i].col = i % options->cols;
+      network.junctions[i].next_event = NO_EVENT;
+      network.junctions[i].lanes = calloc(topology->num_lights, sizeof(CarQueue));
+      ok = network.junctions[i].lanes != NULL;
+    }
+  }
+  if (!ok)
+  {
+    log_error("(Network):\t Out of memory\n");
+  }
+  else
+  {
+    pool = create_pool(options->workers);
+    ok = pool != NULL;
+  }
+
+  log_info("(Network):\t Simulating %d x %d intersections on %d workers\n", options->rows, options->cols, options->workers);
+  struct timespec wall_start;
+  clock_gettime(CLOCK_MONOTONIC, &wall_start);
+
+  uint64_t entered = 0, dropped = 0;
+  long steps = 0;
+  Arrival next;
+  bool have_next = ok && next_arrival(loader, &next);
+  while (ok)
+  {
+    // the next time anything happens: a car enters the network, reaches a stop line or has crossed
+    int now = have_next ? next.time : NO_EVENT;
+    for (int i = 0; i < network.num_junctions; i++)
+    {
+      if (network.junctions[i].next_event < now)
+      {
+        now = network.junctions[i].next_event;
+      }
+    }
+    if (now == NO_EVENT)
+    {
+      break;
+    }
+    network.now = now;
+
+    // the cars of the trace that enter the network now
+    while (have_next && next.time <= now)
+    {
+      Junction* junction = &network.junctions[(unsigned int)next.id % network.num_junctions];
+      if (topology_light(topology, next.side, next.direction) < 0)
+      {
+        log_error("(Network):\t No traffic light for lane %d / %d, skipping car %d\n", next.side, next.direction, next.id);
+      }
+      else
+      {
+        // the lane of a car that has a light fits in 8 bits, as there are 4 approaches of 3 lanes
+        NetworkCar car = {next.id, next.time, next.side, next.direction, 0};
+        enter_car(junction, &car, &dropped);
+        entered += 1;
+      }
+      have_next = next_arrival(loader, &next);
+    }
+
+    // simulate every junction with an event now, in parallel
+    // the cars leaving a junction only arrive at the next one travel_time later, so the junctions are independent
+    int num_due = 0;
+    for (int i = 0; i < network.num_junctions; i++)
+    {
+      if (network.junctions[i].next_event <= now)
+      {
+        due[num_due] = i;
+        num_due += 1;
+      }
+    }
+    pool_run(pool, step_junction, &network, due, num_due);
+    steps += 1;
+
+    // hand the cars that left a junction to their next one
+    for (int w = 0; w < options->workers; w++)
+    {
+      NetworkWorker* worker = &network.workers[w];
+      for (int i = 0; i < worker->num_deliveries; i++)
+      {
+        Delivery* delivery = &worker->deliveries[i];
+        enter_car(&network.junctions[delivery->junction], &delivery->car, &dropped);
+      }
+      worker->num_deliveries = 0;
+    }
+  }
+
+  if (ok)
+  {
+    struct timespec wall_end;
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+    double wall_time = (wall_end.tv_sec - wall_start.tv_sec) + (wall_end.tv_nsec - wall_start.tv_nsec) / 1e9;
+
+    Histogram* waits = malloc(sizeof(Histogram));
+    uint64_t passages = 0, exited = 0;
+    if (waits != NULL)
+    {
+      memset(waits, 0, sizeof(Histogram));
+    }
+    for (int w = 0; w < options->workers; w++)
+    {
+      passages += network.workers[w].passages;
+      exited += network.workers[w].exited;
+      dropped += network.workers[w].dropped;
+      if (waits != NULL)
+      {
+        histogram_merge(waits, &network.workers[w].waits);
+      }
+    }
+    printf("(Network):\t %d x %d intersections, %d workers\n", options->rows, options->cols, options->workers);
+    printf("(Network):\t cars %lu entered, %lu left, %lu dropped, %lu passages\n", entered, exited, dropped, passages);
+    printf("(Network):\t simulated time %d s, %ld steps, wall time %.6f s, %.1f passages/s wall\n",
+      network.now, steps, wall_time, wall_time > 0 ? passages / wall_time : 0.0);
+    if (waits != NULL)
+    {
+      printf("(Network):\t wait mean %.2f s, p50 %lu s, p99 %lu s, max %lu s\n",
+        waits->count > 0 ? waits->sum / (double)waits->count : 0.0,
+        histogram_percentile(waits, 50), histogram_percentile(waits, 99), waits->max);
+      free(waits);
+    }
+  }
+
+  if (pool != NULL)
+  {
+    destroy_pool(pool);
+  }
+  if (network.junctions != NULL)
+  {
+    for (int i = 0; i < network.num_junctions; i++)
+    {
+      if (network.junctions[i].lanes != NULL)
+      {
+        for (int j = 0; j < topology->num_lights; j++)
+        {
+          free(network.junctions[i].lanes[j].cars);
+        }
+        free(network.junctions[i].lanes);
+      }
+      free(network.junctions[i].pending.cars);
+    }
+  }
+  if (network.workers != NULL)
+  {
+    for (int w = 0; w < options->workers; w++)
+    {
+      free(network.workers[w].deliveries);
+    }
+  }
+  free(network.junctions);
+  free(network.workers);
+  free(due);
+  return ok;
+}
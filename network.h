@@ -0,0 +1,42 @@
+#ifndef NETWORK_H
+#define NETWORK_H
+
+#include <stdbool.h>
+
+#include "arrival_loader.h"
+#include "topology.h"
+
+/*
+ * NetworkOptions
+ *
+ * The layout of a network of intersections and how it is simulated
+ * rows, cols: the size of the grid of intersections, neighbours are connected north-south and east-west
+ * workers: the number of threads that simulate the intersections
+ * cross_time: the time in seconds it takes a car to cross an intersection
+ * travel_time: the time in seconds from the exit of an intersection to the stop line of the next one, at least 1
+ */
+typedef struct
+{
+  int rows;
+  int cols;
+  int workers;
+  int cross_time;
+  int travel_time;
+} NetworkOptions;
+
+/*
+ * run_network(const Topology* topology, ArrivalLoader* loader, const NetworkOptions* options)
+ *
+ * simulate a grid of intersections that all have the given topology, in simulated time on a pool of workers
+ * the arrivals of the trace enter the network at intersection (id % (rows * cols)), row by row, in their own lane
+ * a car that passes an intersection leaves it on the side its lane turns to, and arrives at the neighbour there
+ *   travel_time seconds later, in a lane of that side picked by its id, until it leaves the grid
+ *   or has passed rows + cols intersections
+ * every intersection greens the largest group of compatible lights with a waiting car, like the batch engine
+ * the junctions are not Intersection instances: each is a small batch engine of its own without policies,
+ *   platoons, statistics per light or output, so that a worker can step many of them in simulated time
+ * writes a summary of the simulation to stdout, returns false (and logs the reason) when it cannot be run
+ */
+bool run_network(const Topology* topology, ArrivalLoader* loader, const NetworkOptions* options);
+
+#endif
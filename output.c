@@ -0,0 +1,175 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "output.h"
+#include "lock_profile.h"
+#include "log.h"
+
+// the size of the stdout buffer of the text output
+#define TEXT_BUFFER_SIZE (1 << 16)
+
+// the binary output file is mapped in chunks of this many records (the header takes the place of the first record)
+#define CHUNK_RECORDS (1 << 16)
+#define MAX_CHUNKS (1 << 16)
+
+_Static_assert(sizeof(LightChangeHeader) == sizeof(LightChange), "the header takes the place of the first record");
+
+typedef enum {TEXT_OUTPUT, BINARY_OUTPUT} OutputKind;
+
+static OutputKind output_kind = TEXT_OUTPUT;
+
+/*
+ * The state of the binary output
+ * Each writer reserves a slot with a single fetch-add, and writes its record into the mapped chunk of that slot
+ * New chunks are mapped on demand under chunk_lock, chunks that are mapped never move
+ */
+static int binary_fd = -1;
+static _Atomic size_t binary_slots = 1;
+static LightChange* _Atomic chunks[MAX_CHUNKS];
+static pthread_mutex_t chunk_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static LightChange* map_chunk(size_t index);
+
+
+void use_text_output()
+{
+  output_kind = TEXT_OUTPUT;
+  // keep stdout line buffered in a terminal, so the lights can still be followed live
+  if (!isatty(STDOUT_FILENO))
+  {
+    setvbuf(stdout, NULL, _IOFBF, TEXT_BUFFER_SIZE);
+  }
+}
+
+
+bool use_binary_output(const char* path)
+{
+  binary_fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (binary_fd < 0)
+  {
+    log_error("(Output):\t Cannot create %s\n", path);
+    return false;
+  }
+  // the first chunk holds the header
+  if (map_chunk(0) == NULL)
+  {
+    close(binary_fd);
+    binary_fd = -1;
+    return false;
+  }
+  output_kind = BINARY_OUTPUT;
+  return true;
+}
+
+
+/*
+ * map_chunk(size_t index)
+ *
+ * get the chunk with the given index of the binary output file, mapping it when needed
+ * returns NULL when the file cannot be grown or mapped
+ */
+static LightChange* map_chunk(size_t index)
+{
+  LightChange* chunk = atomic_load_explicit(&chunks[index], memory_order_acquire);
+  if (chunk != NULL)
+  {
+    return chunk;
+  }
+  lock_mutex(&chunk_lock, "output chunk");
+  chunk = atomic_load_explicit(&chunks[index], memory_order_relaxed);
+  if (chunk == NULL)
+  {
+    off_t offset = (off_t)index * CHUNK_RECORDS * sizeof(LightChange);
+    off_t size = CHUNK_RECORDS * sizeof(LightChange);
+    if (ftruncate(binary_fd, offset + size) == 0)
+    {
+      chunk = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, binary_fd, offset);
+      if (chunk == MAP_FAILED)
+      {
+        chunk = NULL;
+      }
+    }
+    if (chunk == NULL)
+    {
+      log_error("(Output):\t Cannot grow the binary output to chunk %zu\n", index);
+    }
+    else
+    {
+      if (index == 0)
+      {
+        LightChangeHeader header = {LIGHT_CHANGE_MAGIC, LIGHT_CHANGE_VERSION};
+        memcpy(chunk, &header, sizeof(header));
+      }
+      atomic_store_explicit(&chunks[index], chunk, memory_order_release);
+    }
+  }
+  unlock_mutex(&chunk_lock);
+  return chunk;
+}
+
+
+void output_light_change(const LightChange* change)
+{
+  switch (output_kind)
+  {
+    case TEXT_OUTPUT:
+      if (change->green)
+      {
+        fprintf(stdout, "traffic light %d %d turns green at time %d for car %d\n", change->side, change->direction, change->time, change->car);
+      }
+      else
+      {
+        fprintf(stdout, "traffic light %d %d turns red at time %d\n", change->side, change->direction, change->time);
+      }
+      break;
+    case BINARY_OUTPUT:
+    {
+      size_t slot = atomic_fetch_add(&binary_slots, 1);
+      LightChange* chunk = slot / CHUNK_RECORDS < MAX_CHUNKS ? map_chunk(slot / CHUNK_RECORDS) : NULL;
+      if (chunk != NULL)
+      {
+        chunk[slot % CHUNK_RECORDS] = *change;
+      }
+      break;
+    }
+  }
+}
+
+
+void close_output()
+{
+  switch (output_kind)
+  {
+    case TEXT_OUTPUT:
+      fflush(stdout);
+      break;
+    case BINARY_OUTPUT:
+    {
+      size_t slots = atomic_load(&binary_slots);
+      for (size_t i = 0; i < MAX_CHUNKS; i++)
+      {
+        LightChange* chunk = atomic_load(&chunks[i]);
+        if (chunk != NULL)
+        {
+          munmap(chunk, CHUNK_RECORDS * sizeof(LightChange));
+          chunks[i] = NULL;
+        }
+      }
+      // cut off the unused part of the last chunk
+      if (ftruncate(binary_fd, (off_t)slots * sizeof(LightChange)) != 0)
+      {
+        log_error("(Output):\t Cannot truncate the binary output\n");
+      }
+      close(binary_fd);
+      binary_fd = -1;
+      break;
+    }
+  }
+}
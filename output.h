@@ -0,0 +1,74 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * LightChange
+ *
+ * A fixed size record of a traffic light change, as written by the binary sink
+ */
+typedef struct
+{
+  int32_t time;           // the time at which the traffic light changes
+  int32_t car;            // the car the light turns green for, 0 when it turns red
+  uint16_t side;          // the side of the intersection that the traffic light is for
+  uint16_t direction;     // the direction that the traffic light is for
+  uint8_t green;          // whether the traffic light turns green (1) or red (0)
+  uint8_t padding[3];
+} LightChange;
+
+/*
+ * Binary output files start with this header, which has the same size as a record, followed by LightChange records
+ */
+#define LIGHT_CHANGE_MAGIC "LCHG"
+#define LIGHT_CHANGE_VERSION 1
+
+typedef struct
+{
+  char magic[4];          // LIGHT_CHANGE_MAGIC, not null terminated
+  uint32_t version;       // LIGHT_CHANGE_VERSION
+  uint8_t padding[8];
+} LightChangeHeader;
+
+/*
+ * LightChangeCallback
+ *
+ * A function that receives light changes, together with the argument given with it
+ * an intersection with an output in its options hands its light changes to it instead of the output chosen below,
+ *   from any of its threads
+ */
+typedef void (*LightChangeCallback)(const LightChange* changes, size_t count, void* arg);
+
+/*
+ * use_text_output()
+ *
+ * write light changes as text lines to stdout, fully buffered (the default)
+ */
+void use_text_output();
+
+/*
+ * use_binary_output(const char* path)
+ *
+ * write light changes as LightChange records into a memory mapped file
+ * returns false (and logs the reason) when the file cannot be created
+ */
+bool use_binary_output(const char* path);
+
+/*
+ * output_light_change(const LightChange* change)
+ *
+ * write a light change to the chosen output, may be used by any thread
+ */
+void output_light_change(const LightChange* change);
+
+/*
+ * close_output()
+ *
+ * write all pending light changes and close the output
+ */
+void close_output();
+
+#endif
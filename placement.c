@@ -0,0 +1,201 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "placement.h"
+#include "log.h"
+
+// where the kernel lists the CPUs of every NUMA node
+#define NODE_CPULIST "/sys/devices/system/node/node%d/cpulist"
+
+
+/*
+ * parse_cpu_range(const char** text, int* first, int* last)
+ *
+ * read a CPU (3) or a range of CPUs (1-4) and move text past it, returns false when there is none
+ */
+static bool parse_cpu_range(const char** text, int* first, int* last)
+{
+  char* end;
+  long value = strtol(*text, &end, 10);
+  if (end == *text || value < 0)
+  {
+    return false;
+  }
+  *first = *last = (int)value;
+  if (*end == '-')
+  {
+    const char* start = end + 1;
+    value = strtol(start, &end, 10);
+    if (end == start || value < *first)
+    {
+      return false;
+    }
+    *last = (int)value;
+  }
+  *text = end;
+  return true;
+}
+
+
+/*
+ * node_cpus(int node, CpuMask* mask)
+ *
+ * store the CPUs of the NUMA node in mask, from its cpulist in sysfs
+ * returns false (and logs the reason) when the node does not exist
+ */
+static bool node_cpus(int node, CpuMask* mask)
+{
+  char path[64];
+  snprintf(path, sizeof(path), NODE_CPULIST, node);
+  FILE* in = fopen(path, "r");
+  char line[4096];
+  bool read = in != NULL && fgets(line, sizeof(line), in) != NULL;
+  if (in != NULL)
+  {
+    fclose(in);
+  }
+  memset(mask, 0, sizeof(CpuMask));
+  const char* text = line;
+  int first, last;
+  while (read && parse_cpu_range(&text, &first, &last) && last < MAX_CPUS)
+  {
+    for (int cpu = first; cpu <= last; cpu++)
+    {
+      mask->bits[cpu / 64] |= 1ull << (cpu % 64);
+    }
+    if (*text != ',')
+    {
+      return true;
+    }
+    text++;
+  }
+  log_error("(Controller):\t No CPUs for NUMA node %d in %s\n", node, path);
+  return false;
+}
+
+
+/*
+ * parse_places(const char* text, const char* end, PlaceList* list)
+ *
+ * parse the list of places between text and end
+ * returns false (and logs the reason) when it is malformed or too long
+ */
+static bool parse_places(const char* text, const char* end, PlaceList* list)
+{
+  int num_cpus = (int)sysconf(_SC_NPROCESSORS_CONF);
+  list->count = 0;
+  while (text < end)
+  {
+    int first, last;
+    if (strncmp(text, "node", 4) == 0)
+    {
+      text += 4;
+      if (!parse_cpu_range(&text, &first, &last) || first != last)
+      {
+        break;
+      }
+      if (list->count == MAX_PLACES || !node_cpus(first, &list->places[list->count]))
+      {
+        return false;
+      }
+      list->count += 1;
+    }
+    else
+    {
+      if (!parse_cpu_range(&text, &first, &last))
+      {
+        break;
+      }
+      if (last >= num_cpus || last >= MAX_CPUS)
+      {
+        log_error("(Controller):\t There is no CPU %d, the CPUs are 0-%d\n", last, num_cpus - 1);
+        return false;
+      }
+      for (int cpu = first; cpu <= last; cpu++)
+      {
+        if (list->count == MAX_PLACES)
+        {
+          log_error("(Controller):\t More than %d places\n", MAX_PLACES);
+          return false;
+        }
+        memset(&list->places[list->count], 0, sizeof(CpuMask));
+        list->places[list->count].bits[cpu / 64] = 1ull << (cpu % 64);
+        list->count += 1;
+      }
+    }
+    if (text == end)
+    {
+      return true;
+    }
+    if (*text != ',')
+    {
+      break;
+    }
+    text++;
+  }
+  log_error("(Controller):\t Invalid list of CPUs %.*s, expected CPUs, ranges like 1-4 and nodes like node1\n", (int)(end - text), text);
+  return false;
+}
+
+
+bool parse_placement(const char* text, ThreadPlacement* placement)
+{
+  const char* slash = strchr(text, '/');
+  const char* end = text + strlen(text);
+  if (!parse_places(text, slash != NULL ? slash : end, &placement->supplier))
+  {
+    return false;
+  }
+  if (slash == NULL)
+  {
+    placement->lights = placement->supplier;
+    return true;
+  }
+  return parse_places(slash + 1, end, &placement->lights);
+}
+
+
+bool parse_priority(const char* text, ThreadPlacement* placement)
+{
+  int priority = atoi(text);
+  int lowest = sched_get_priority_min(SCHED_FIFO), highest = sched_get_priority_max(SCHED_FIFO);
+  if (priority < lowest || priority > highest)
+  {
+    log_error("(Controller):\t Invalid priority %s, SCHED_FIFO priorities are %d to %d\n", text, lowest, highest);
+    return false;
+  }
+  placement->priority = priority;
+  return true;
+}
+
+
+void placement_attr(const PlaceList* places, int priority, int thread, pthread_attr_t* attr)
+{
+  pthread_attr_init(attr);
+  if (places->count > 0)
+  {
+    const CpuMask* place = &places->places[thread % places->count];
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int cpu = 0; cpu < MAX_CPUS && cpu < CPU_SETSIZE; cpu++)
+    {
+      if (place->bits[cpu / 64] & (1ull << (cpu % 64)))
+      {
+        CPU_SET(cpu, &cpus);
+      }
+    }
+    pthread_attr_setaffinity_np(attr, sizeof(cpus), &cpus);
+  }
+  if (priority > 0)
+  {
+    struct sched_param param = {.sched_priority = priority};
+    pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(attr, SCHED_FIFO);
+    pthread_attr_setschedparam(attr, &param);
+  }
+}
@@ -0,0 +1,75 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// the most CPUs a place can name, and the most places in a list
+#define MAX_CPUS 1024
+#define MAX_PLACES 64
+
+/*
+ * CpuMask
+ *
+ * A set of CPUs, bit n for CPU n
+ */
+typedef struct
+{
+  uint64_t bits[MAX_CPUS / 64];
+} CpuMask;
+
+/*
+ * PlaceList
+ *
+ * The places a group of threads runs on, thread n of the group runs on places[n % count]
+ * A place is a single CPU, or all CPUs of a NUMA node
+ * count is 0 when the threads may run on any CPU
+ */
+typedef struct
+{
+  CpuMask places[MAX_PLACES];
+  int count;
+} PlaceList;
+
+/*
+ * ThreadPlacement
+ *
+ * Where and how the threads of an intersection run, so that they are not migrated or preempted in real time
+ * supplier: the place of the thread that supplies the arrivals, its first place
+ * lights: the places of the traffic light threads in the order of the topology, or of the scheduler of the batch engine
+ * priority: the SCHED_FIFO priority of these threads, 0 to keep the default scheduling
+ */
+typedef struct
+{
+  PlaceList supplier;
+  PlaceList lights;
+  int priority;
+} ThreadPlacement;
+
+/*
+ * parse_placement(const char* text, ThreadPlacement* placement)
+ *
+ * set the places from a list like "0/1-4,6" or "node0/node1": the places of the supplier, a slash
+ *   and the places of the lights, or a single list that both use
+ * a list has CPUs (3), ranges of CPUs that are a place each (1-4) and NUMA nodes (node1), separated by commas
+ * returns false (and logs the reason) when the list is malformed or names a CPU or node that does not exist
+ */
+bool parse_placement(const char* text, ThreadPlacement* placement);
+
+/*
+ * parse_priority(const char* text, ThreadPlacement* placement)
+ *
+ * set the SCHED_FIFO priority, returns false (and logs the reason) when it is out of the range of SCHED_FIFO
+ */
+bool parse_priority(const char* text, ThreadPlacement* placement);
+
+/*
+ * placement_attr(const PlaceList* places, int priority, int thread, pthread_attr_t* attr)
+ *
+ * initialize the attributes for thread number thread of a group with the given places and SCHED_FIFO priority
+ * the caller destroys the attributes after creating the thread
+ */
+void placement_attr(const PlaceList* places, int priority, int thread, pthread_attr_t* attr);
+
+#endif
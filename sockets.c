@@ -0,0 +1,100 @@
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "sockets.h"
+#include "log.h"
+
+// the connections a stream socket queues before they are accepted
+#define LISTEN_BACKLOG 64
+
+
+/*
+ * bind_socket(int fd, const struct sockaddr* address, socklen_t length, int type)
+ *
+ * bind the socket, and listen on it when it is a stream socket, returns false on failure with errno set
+ */
+static bool bind_socket(int fd, const struct sockaddr* address, socklen_t length, int type)
+{
+  return bind(fd, address, length) == 0 && (type != SOCK_STREAM || listen(fd, LISTEN_BACKLOG) == 0);
+}
+
+
+int open_listener(const char* address, int type, const char* name, char** path)
+{
+  *path = NULL;
+  const char* colon = strrchr(address, ':');
+  if (colon == NULL || strchr(address, '/') != NULL)
+  {
+    struct sockaddr_un local = {.sun_family = AF_UNIX};
+    if (strlen(address) >= sizeof(local.sun_path))
+    {
+      log_error("%s:\t Socket path %s is too long\n", name, address);
+      return -1;
+    }
+    strcpy(local.sun_path, address);
+    // only a socket is replaced, never a file that happens to have the name
+    struct stat status;
+    if (stat(address, &status) == 0 && S_ISSOCK(status.st_mode))
+    {
+      unlink(address);
+    }
+    int fd = socket(AF_UNIX, type | SOCK_CLOEXEC, 0);
+    if (fd < 0 || !bind_socket(fd, (struct sockaddr*)&local, sizeof(local), type))
+    {
+      log_error("%s:\t Cannot listen on %s: %s\n", name, address, strerror(errno));
+      if (fd >= 0)
+      {
+        close(fd);
+      }
+      return -1;
+    }
+    *path = strdup(address);
+    return fd;
+  }
+
+  char host[256];
+  size_t host_length = colon - address;
+  if (host_length >= sizeof(host))
+  {
+    log_error("%s:\t Invalid address %s\n", name, address);
+    return -1;
+  }
+  memcpy(host, address, host_length);
+  host[host_length] = '\0';
+  struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = type, .ai_flags = AI_PASSIVE};
+  struct addrinfo* addresses;
+  int error = getaddrinfo(host_length > 0 ? host : NULL, colon + 1, &hints, &addresses);
+  if (error != 0)
+  {
+    log_error("%s:\t Invalid address %s: %s\n", name, address, gai_strerror(error));
+    return -1;
+  }
+  int fd = -1;
+  for (struct addrinfo* info = addresses; info != NULL && fd < 0; info = info->ai_next)
+  {
+    fd = socket(info->ai_family, info->ai_socktype | SOCK_CLOEXEC, info->ai_protocol);
+    int reuse = 1;
+    if (fd >= 0 && (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0
+      || !bind_socket(fd, info->ai_addr, info->ai_addrlen, type)))
+    {
+      close(fd);
+      fd = -1;
+    }
+  }
+  if (fd < 0)
+  {
+    log_error("%s:\t Cannot listen on %s: %s\n", name, address, strerror(errno));
+  }
+  freeaddrinfo(addresses);
+  return fd;
+}
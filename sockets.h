@@ -0,0 +1,15 @@
+#ifndef SOCKETS_H
+#define SOCKETS_H
+
+/*
+ * open_listener(const char* address, int type, const char* name, char** path)
+ *
+ * create a socket of the type (SOCK_STREAM or SOCK_DGRAM) bound to the address, a Unix socket path
+ *   or [host]:port, and for a stream socket listening for connections
+ * a socket file left at the path by an earlier run is replaced, never another file
+ * stores a copy of the path of a Unix socket in path, to unlink it when done, or NULL
+ * returns the socket, or -1 (and logs the reason with name as prefix) when it cannot be created
+ */
+int open_listener(const char* address, int type, const char* name, char** path);
+
+#endif
@@ -0,0 +1,895 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define __USE_POSIX199309 1
+
+#include <time.h>
+
+#include "arrivals.h"
+#include "arrival_loader.h"
+#include "lights.h"
+#include "conflicts.h"
+#include "topology.h"
+#include "thread_pool.h"
+#include "log.h"
+#include "input.h"
+
+/*
+ * solve_schedule
+ *
+ * Computes the best schedule of the traffic lights for a trace of arrivals offline, knowing every arrival in advance,
+ *   as the ground truth to compare the online engines against
+ * A schedule gives every car the time at which its light turns green, such that:
+ * - a car does not get green before it arrives, and the cars of a lane get green in the order in which they arrived
+ * - a car holds the sections of its light for cross_time seconds from its green
+ * - no two cars hold the same section at the same time
+ * The objective is the total delay (the sum over all cars of green time - arrival time, the waits of -S),
+ *   or the makespan (the time at which the last car has crossed)
+ *
+ * The solver is a branch and bound over the order in which the cars get green, every car getting green as soon as
+ *   its sections are free. Two dominance rules shrink the search without losing the optimum:
+ * - the cars get green in order of time, cars that get green at the same time in order of their light
+ * - a car does not get green while another waiting car could have crossed completely before
+ * The subtrees below the first two choices are searched in parallel on a thread pool, sharing the best schedule found
+ * The search stops after a budget of nodes, the schedule is then the best one found and not necessarily optimal
+ */
+
+typedef enum {TOTAL_DELAY, MAKESPAN} Objective;
+
+// how many nodes a worker searches between checks of the budget and the best cost
+#define NODE_BATCH 4096
+
+// the depth of the search tree at which it is split into parallel tasks
+#define TASK_DEPTH 2
+
+/*
+ * topology, cross_time, objective
+ *
+ * The intersection, the time in seconds a car takes to cross and what the schedule minimises
+ */
+static Topology topology;
+static int cross_time = CROSS_TIME;
+static Objective objective = TOTAL_DELAY;
+
+/*
+ * lane_cars[], lane_sizes[], num_cars
+ *
+ * The arrivals of the trace, per light in the order of the trace, and the number of them
+ */
+static Arrival* lane_cars[MAX_LIGHTS];
+static int lane_sizes[MAX_LIGHTS];
+static int num_cars = 0;
+
+/*
+ * State
+ *
+ * A partial schedule: the cars that got green so far and what that leaves for the others
+ * heads[i]: the next car of the lane of light i, as an index in lane_cars[i]
+ * section_free[s]: the time at which section s + 1 is free again
+ * last_start, last_light: the green time and light of the last car that got green, -1 before the first
+ * cost: the total delay so far, or the makespan so far
+ * scheduled: the number of cars that got green
+ */
+typedef struct
+{
+  int heads[MAX_LIGHTS];
+  int section_free[MAX_SECTIONS];
+  int last_start;
+  int last_light;
+  long long cost;
+  int scheduled;
+} State;
+
+/*
+ * Level
+ *
+ * A node on the path of the depth first search: its state, the lights whose car can get green next
+ *   in the order in which they are tried, and the lower bound of the cost after each of them
+ */
+typedef struct
+{
+  State state;
+  int choices[MAX_LIGHTS];
+  long long bounds[MAX_LIGHTS];
+  int num_choices;
+  int next_choice;
+} Level;
+
+/*
+ * Task
+ *
+ * A subtree of the search: the state after the first choices, and the lights and green times of those choices
+ */
+typedef struct
+{
+  State state;
+  int lights[TASK_DEPTH];
+  int starts[TASK_DEPTH];
+} Task;
+
+/*
+ * Search
+ *
+ * The state shared by the workers of the search
+ * best_cost: the cost of the best complete schedule found, LLONG_MAX before the first
+ * best_lights[], best_starts[]: that schedule, the light and green time of every car in the order they got green,
+ *   written under best_lock
+ * nodes: the number of nodes searched so far, budget: the most nodes to search
+ * stopped: set when the budget ran out, the best schedule is then not proven optimal
+ */
+typedef struct
+{
+  Task* tasks;
+  _Atomic long long best_cost;
+  pthread_mutex_t best_lock;
+  int* best_lights;
+  int* best_starts;
+  _Atomic long long nodes;
+  long long budget;
+  atomic_bool stopped;
+} Search;
+
+
+/*
+ * earliest_start(const State* state, int light)
+ *
+ * get the earliest time at which the next car of the lane of the light can get green: once it arrived
+ *   and all sections of the light are free
+ */
+static int earliest_start(const State* state, int light)
+{
+  int start = lane_cars[light][state->heads[light]].time;
+  for (SectionMask sections = topology.lights[light].sections; sections != 0; sections &= sections - 1)
+  {
+    int free_time = state->section_free[__builtin_ctz(sections)];
+    start = free_time > start ? free_time : start;
+  }
+  return start;
+}
+
+
+/*
+ * give_green(State* state, int light, int start)
+ *
+ * let the next car of the lane of the light get green at start
+ */
+static void give_green(State* state, int light, int start)
+{
+  const Arrival* car = &lane_cars[light][state->heads[light]];
+  for (SectionMask sections = topology.lights[light].sections; sections != 0; sections &= sections - 1)
+  {
+    state->section_free[__builtin_ctz(sections)] = start + cross_time;
+  }
+  state->heads[light] += 1;
+  state->last_start = start;
+  state->last_light = light;
+  if (objective == TOTAL_DELAY)
+  {
+    state->cost += start - car->time;
+  }
+  else if (start + cross_time > state->cost)
+  {
+    state->cost = start + cross_time;
+  }
+  state->scheduled += 1;
+}
+
+
+/*
+ * section_delay(const State* state, const int* releases, uint32_t lights, int section)
+ *
+ * get the least total delay of the remaining cars of the lights when only the section counted,
+ *   with the earliest green of every next car in releases: the cars cross the section one after the other,
+ *   and as they then only differ in when they can start, in the order in which they can start
+ * a car can start after it arrived and one crossing after the car in front of it in its lane could
+ */
+static long long section_delay(const State* state, const int* releases, uint32_t lights, int section)
+{
+  int heads[MAX_LIGHTS], ready[MAX_LIGHTS];
+  for (uint32_t left = lights; left != 0; left &= left - 1)
+  {
+    int light = __builtin_ctz(left);
+    heads[light] = state->heads[light];
+    ready[light] = releases[light];
+  }
+  long long delay = 0;
+  int time = state->section_free[section] > state->last_start ? state->section_free[section] : state->last_start;
+  while (lights != 0)
+  {
+    int first = -1;
+    for (uint32_t left = lights; left != 0; left &= left - 1)
+    {
+      int light = __builtin_ctz(left);
+      first = first < 0 || ready[light] < ready[first] ? light : first;
+    }
+    int arrival = lane_cars[first][heads[first]].time;
+    time = time > ready[first] ? time : ready[first];
+    delay += time - arrival;
+    time += cross_time;
+    heads[first] += 1;
+    if (heads[first] == lane_sizes[first])
+    {
+      lights &= ~(1u << first);
+    }
+    else
+    {
+      int next = lane_cars[first][heads[first]].time;
+      ready[first] += cross_time;
+      ready[first] = next > ready[first] ? next : ready[first];
+    }
+  }
+  return delay;
+}
+
+
+/*
+ * lower_bound(const State* state)
+ *
+ * get a cost that every complete schedule extending the state has at least
+ * every lane on its own is scheduled as if the other lanes did not exist, after the sections it needs are free
+ *   and not before the last green (the cars get green in order of time)
+ * every section has to be crossed by all remaining cars that need it one after the other, for the total delay
+ *   the delay of the cars on the busiest section is added to the bounds of the lanes that do not cross it
+ */
+static long long lower_bound(const State* state)
+{
+  int releases[MAX_LIGHTS];
+  long long lane_delays[MAX_LIGHTS];
+  long long lanes_delay = 0;
+  long long bound = state->cost;
+  uint32_t remaining = 0;
+  for (int light = 0; light < topology.num_lights; light++)
+  {
+    lane_delays[light] = 0;
+    if (state->heads[light] == lane_sizes[light])
+    {
+      continue;
+    }
+    remaining |= 1u << light;
+    int time = earliest_start(state, light);
+    time = time > state->last_start ? time : state->last_start;
+    releases[light] = time;
+    for (int car = state->heads[light]; car < lane_sizes[light]; car++)
+    {
+      int arrival = lane_cars[light][car].time;
+      time = time > arrival ? time : arrival;
+      lane_delays[light] += time - arrival;
+      time += cross_time;
+    }
+    lanes_delay += lane_delays[light];
+    if (objective == MAKESPAN && time > bound)
+    {
+      bound = time;
+    }
+  }
+
+  if (objective == TOTAL_DELAY)
+  {
+    long long delay = lanes_delay;
+    for (int section = 0; section < topology.num_sections; section++)
+    {
+      uint32_t lights = 0;
+      long long others = lanes_delay;
+      for (uint32_t left = remaining; left != 0; left &= left - 1)
+      {
+        int light = __builtin_ctz(left);
+        if (topology.lights[light].sections & (1u << section))
+        {
+          lights |= 1u << light;
+          others -= lane_delays[light];
+        }
+      }
+      // a section of a single lane adds nothing to the bound of that lane
+      if ((lights & (lights - 1)) != 0)
+      {
+        long long section_bound = others + section_delay(state, releases, lights, section);
+        delay = section_bound > delay ? section_bound : delay;
+      }
+    }
+    return bound + delay;
+  }
+
+  for (int section = 0; section < topology.num_sections; section++)
+  {
+    long long time = state->section_free[section] > state->last_start ? state->section_free[section] : state->last_start;
+    for (uint32_t left = remaining; left != 0; left &= left - 1)
+    {
+      int light = __builtin_ctz(left);
+      if (topology.lights[light].sections & (1u << section))
+      {
+        time += (long long)(lane_sizes[light] - state->heads[light]) * cross_time;
+      }
+    }
+    bound = time > bound ? time : bound;
+  }
+  return bound;
+}
+
+
+/*
+ * find_choices(Level* level, long long best_cost)
+ *
+ * fill in the lights whose car may get green next in the state of the level following the dominance rules:
+ *   not before the last green (or at the same time for a light that comes before the last one),
+ *   and not when some other car could cross completely before
+ * the lights are tried in order of the lower bound after their car got green, earliest green first on ties,
+ *   and lights whose bound is not below best_cost are left out
+ */
+static void find_choices(Level* level, long long best_cost)
+{
+  const State* state = &level->state;
+  int starts[MAX_LIGHTS];
+  int first_end = INT_MAX;
+  for (int light = 0; light < topology.num_lights; light++)
+  {
+    if (state->heads[light] < lane_sizes[light])
+    {
+      starts[light] = earliest_start(state, light);
+      first_end = starts[light] + cross_time < first_end ? starts[light] + cross_time : first_end;
+    }
+  }
+  level->num_choices = 0;
+  level->next_choice = 0;
+  for (int light = 0; light < topology.num_lights; light++)
+  {
+    if (state->heads[light] == lane_sizes[light] || starts[light] >= first_end
+      || starts[light] < state->last_start || (starts[light] == state->last_start && light < state->last_light))
+    {
+      continue;
+    }
+    State child = *state;
+    give_green(&child, light, starts[light]);
+    long long bound = lower_bound(&child);
+    if (bound >= best_cost)
+    {
+      continue;
+    }
+    // insert in order of bound then start, the lights are visited in order so full ties stay in order of light
+    int i = level->num_choices;
+    while (i > 0 && (level->bounds[i - 1] > bound
+      || (level->bounds[i - 1] == bound && starts[level->choices[i - 1]] > starts[light])))
+    {
+      level->choices[i] = level->choices[i - 1];
+      level->bounds[i] = level->bounds[i - 1];
+      i--;
+    }
+    level->choices[i] = light;
+    level->bounds[i] = bound;
+    level->num_choices += 1;
+  }
+}
+
+
+/*
+ * offer_schedule(Search* search, long long cost, const int* lights, const int* starts)
+ *
+ * keep the complete schedule as the best one if it is better than the best found so far
+ */
+static void offer_schedule(Search* search, long long cost, const int* lights, const int* starts)
+{
+  if (cost >= atomic_load(&search->best_cost))
+  {
+    return;
+  }
+  pthread_mutex_lock(&search->best_lock);
+  if (cost < atomic_load(&search->best_cost))
+  {
+    memcpy(search->best_lights, lights, num_cars * sizeof(int));
+    memcpy(search->best_starts, starts, num_cars * sizeof(int));
+    atomic_store(&search->best_cost, cost);
+  }
+  pthread_mutex_unlock(&search->best_lock);
+}
+
+
+/*
+ * search_task(void* context, int task, int worker)
+ *
+ * search the subtree of a task depth first, a PoolTask with the Search as context
+ */
+static void search_task(void* context, int task, int worker)
+{
+  Search* search = context;
+  const Task* start = &search->tasks[task];
+  int depth = num_cars - start->state.scheduled;
+  Level* levels = malloc((depth + 1) * sizeof(Level));
+  int* lights = malloc(num_cars * sizeof(int));
+  int* starts = malloc(num_cars * sizeof(int));
+  if (levels == NULL || lights == NULL || starts == NULL)
+  {
+    log_error("(Solver):\t Out of memory, stopping the search\n");
+    atomic_store(&search->stopped, true);
+    free(levels);
+    free(lights);
+    free(starts);
+    return;
+  }
+  memcpy(lights, start->lights, start->state.scheduled * sizeof(int));
+  memcpy(starts, start->starts, start->state.scheduled * sizeof(int));
+
+  levels[0].state = start->state;
+  if (start->state.scheduled == num_cars)
+  {
+    offer_schedule(search, start->state.cost, lights, starts);
+    levels[0].num_choices = 0;
+    levels[0].next_choice = 0;
+  }
+  else
+  {
+    find_choices(&levels[0], atomic_load(&search->best_cost));
+  }
+  long long nodes = 0;
+  int top = 0;
+  while (top >= 0)
+  {
+    Level* level = &levels[top];
+    if (level->next_choice == level->num_choices)
+    {
+      top--;
+      continue;
+    }
+    int choice = level->next_choice++;
+    if (level->bounds[choice] >= atomic_load(&search->best_cost))
+    {
+      // a better schedule was found since the choices were made, and they are in order of bound
+      level->next_choice = level->num_choices;
+      continue;
+    }
+    int light = level->choices[choice];
+    Level* child = &levels[top + 1];
+    child->state = level->state;
+    int position = child->state.scheduled;
+    lights[position] = light;
+    starts[position] = earliest_start(&child->state, light);
+    give_green(&child->state, light, starts[position]);
+
+    nodes++;
+    if (nodes == NODE_BATCH)
+    {
+      if (atomic_fetch_add(&search->nodes, nodes) + nodes >= search->budget)
+      {
+        atomic_store(&search->stopped, true);
+      }
+      nodes = 0;
+      if (atomic_load(&search->stopped))
+      {
+        break;
+      }
+    }
+
+    if (child->state.scheduled == num_cars)
+    {
+      offer_schedule(search, child->state.cost, lights, starts);
+    }
+    else
+    {
+      find_choices(child, atomic_load(&search->best_cost));
+      top++;
+    }
+  }
+  atomic_fetch_add(&search->nodes, nodes);
+  free(levels);
+  free(lights);
+  free(starts);
+}
+
+
+/*
+ * greedy_schedule(Search* search)
+ *
+ * offer the schedule that always gives green to the car that can get it first, of those the one with the lowest bound,
+ *   so every task starts with a bound
+ * unlike the other choices the earliest car never leaves a lane behind that can no longer get green in order of time
+ */
+static void greedy_schedule(Search* search)
+{
+  int* lights = malloc(num_cars * sizeof(int) + 1);
+  int* starts = malloc(num_cars * sizeof(int) + 1);
+  Level level;
+  memset(&level.state, 0, sizeof(State));
+  level.state.last_start = -1;
+  level.state.last_light = -1;
+  for (int i = 0; i < num_cars && lights != NULL && starts != NULL; i++)
+  {
+    find_choices(&level, LLONG_MAX);
+    lights[i] = level.choices[0];
+    starts[i] = earliest_start(&level.state, lights[i]);
+    for (int choice = 1; choice < level.num_choices; choice++)
+    {
+      int start = earliest_start(&level.state, level.choices[choice]);
+      if (start < starts[i])
+      {
+        lights[i] = level.choices[choice];
+        starts[i] = start;
+      }
+    }
+    give_green(&level.state, lights[i], starts[i]);
+  }
+  if (lights != NULL && starts != NULL)
+  {
+    offer_schedule(search, level.state.cost, lights, starts);
+  }
+  free(lights);
+  free(starts);
+}
+
+
+/*
+ * make_tasks(Search* search, const Level* level, int* num_tasks)
+ *
+ * add a task for every node TASK_DEPTH choices below the level, or for the level itself when it has no more cars
+ */
+static void make_tasks(Search* search, Level* level, int* num_tasks)
+{
+  int depth = level->state.scheduled;
+  if (depth == TASK_DEPTH || depth == num_cars)
+  {
+    search->tasks[*num_tasks].state = level->state;
+    *num_tasks += 1;
+    return;
+  }
+  find_choices(level, LLONG_MAX);
+  for (int i = 0; i < level->num_choices; i++)
+  {
+    Level child;
+    child.state = level->state;
+    int light = level->choices[i];
+    int start = earliest_start(&child.state, light);
+    give_green(&child.state, light, start);
+    int first = *num_tasks;
+    make_tasks(search, &child, num_tasks);
+    for (int task = first; task < *num_tasks; task++)
+    {
+      search->tasks[task].lights[depth] = light;
+      search->tasks[task].starts[depth] = start;
+    }
+  }
+}
+
+
+/*
+ * arrival_time_of(int id, const Arrival* arrivals, int count)
+ *
+ * get the arrival time of the car with the id from the arrivals sorted by id, or -1 when it is not in the trace
+ */
+static int arrival_time_of(int id, const Arrival* arrivals, int count)
+{
+  int low = 0, high = count - 1;
+  while (low <= high)
+  {
+    int middle = (low + high) / 2;
+    if (arrivals[middle].id == id)
+    {
+      return arrivals[middle].time;
+    }
+    if (arrivals[middle].id < id)
+    {
+      low = middle + 1;
+    }
+    else
+    {
+      high = middle - 1;
+    }
+  }
+  return -1;
+}
+
+
+static int compare_ids(const void* a, const void* b)
+{
+  int first = ((const Arrival*)a)->id, second = ((const Arrival*)b)->id;
+  return (first > second) - (first < second);
+}
+
+
+/*
+ * read_online(const char* path, long long* total_delay, int* makespan)
+ *
+ * read the light changes written by the intersection for the same trace, and get the total delay and the makespan
+ *   of that schedule, returns false (and logs the reason) when the file cannot be read or does not match the trace
+ */
+static bool read_online(const char* path, long long* total_delay, int* makespan)
+{
+  FILE* in = fopen(path, "r");
+  if (in == NULL)
+  {
+    log_error("(Solver):\t Cannot open %s\n", path);
+    return false;
+  }
+  Arrival* arrivals = malloc(num_cars * sizeof(Arrival) + 1);
+  if (arrivals == NULL)
+  {
+    log_error("(Solver):\t Out of memory\n");
+    fclose(in);
+    return false;
+  }
+  int count = 0;
+  for (int light = 0; light < topology.num_lights; light++)
+  {
+    memcpy(&arrivals[count], lane_cars[light], lane_sizes[light] * sizeof(Arrival));
+    count += lane_sizes[light];
+  }
+  qsort(arrivals, count, sizeof(Arrival), compare_ids);
+
+  char line[256];
+  int greens = 0;
+  bool matches = true;
+  *total_delay = 0;
+  *makespan = 0;
+  while (fgets(line, sizeof(line), in) != NULL)
+  {
+    int side, direction, time, id;
+    if (sscanf(line, "traffic light %d %d turns green at time %d for car %d", &side, &direction, &time, &id) != 4)
+    {
+      continue;
+    }
+    int arrival = arrival_time_of(id, arrivals, count);
+    if (arrival < 0)
+    {
+      log_error("(Solver):\t Car %d of %s is not in the trace\n", id, path);
+      matches = false;
+      break;
+    }
+    *total_delay += time - arrival;
+    *makespan = time + cross_time > *makespan ? time + cross_time : *makespan;
+    greens += 1;
+  }
+  if (matches && greens != count)
+  {
+    log_error("(Solver):\t %s has %d green lights for %d cars\n", path, greens, count);
+    matches = false;
+  }
+  free(arrivals);
+  fclose(in);
+  return matches;
+}
+
+
+/*
+ * print_schedule(const int* lights, const int* starts)
+ *
+ * write the schedule to stdout as the light changes the intersection would print for it
+ */
+static void print_schedule(const int* lights, const int* starts)
+{
+  int heads[MAX_LIGHTS] = {0};
+  int* cars = malloc(num_cars * sizeof(int) + 1);
+  if (cars == NULL)
+  {
+    log_error("(Solver):\t Out of memory\n");
+    return;
+  }
+  for (int i = 0; i < num_cars; i++)
+  {
+    cars[i] = lane_cars[lights[i]][heads[lights[i]]++].id;
+  }
+  // the greens are in order of time, the reds of the cars that got green before are printed as their time comes
+  int red = 0;
+  for (int i = 0; i <= num_cars; i++)
+  {
+    int time = i < num_cars ? starts[i] : INT_MAX;
+    for (; red < i && starts[red] + cross_time <= time; red++)
+    {
+      const Light* light = &topology.lights[lights[red]];
+      printf("traffic light %d %d turns red at time %d\n", light->side, light->direction, starts[red] + cross_time);
+    }
+    if (i < num_cars)
+    {
+      const Light* light = &topology.lights[lights[i]];
+      printf("traffic light %d %d turns green at time %d for car %d\n", light->side, light->direction, starts[i], cars[i]);
+    }
+  }
+  free(cars);
+}
+
+
+static void usage(const char* program)
+{
+  fprintf(stderr, "usage: %s [-c cross_time] [-m nodes] [-o objective] [-r output] [-t topology] [-w workers] [trace]\n", program);
+  fprintf(stderr, "  -c cross_time time in seconds it takes a car to cross, at least 1 (default %d)\n", CROSS_TIME);
+  fprintf(stderr, "  -m nodes      the most nodes to search before settling for the best schedule found (default 100000000)\n");
+  fprintf(stderr, "  -o objective  delay: minimise the total delay (default), makespan: minimise the time the last car has crossed\n");
+  fprintf(stderr, "  -r output     the output of the intersection for the same trace, to compare against the best schedule\n");
+  fprintf(stderr, "  -t topology   file describing the approaches, lanes, sections and lights (default: lights.h)\n");
+  fprintf(stderr, "  -w workers    the number of threads that search (default: one per core)\n");
+  fprintf(stderr, "  trace         file with arrivals, - for stdin (default: input_arrivals from input.h)\n");
+  fprintf(stderr, "writes the best schedule to stdout in the format of the intersection, and a summary to stderr\n");
+}
+
+
+int main(int argc, char* argv[])
+{
+  long long budget = 100000000;
+  const char* online_output = NULL;
+  const char* topology_file = NULL;
+  int workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+  int option;
+  while ((option = getopt(argc, argv, "c:m:o:r:t:w:h")) != -1)
+  {
+    switch (option)
+    {
+      case 'c':
+        cross_time = atoi(optarg);
+        break;
+      case 'm':
+        budget = atoll(optarg);
+        break;
+      case 'o':
+        if (strcmp(optarg, "delay") == 0)
+        {
+          objective = TOTAL_DELAY;
+        }
+        else if (strcmp(optarg, "makespan") == 0)
+        {
+          objective = MAKESPAN;
+        }
+        else
+        {
+          fprintf(stderr, "Unknown objective %s\n", optarg);
+          return 1;
+        }
+        break;
+      case 'r':
+        online_output = optarg;
+        break;
+      case 't':
+        topology_file = optarg;
+        break;
+      case 'w':
+        workers = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return option == 'h' ? 0 : 1;
+    }
+  }
+  if (optind < argc - 1 || cross_time < 1 || budget < 1 || workers < 1)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  bool topology_loaded = topology_file != NULL
+    ? load_topology(&topology, topology_file)
+    : init_topology(&topology, DEFAULT_APPROACHES, DEFAULT_LANES, DEFAULT_SECTIONS, default_lights, NUM_DEFAULT_LIGHTS, &default_tables);
+  if (!topology_loaded)
+  {
+    return 1;
+  }
+
+  // split the trace into the lanes of the lights
+  ArrivalLoader* loader = optind < argc
+    ? open_arrivals(argv[optind])
+    : open_arrivals_array(input_arrivals, sizeof(input_arrivals)/sizeof(Arrival));
+  if (loader == NULL)
+  {
+    return 1;
+  }
+  int capacities[MAX_LIGHTS] = {0};
+  Arrival arrival;
+  while (next_arrival(loader, &arrival))
+  {
+    int light = topology_light(&topology, arrival.side, arrival.direction);
+    if (light < 0)
+    {
+      log_error("(Solver):\t No traffic light for lane %d / %d, skipping car %d\n", arrival.side, arrival.direction, arrival.id);
+      continue;
+    }
+    if (lane_sizes[light] == capacities[light])
+    {
+      capacities[light] = capacities[light] == 0 ? 64 : capacities[light] * 2;
+      Arrival* cars = realloc(lane_cars[light], capacities[light] * sizeof(Arrival));
+      if (cars == NULL)
+      {
+        log_error("(Solver):\t Out of memory\n");
+        return 1;
+      }
+      lane_cars[light] = cars;
+    }
+    lane_cars[light][lane_sizes[light]++] = arrival;
+    num_cars += 1;
+  }
+  close_arrivals(loader);
+
+  Search search;
+  atomic_init(&search.best_cost, LLONG_MAX);
+  pthread_mutex_init(&search.best_lock, NULL);
+  atomic_init(&search.nodes, 0);
+  atomic_init(&search.stopped, false);
+  search.budget = budget;
+  search.best_lights = malloc(num_cars * sizeof(int) + 1);
+  search.best_starts = malloc(num_cars * sizeof(int) + 1);
+  // at most MAX_LIGHTS choices at every level above the tasks
+  int max_tasks = 1;
+  for (int depth = 0; depth < TASK_DEPTH; depth++)
+  {
+    max_tasks *= topology.num_lights;
+  }
+  search.tasks = malloc(max_tasks * sizeof(Task));
+  int* task_numbers = malloc(max_tasks * sizeof(int));
+  ThreadPool* pool = create_pool(workers);
+  if (search.best_lights == NULL || search.best_starts == NULL || search.tasks == NULL || task_numbers == NULL || pool == NULL)
+  {
+    log_error("(Solver):\t Out of memory\n");
+    return 1;
+  }
+  fprintf(stderr, "(Solver):\t %d cars, %d lights, cross time %d s, minimising the %s, %d workers\n",
+    num_cars, topology.num_lights, cross_time, objective == TOTAL_DELAY ? "total delay" : "makespan", workers);
+
+  struct timespec begin, end;
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  Level root;
+  memset(&root.state, 0, sizeof(State));
+  root.state.last_start = -1;
+  root.state.last_light = -1;
+  long long root_bound = lower_bound(&root.state);
+  greedy_schedule(&search);
+  int num_tasks = 0;
+  make_tasks(&search, &root, &num_tasks);
+  for (int i = 0; i < num_tasks; i++)
+  {
+    task_numbers[i] = i;
+  }
+  pool_run(pool, search_task, &search, task_numbers, num_tasks);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+
+  long long best = atomic_load(&search.best_cost);
+  bool optimal = !atomic_load(&search.stopped);
+  int makespan = 0;
+  long long total_delay = 0;
+  int heads[MAX_LIGHTS] = {0};
+  for (int i = 0; i < num_cars; i++)
+  {
+    int light = search.best_lights[i];
+    total_delay += search.best_starts[i] - lane_cars[light][heads[light]++].time;
+    makespan = search.best_starts[i] + cross_time > makespan ? search.best_starts[i] + cross_time : makespan;
+  }
+  print_schedule(search.best_lights, search.best_starts);
+  fflush(stdout);
+
+  fprintf(stderr, "(Solver):\t %s schedule: total delay %lld s (mean %.2f s), makespan %d s\n", optimal ? "optimal" : "best found",
+    total_delay, num_cars > 0 ? total_delay / (double)num_cars : 0.0, makespan);
+  fprintf(stderr, "(Solver):\t %lld nodes in %d tasks, %.3f s", atomic_load(&search.nodes), num_tasks, seconds);
+  if (!optimal)
+  {
+    fprintf(stderr, ", stopped by the node budget, the optimum is at least %lld s", root_bound);
+  }
+  fprintf(stderr, "\n");
+
+  bool compared = true;
+  if (online_output != NULL)
+  {
+    long long online_delay;
+    int online_makespan;
+    compared = read_online(online_output, &online_delay, &online_makespan);
+    if (compared)
+    {
+      long long online = objective == TOTAL_DELAY ? online_delay : online_makespan;
+      fprintf(stderr, "(Solver):\t online schedule: total delay %lld s (mean %.2f s), makespan %d s\n",
+        online_delay, num_cars > 0 ? online_delay / (double)num_cars : 0.0, online_makespan);
+      fprintf(stderr, "(Solver):\t gap to the %s schedule: %lld s (%.1f%%)\n", optimal ? "optimal" : "best found",
+        online - best, best > 0 ? 100.0 * (online - best) / best : 0.0);
+    }
+  }
+
+  destroy_pool(pool);
+  pthread_mutex_destroy(&search.best_lock);
+  free(search.best_lights);
+  free(search.best_starts);
+  free(search.tasks);
+  free(task_numbers);
+  for (int light = 0; light < topology.num_lights; light++)
+  {
+    free(lane_cars[light]);
+  }
+  free_topology(&topology);
+  return compared ? 0 : 1;
+}
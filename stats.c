@@ -0,0 +1,129 @@
+#define __USE_POSIX199309 1
+
+#include <time.h>
+
+#include "stats.h"
+
+
+/*
+ * bucket_of(uint64_t value)
+ *
+ * get the index of the bucket that holds the value
+ */
+static int bucket_of(uint64_t value)
+{
+  if (value < HISTOGRAM_LINEAR)
+  {
+    return (int)value;
+  }
+  // the position of the highest bit selects the power of two, the bits below it the sub bucket
+  int magnitude = 63 - __builtin_clzll(value);
+  int sub_bucket = (int)(value >> (magnitude - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1);
+  return HISTOGRAM_LINEAR + (magnitude - HISTOGRAM_SUB_BITS - 1) * HISTOGRAM_SUB_BUCKETS + sub_bucket;
+}
+
+
+/*
+ * bucket_limit(int bucket)
+ *
+ * get the largest value that is stored in the bucket
+ */
+static uint64_t bucket_limit(int bucket)
+{
+  if (bucket < HISTOGRAM_LINEAR)
+  {
+    return bucket;
+  }
+  int magnitude = (bucket - HISTOGRAM_LINEAR) / HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BITS + 1;
+  uint64_t sub_bucket = (bucket - HISTOGRAM_LINEAR) % HISTOGRAM_SUB_BUCKETS;
+  uint64_t width = (uint64_t)1 << (magnitude - HISTOGRAM_SUB_BITS);
+  return ((uint64_t)1 << magnitude) + (sub_bucket + 1) * width - 1;
+}
+
+
+/*
+ * copy_counters(uint64_t* copy, const uint64_t* counters, size_t n)
+ *
+ * copy n counters that other threads may be adding to
+ */
+static void copy_counters(uint64_t* copy, const uint64_t* counters, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+  {
+    copy[i] = __atomic_load_n(&counters[i], __ATOMIC_RELAXED);
+  }
+}
+
+
+void counter_add(uint64_t* counter, uint64_t value)
+{
+  // only this thread writes the counter, so a relaxed store (a plain move) is enough, no locked add is needed
+  __atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+
+void histogram_record(Histogram* histogram, uint64_t value)
+{
+  counter_add(&histogram->count, 1);
+  counter_add(&histogram->sum, value);
+  if (value > histogram->max)
+  {
+    __atomic_store_n(&histogram->max, value, __ATOMIC_RELAXED);
+  }
+  counter_add(&histogram->buckets[bucket_of(value)], 1);
+}
+
+
+void histogram_merge(Histogram* into, const Histogram* from)
+{
+  into->count += from->count;
+  into->sum += from->sum;
+  if (from->max > into->max)
+  {
+    into->max = from->max;
+  }
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+  {
+    into->buckets[i] += from->buckets[i];
+  }
+}
+
+
+uint64_t histogram_percentile(const Histogram* histogram, double percentile)
+{
+  if (histogram->count == 0)
+  {
+    return 0;
+  }
+  uint64_t rank = (uint64_t)(percentile / 100.0 * histogram->count + 0.5);
+  if (rank < 1)
+  {
+    rank = 1;
+  }
+  uint64_t seen = 0;
+  for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++)
+  {
+    seen += histogram->buckets[bucket];
+    if (seen >= rank)
+    {
+      uint64_t limit = bucket_limit(bucket);
+      return limit < histogram->max ? limit : histogram->max;
+    }
+  }
+  return histogram->max;
+}
+
+
+void light_stats_snapshot(LightStats* copy, const LightStats* stats)
+{
+  // LightStats only holds counters, so it can be copied as one array of them
+  copy_counters((uint64_t*)copy, (const uint64_t*)stats, sizeof(LightStats) / sizeof(uint64_t));
+}
+
+
+uint64_t thread_cpu_time()
+{
+  struct timespec time;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+  return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
@@ -0,0 +1,103 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "lane_queue.h"
+
+/*
+ * Histogram
+ *
+ * A latency histogram with logarithmic buckets: values below HISTOGRAM_LINEAR each have their own bucket,
+ *   above that every power of two is split into HISTOGRAM_SUB_BUCKETS buckets,
+ *   so percentiles are exact for small values and within a few percent for large ones
+ * Only a single thread may record into a histogram, other threads can read it with light_stats_snapshot
+ */
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_LINEAR (2 * HISTOGRAM_SUB_BUCKETS)
+#define HISTOGRAM_BUCKETS (HISTOGRAM_LINEAR + (64 - HISTOGRAM_SUB_BITS - 1) * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct
+{
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t buckets[HISTOGRAM_BUCKETS];
+} Histogram;
+
+/*
+ * histogram_record(Histogram* histogram, uint64_t value)
+ *
+ * add a value to the histogram
+ */
+void histogram_record(Histogram* histogram, uint64_t value);
+
+/*
+ * histogram_percentile(const Histogram* histogram, double percentile)
+ *
+ * get the smallest value such that at least percentile percent of the values are at most that value
+ * returns 0 for an empty histogram
+ */
+uint64_t histogram_percentile(const Histogram* histogram, double percentile);
+
+/*
+ * histogram_merge(Histogram* into, const Histogram* from)
+ *
+ * add all values of the histogram from to the histogram into
+ */
+void histogram_merge(Histogram* into, const Histogram* from);
+
+/*
+ * counter_add(uint64_t* counter, uint64_t value)
+ *
+ * add a value to a counter that only the calling thread writes, but other threads may read at the same time
+ */
+void counter_add(uint64_t* counter, uint64_t value);
+
+/*
+ * LightStats
+ *
+ * The statistics that one traffic light thread keeps, each on its own cache line
+ * waits: the time in seconds between the arrival of a car and its green light, its count is the number of cars served
+ * blocked: the time in microseconds a car at the front of the lane waited for sections taken by conflicting lights
+ * latency: in real time, the real time in microseconds from the arrival time of a car to its green light,
+ *   for the cars that found the light idle and its sections free, so what the threads add to a green that is due
+ * failed_claims: the number of times the light tried to claim its sections and found one of them taken,
+ *   a light thread tries once when its car comes to the front and again on every wake-up,
+ *   the batch and event engines count a car once when they first hold it back
+ * section_conflicts[n]: how many of those failed claims found section n + 1 taken,
+ *   which shows the sections (and so the conflicting lights) that hold up this light
+ * blocked_time, hold_time: the total simulated time in nanoseconds spent blocked on conflicts and holding the sections
+ * cpu_time: the time in nanoseconds the light thread ran on a CPU, set when the thread stops
+ * The counters are only updated with counter_add and histogram_record, so they can be read while the light runs
+ */
+typedef struct
+{
+  _Alignas(CACHE_LINE_SIZE) Histogram waits;
+  Histogram blocked;
+  Histogram latency;
+  uint64_t failed_claims;
+  uint64_t section_conflicts[32];
+  uint64_t blocked_time;
+  uint64_t hold_time;
+  uint64_t cpu_time;
+} LightStats;
+
+/*
+ * light_stats_snapshot(LightStats* copy, const LightStats* stats)
+ *
+ * copy the statistics of a traffic light while its thread may still be updating them
+ * every counter in the copy is a value it had, but they are not necessarily from the same moment
+ */
+void light_stats_snapshot(LightStats* copy, const LightStats* stats);
+
+/*
+ * thread_cpu_time()
+ *
+ * get the CPU time in nanoseconds used by the calling thread
+ */
+uint64_t thread_cpu_time();
+
+#endif
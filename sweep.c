@@ -0,0 +1,495 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <stdatomic.h>
+
+#define __USE_POSIX199309 1
+
+#include <time.h>
+
+#include "arrivals.h"
+#include "arrival_gen.h"
+#include "arrival_loader.h"
+#include "lights.h"
+#include "conflicts.h"
+#include "topology.h"
+#include "intersection.h"
+#include "thread_pool.h"
+#include "log.h"
+#include "input.h"
+
+/*
+ * sweep
+ *
+ * Runs a grid of scenarios, every combination of a traffic pattern, arrival rate, seed, cross time, policy,
+ *   platoon, engine and lookahead, and writes a line of CSV with the totals of each
+ * Every scenario is an instance of the intersection simulated in virtual time on a synthetic trace from arrival_gen.h,
+ *   the same trace that gen_arrivals writes for the pattern, rate and seed
+ * The scenarios run as tasks on a thread pool with a worker per core, the lines are written in the order of the grid
+ */
+
+// the most values of one parameter of the grid
+#define MAX_VALUES 64
+
+// the number of parameters of the grid
+#define NUM_PARAMETERS 8
+
+/*
+ * ParameterList
+ *
+ * The values of one parameter of the grid, as given on the command line and as parsed
+ */
+typedef struct
+{
+  const char* names[MAX_VALUES];
+  int count;
+} ParameterList;
+
+/*
+ * Grid
+ *
+ * The parameters that are combined, the context of the tasks
+ * patterns[], rates[], seeds[], cross_times[], engines[], lookaheads[]: the parsed values
+ * policies[], max_waits[]: the policies and their max_wait, MAX_WAIT unless given with aging:max_wait
+ * platoons[], platoon_waits[]: the platoons, with ADAPTIVE_PLATOON for the adaptive policy when none were given
+ * results[]: the totals of every scenario, in the order of the grid
+ */
+typedef struct
+{
+  const Topology* topology;
+  int cars;
+  ParameterList pattern_list, rate_list, seed_list, cross_list, policy_list, platoon_list, engine_list, lookahead_list;
+  Pattern patterns[MAX_VALUES];
+  double rates[MAX_VALUES];
+  unsigned int seeds[MAX_VALUES];
+  int cross_times[MAX_VALUES];
+  Policy policies[MAX_VALUES];
+  int max_waits[MAX_VALUES];
+  int platoons[MAX_VALUES];
+  int platoon_waits[MAX_VALUES];
+  bool platoon_set;
+  Engine engines[MAX_VALUES];
+  int lookaheads[MAX_VALUES];
+  struct Result* results;
+} Grid;
+
+/*
+ * Result
+ *
+ * The outcome of one scenario: the values it combines, as indices in the lists of the grid, and its totals
+ * light_changes is counted by the output callback, which the lights of the threaded engine call from their threads
+ */
+typedef struct Result
+{
+  int pattern, rate, seed, cross_time, policy, platoon, engine, lookahead;
+  bool ran;
+  IntersectionSummary summary;
+  _Atomic uint64_t light_changes;
+} Result;
+
+static const char* engine_names[] = {"threads", "batch", "event"};
+
+
+/*
+ * split_list(char* text, ParameterList* list)
+ *
+ * split a comma separated list of values in place
+ * returns false (and logs the reason) when it is empty or has more than MAX_VALUES values
+ */
+static bool split_list(char* text, ParameterList* list)
+{
+  list->count = 0;
+  for (char* value = strtok(text, ","); value != NULL; value = strtok(NULL, ","))
+  {
+    if (list->count == MAX_VALUES)
+    {
+      log_error("(Sweep):\t More than %d values in a list\n", MAX_VALUES);
+      return false;
+    }
+    list->names[list->count++] = value;
+  }
+  if (list->count == 0)
+  {
+    log_error("(Sweep):\t Empty list of values\n");
+    return false;
+  }
+  return true;
+}
+
+
+/*
+ * parse_grid(Grid* grid)
+ *
+ * parse the values of every list of the grid
+ * returns false (and logs the reason) when a value is invalid
+ */
+static bool parse_grid(Grid* grid)
+{
+  for (int i = 0; i < grid->pattern_list.count; i++)
+  {
+    if (!parse_pattern(grid->pattern_list.names[i], &grid->patterns[i]))
+    {
+      log_error("(Sweep):\t Unknown pattern %s\n", grid->pattern_list.names[i]);
+      return false;
+    }
+  }
+  for (int i = 0; i < grid->rate_list.count; i++)
+  {
+    grid->rates[i] = atof(grid->rate_list.names[i]);
+    if (grid->rates[i] <= 0)
+    {
+      log_error("(Sweep):\t Invalid rate %s\n", grid->rate_list.names[i]);
+      return false;
+    }
+  }
+  for (int i = 0; i < grid->seed_list.count; i++)
+  {
+    grid->seeds[i] = (unsigned int)atol(grid->seed_list.names[i]);
+  }
+  for (int i = 0; i < grid->cross_list.count; i++)
+  {
+    grid->cross_times[i] = atoi(grid->cross_list.names[i]);
+    if (grid->cross_times[i] < 0)
+    {
+      log_error("(Sweep):\t Invalid cross time %s\n", grid->cross_list.names[i]);
+      return false;
+    }
+  }
+  for (int i = 0; i < grid->policy_list.count; i++)
+  {
+    grid->max_waits[i] = MAX_WAIT;
+    if (!parse_policy(grid->policy_list.names[i], &grid->policies[i], &grid->max_waits[i]))
+    {
+      return false;
+    }
+  }
+  for (int i = 0; i < grid->platoon_list.count; i++)
+  {
+    grid->platoon_waits[i] = 0;
+    int fields = sscanf(grid->platoon_list.names[i], "%d:%d", &grid->platoons[i], &grid->platoon_waits[i]);
+    if (fields < 1 || grid->platoons[i] < 1 || (fields == 2 && grid->platoon_waits[i] < 1))
+    {
+      log_error("(Sweep):\t Invalid platoon %s, expected cars or cars:wait\n", grid->platoon_list.names[i]);
+      return false;
+    }
+  }
+  for (int i = 0; i < grid->engine_list.count; i++)
+  {
+    int engine = 0;
+    while (engine <= EVENT_ENGINE && strcmp(grid->engine_list.names[i], engine_names[engine]) != 0)
+    {
+      engine++;
+    }
+    if (engine > EVENT_ENGINE)
+    {
+      log_error("(Sweep):\t Unknown engine %s\n", grid->engine_list.names[i]);
+      return false;
+    }
+    grid->engines[i] = engine;
+  }
+  for (int i = 0; i < grid->lookahead_list.count; i++)
+  {
+    grid->lookaheads[i] = atoi(grid->lookahead_list.names[i]);
+    if (grid->lookaheads[i] < 0)
+    {
+      log_error("(Sweep):\t Invalid lookahead %s\n", grid->lookahead_list.names[i]);
+      return false;
+    }
+  }
+  return true;
+}
+
+
+/*
+ * count_changes(const LightChange* changes, size_t count, void* arg)
+ *
+ * The output of the intersections, which only counts the light changes in the Result given as argument
+ */
+static void count_changes(const LightChange* changes, size_t count, void* arg)
+{
+  atomic_fetch_add_explicit(&((Result*)arg)->light_changes, count, memory_order_relaxed);
+}
+
+
+/*
+ * run_scenario(void* context, int task, int worker)
+ *
+ * A task of the pool: generates the trace of the scenario with the given number and simulates the intersection on it,
+ *   storing the totals in its Result
+ */
+static void run_scenario(void* context, int task, int worker)
+{
+  Grid* grid = context;
+  Result* result = &grid->results[task];
+  Arrival* arrivals = malloc(grid->cars * sizeof(Arrival) + 1);
+  if (arrivals == NULL)
+  {
+    log_error("(Sweep):\t Out of memory for scenario %d\n", task);
+    return;
+  }
+  ArrivalGenerator generator;
+  init_generator(&generator, grid->topology, grid->patterns[result->pattern], grid->rates[result->rate], grid->seeds[result->seed]);
+  for (int i = 0; i < grid->cars; i++)
+  {
+    arrivals[i] = generate_arrival(&generator);
+  }
+
+  Policy policy = grid->policies[result->policy];
+  IntersectionOptions options = {grid->engines[result->engine], grid->cross_times[result->cross_time], policy,
+    grid->max_waits[result->policy], grid->platoons[result->platoon], grid->platoon_waits[result->platoon],
+    true, 1.0, count_changes, result, NULL, NULL, 0, NULL};
+  if (policy == ADAPTIVE_POLICY && !grid->platoon_set)
+  {
+    options.platoon = ADAPTIVE_PLATOON;
+  }
+  // only the batch engine plans ahead, the scheduler reads the trace a second time
+  if (options.engine == BATCH_ENGINE && grid->lookaheads[result->lookahead] > 0)
+  {
+    options.lookahead = grid->lookaheads[result->lookahead];
+    options.forecast = open_arrivals_array(arrivals, grid->cars);
+  }
+  ArrivalLoader* loader = open_arrivals_array(arrivals, grid->cars);
+  Intersection* intersection = loader != NULL && (options.lookahead == 0 || options.forecast != NULL)
+    ? create_intersection(grid->topology, &options) : NULL;
+  if (intersection != NULL)
+  {
+    result->ran = run_intersection(intersection, loader);
+    summarize_intersection(intersection, &result->summary);
+    destroy_intersection(intersection);
+  }
+  if (loader != NULL)
+  {
+    close_arrivals(loader);
+  }
+  if (options.forecast != NULL)
+  {
+    close_arrivals(options.forecast);
+  }
+  free(arrivals);
+}
+
+
+/*
+ * write_results(FILE* out, const Grid* grid, int num_scenarios)
+ *
+ * write a header and a line per scenario that ran as CSV
+ */
+static void write_results(FILE* out, const Grid* grid, int num_scenarios)
+{
+  fprintf(out, "pattern,rate,seed,cross_time,policy,platoon,engine,lookahead,cars,simulated_time,throughput,"
+    "wait_mean,wait_p50,wait_p99,wait_max,failed_claims,blocked_time,light_changes,wall_time,cpu_time\n");
+  for (int i = 0; i < num_scenarios; i++)
+  {
+    const Result* result = &grid->results[i];
+    if (!result->ran)
+    {
+      continue;
+    }
+    const IntersectionSummary* summary = &result->summary;
+    const char* platoon = grid->policies[result->policy] == ADAPTIVE_POLICY && !grid->platoon_set
+      ? "adaptive" : grid->platoon_list.names[result->platoon];
+    fprintf(out, "%s,%s,%s,%s,%s,%s,%s,%d,%lu,%d,%.4f,%.3f,%lu,%lu,%lu,%lu,%.3f,%lu,%.6f,%.6f\n",
+      grid->pattern_list.names[result->pattern], grid->rate_list.names[result->rate], grid->seed_list.names[result->seed],
+      grid->cross_list.names[result->cross_time], grid->policy_list.names[result->policy], platoon,
+      grid->engine_list.names[result->engine], grid->engines[result->engine] == BATCH_ENGINE ? grid->lookaheads[result->lookahead] : 0,
+      summary->cars, summary->simulated_time,
+      summary->simulated_time > 0 ? summary->cars / (double)summary->simulated_time : 0.0,
+      summary->wait_mean, summary->wait_p50, summary->wait_p99, summary->wait_max, summary->failed_claims,
+      summary->blocked_time, atomic_load(&result->light_changes), summary->wall_time, summary->cpu_time);
+  }
+}
+
+
+static void usage(const char* program)
+{
+  fprintf(stderr, "usage: %s [-c cross_times] [-e engines] [-g patterns] [-l log_level] [-L lookaheads] [-n cars] [-o output] [-p policies] [-P platoons] [-r rates] [-s seeds] [-t topology] [-w workers]\n", program);
+  fprintf(stderr, "  every option but -l, -n, -o, -t and -w takes a comma separated list, every combination is a scenario\n");
+  fprintf(stderr, "  -c cross_times time in seconds it takes a car to cross (default %d)\n", CROSS_TIME);
+  fprintf(stderr, "  -e engines     threads, batch or event (default event)\n");
+  fprintf(stderr, "  -g patterns    the traffic of gen_arrivals: uniform, poisson, rush or conflict (default poisson)\n");
+  fprintf(stderr, "  -l log_level   0 for errors, 1 for progress, 2 for debug traces (default 0)\n");
+  fprintf(stderr, "  -L lookaheads  horizons in seconds the batch engine plans ahead over, 0 for none,\n");
+  fprintf(stderr, "                 the other engines ignore them (default 0)\n");
+  fprintf(stderr, "  -n cars        the number of cars of every trace (default 10000)\n");
+  fprintf(stderr, "  -o output      write the CSV to the output file instead of stdout\n");
+  fprintf(stderr, "  -p policies    greedy, fifo, queue, aging[:max_wait] or adaptive (default greedy)\n");
+  fprintf(stderr, "  -P platoons    cars[:wait] as with the intersection (default 1, and %d for adaptive)\n", ADAPTIVE_PLATOON);
+  fprintf(stderr, "  -r rates       the mean number of cars arriving per second (default 1)\n");
+  fprintf(stderr, "  -s seeds       the seeds of the random generator (default 1)\n");
+  fprintf(stderr, "  -t topology    file describing the approaches, lanes, sections and lights (default: lights.h)\n");
+  fprintf(stderr, "  -w workers     the number of threads running scenarios (default: one per core)\n");
+}
+
+
+int main(int argc, char* argv[])
+{
+  Grid grid;
+  memset(&grid, 0, sizeof(Grid));
+  grid.cars = 10000;
+  char default_cross[16];
+  snprintf(default_cross, sizeof(default_cross), "%d", CROSS_TIME);
+  char* lists[NUM_PARAMETERS] = {"poisson", "1", "1", default_cross, "greedy", "1", "event", "0"};
+  ParameterList* list_of[NUM_PARAMETERS] = {&grid.pattern_list, &grid.rate_list, &grid.seed_list, &grid.cross_list,
+    &grid.policy_list, &grid.platoon_list, &grid.engine_list, &grid.lookahead_list};
+  const char* output = NULL;
+  const char* topology_file = NULL;
+  int workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  log_level = LOG_ERROR;
+
+  int option;
+  while ((option = getopt(argc, argv, "c:e:g:l:L:n:o:p:P:r:s:t:w:h")) != -1)
+  {
+    switch (option)
+    {
+      case 'c':
+        lists[3] = optarg;
+        break;
+      case 'e':
+        lists[6] = optarg;
+        break;
+      case 'g':
+        lists[0] = optarg;
+        break;
+      case 'l':
+        log_level = atoi(optarg);
+        break;
+      case 'L':
+        lists[7] = optarg;
+        break;
+      case 'n':
+        grid.cars = atoi(optarg);
+        break;
+      case 'o':
+        output = optarg;
+        break;
+      case 'p':
+        lists[4] = optarg;
+        break;
+      case 'P':
+        lists[5] = optarg;
+        grid.platoon_set = true;
+        break;
+      case 'r':
+        lists[1] = optarg;
+        break;
+      case 's':
+        lists[2] = optarg;
+        break;
+      case 't':
+        topology_file = optarg;
+        break;
+      case 'w':
+        workers = atoi(optarg);
+        break;
+      default:
+        usage(argv[0]);
+        return option == 'h' ? 0 : 1;
+    }
+  }
+  if (optind < argc || grid.cars < 0 || workers < 1)
+  {
+    usage(argv[0]);
+    return 1;
+  }
+
+  // split the lists, the defaults are string literals and copied first
+  char* copies[NUM_PARAMETERS];
+  for (int i = 0; i < NUM_PARAMETERS; i++)
+  {
+    copies[i] = strdup(lists[i]);
+    if (copies[i] == NULL || !split_list(copies[i], list_of[i]))
+    {
+      return 1;
+    }
+  }
+  if (!parse_grid(&grid))
+  {
+    return 1;
+  }
+
+  Topology topology;
+  bool topology_loaded = topology_file != NULL
+    ? load_topology(&topology, topology_file)
+    : init_topology(&topology, DEFAULT_APPROACHES, DEFAULT_LANES, DEFAULT_SECTIONS, default_lights, NUM_DEFAULT_LIGHTS, &default_tables);
+  if (!topology_loaded)
+  {
+    return 1;
+  }
+  grid.topology = &topology;
+
+  // number the scenarios in the order of the grid, the last list changing fastest
+  int num_scenarios = 1;
+  for (int i = 0; i < NUM_PARAMETERS; i++)
+  {
+    num_scenarios *= list_of[i]->count;
+  }
+  grid.results = calloc(num_scenarios, sizeof(Result));
+  int* tasks = malloc(num_scenarios * sizeof(int));
+  FILE* out = output != NULL ? fopen(output, "w") : stdout;
+  if (out == NULL)
+  {
+    perror(output);
+    return 1;
+  }
+  ThreadPool* pool = create_pool(workers);
+  if (grid.results == NULL || tasks == NULL || pool == NULL)
+  {
+    log_error("(Sweep):\t Out of memory\n");
+    return 1;
+  }
+  for (int i = 0; i < num_scenarios; i++)
+  {
+    Result* result = &grid.results[i];
+    int* indices[NUM_PARAMETERS] = {&result->pattern, &result->rate, &result->seed, &result->cross_time, &result->policy,
+      &result->platoon, &result->engine, &result->lookahead};
+    int rest = i;
+    for (int j = NUM_PARAMETERS - 1; j >= 0; j--)
+    {
+      *indices[j] = rest % list_of[j]->count;
+      rest /= list_of[j]->count;
+    }
+    atomic_init(&result->light_changes, 0);
+    tasks[i] = i;
+  }
+  fprintf(stderr, "(Sweep):\t %d scenarios of %d cars on %d workers\n", num_scenarios, grid.cars, pool_size(pool));
+
+  start_logging();
+  struct timespec begin, end;
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  pool_run(pool, run_scenario, &grid, tasks, num_scenarios);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  stop_logging();
+  double seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+
+  write_results(out, &grid, num_scenarios);
+  bool written = !ferror(out);
+  written &= out == stdout ? fflush(out) == 0 : fclose(out) == 0;
+  int failed = 0;
+  for (int i = 0; i < num_scenarios; i++)
+  {
+    failed += !grid.results[i].ran;
+  }
+  fprintf(stderr, "(Sweep):\t %d scenarios in %.3f s, %.1f scenarios/s", num_scenarios - failed, seconds,
+    seconds > 0 ? (num_scenarios - failed) / seconds : 0.0);
+  if (failed > 0)
+  {
+    fprintf(stderr, ", %d failed", failed);
+  }
+  fprintf(stderr, "\n");
+  if (!written)
+  {
+    log_error("(Sweep):\t Cannot write the results to %s\n", output != NULL ? output : "stdout");
+  }
+
+  destroy_pool(pool);
+  free(grid.results);
+  free(tasks);
+  for (int i = 0; i < NUM_PARAMETERS; i++)
+  {
+    free(copies[i]);
+  }
+  free_topology(&topology);
+  return failed == 0 && written ? 0 : 1;
+}
@@ -0,0 +1,280 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "thread_pool.h"
+#include "lane_queue.h"
+#include "lock_profile.h"
+#include "log.h"
+
+
+/*
+ * TaskDeque
+ *
+ * the tasks of one worker, a Chase-Lev deque that is filled before a batch starts
+ * the owner takes tasks at the bottom, other workers steal them at the top
+ */
+typedef struct
+{
+  _Alignas(CACHE_LINE_SIZE) _Atomic long top;
+  _Atomic long bottom;
+  int* tasks;
+  long capacity;
+} TaskDeque;
+
+typedef struct
+{
+  TaskDeque deque;
+  ThreadPool* pool;
+  int index;
+  pthread_t thread;
+} Worker;
+
+struct ThreadPool
+{
+  int num_workers;
+  Worker* workers;
+  // the batch that is running
+  PoolTask run;
+  void* context;
+  // guards the fields below, workers wait on start for a new batch and pool_run waits on done for the workers
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t done;
+  unsigned long generation;
+  int busy;
+  bool stopping;
+};
+
+
+/*
+ * take_task(TaskDeque* deque, int* task)
+ *
+ * take the task at the bottom of the deque of the calling worker, returns false when it is empty
+ */
+static bool take_task(TaskDeque* deque, int* task)
+{
+  long bottom = atomic_load(&deque->bottom) - 1;
+  atomic_store(&deque->bottom, bottom);
+  long top = atomic_load(&deque->top);
+  if (top > bottom)
+  {
+    atomic_store(&deque->bottom, bottom + 1);
+    return false;
+  }
+  *task = deque->tasks[bottom];
+  if (top == bottom)
+  {
+    // the last task, a thief may take it at the same time
+    bool won = atomic_compare_exchange_strong(&deque->top, &top, top + 1);
+    atomic_store(&deque->bottom, bottom + 1);
+    return won;
+  }
+  return true;
+}
+
+
+/*
+ * steal_task(TaskDeque* deque, int* task)
+ *
+ * steal the task at the top of the deque of another worker, returns false when it is empty or another worker won
+ */
+static bool steal_task(TaskDeque* deque, int* task)
+{
+  long top = atomic_load(&deque->top);
+  long bottom = atomic_load(&deque->bottom);
+  if (top >= bottom)
+  {
+    return false;
+  }
+  *task = deque->tasks[top];
+  return atomic_compare_exchange_strong(&deque->top, &top, top + 1);
+}
+
+
+/*
+ * work(ThreadPool* pool, int index)
+ *
+ * run the tasks of the worker, then those that can be stolen from the others, until none are left
+ * no tasks are added while a batch runs, so a worker that finds every deque empty is done
+ */
+static void work(ThreadPool* pool, int index)
+{
+  int task;
+  while (take_task(&pool->workers[index].deque, &task))
+  {
+    pool->run(pool->context, task, index);
+  }
+  for (int attempt = 1; attempt < pool->num_workers; attempt++)
+  {
+    TaskDeque* victim = &pool->workers[(index + attempt) % pool->num_workers].deque;
+    while (steal_task(victim, &task))
+    {
+      pool->run(pool->context, task, index);
+    }
+  }
+}
+
+
+/*
+ * pool_worker(void* arg)
+ *
+ * the thread of a worker: waits for a batch, works on it, and reports when it is done
+ */
+static void* pool_worker(void* arg)
+{
+  Worker* worker = arg;
+  ThreadPool* pool = worker->pool;
+  unsigned long seen = 0;
+
+  lock_mutex(&pool->lock, "pool");
+  while (true)
+  {
+    while (pool->generation == seen && !pool->stopping)
+    {
+      wait_condition(&pool->start, &pool->lock, "pool");
+    }
+    if (pool->stopping)
+    {
+      break;
+    }
+    seen = pool->generation;
+    unlock_mutex(&pool->lock);
+
+    work(pool, worker->index);
+
+    lock_mutex(&pool->lock, "pool");
+    pool->busy -= 1;
+    if (pool->busy == 0)
+    {
+      pthread_cond_signal(&pool->done);
+    }
+  }
+  unlock_mutex(&pool->lock);
+  return(0);
+}
+
+
+ThreadPool* create_pool(int num_workers)
+{
+  ThreadPool* pool = calloc(1, sizeof(ThreadPool));
+  Worker* workers = aligned_alloc(CACHE_LINE_SIZE, (num_workers > 0 ? num_workers : 1) * sizeof(Worker));
+  if (pool == NULL || workers == NULL || num_workers <= 0)
+  {
+    log_error("(Pool):\t Cannot create a pool of %d workers\n", num_workers);
+    free(pool);
+    free(workers);
+    return NULL;
+  }
+  pool->num_workers = num_workers;
+  pool->workers = workers;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->done, NULL);
+
+  for (int i = 0; i < num_workers; i++)
+  {
+    atomic_init(&workers[i].deque.top, 0);
+    atomic_init(&workers[i].deque.bottom, 0);
+    workers[i].deque.tasks = NULL;
+    workers[i].deque.capacity = 0;
+    workers[i].pool = pool;
+    workers[i].index = i;
+  }
+  // worker 0 is the thread calling pool_run
+  for (int i = 1; i < num_workers; i++)
+  {
+    if (pthread_create(&workers[i].thread, NULL, pool_worker, &workers[i]) != 0)
+    {
+      log_error("(Pool):\t Cannot create worker %d\n", i);
+      pool->num_workers = i;
+      destroy_pool(pool);
+      return NULL;
+    }
+  }
+  return pool;
+}
+
+
+int pool_size(const ThreadPool* pool)
+{
+  return pool->num_workers;
+}
+
+
+void pool_run(ThreadPool* pool, PoolTask run, void* context, const int* tasks, int num_tasks)
+{
+  // give every worker an even share of neighbouring tasks
+  int num_workers = pool->num_workers;
+  for (int i = 0; i < num_workers; i++)
+  {
+    TaskDeque* deque = &pool->workers[i].deque;
+    long first = (long)num_tasks * i / num_workers, last = (long)num_tasks * (i + 1) / num_workers;
+    if (last - first > deque->capacity)
+    {
+      int* grown = realloc(deque->tasks, (last - first) * sizeof(int));
+      if (grown == NULL)
+      {
+        // run the share of this worker on the calling thread instead
+        log_error("(Pool):\t Out of memory, running %ld tasks serially\n", last - first);
+        for (long j = first; j < last; j++)
+        {
+          run(context, tasks[j], 0);
+        }
+        last = first;
+      }
+      else
+      {
+        deque->tasks = grown;
+        deque->capacity = last - first;
+      }
+    }
+    for (long j = first; j < last; j++)
+    {
+      deque->tasks[j - first] = tasks[j];
+    }
+    atomic_store(&deque->top, 0);
+    atomic_store(&deque->bottom, last - first);
+  }
+
+  lock_mutex(&pool->lock, "pool");
+  pool->run = run;
+  pool->context = context;
+  pool->generation += 1;
+  pool->busy = num_workers - 1;
+  pthread_cond_broadcast(&pool->start);
+  unlock_mutex(&pool->lock);
+
+  work(pool, 0);
+
+  // the batch is done once every worker has stopped looking for tasks
+  lock_mutex(&pool->lock, "pool");
+  while (pool->busy > 0)
+  {
+    wait_condition(&pool->done, &pool->lock, "pool");
+  }
+  unlock_mutex(&pool->lock);
+}
+
+
+void destroy_pool(ThreadPool* pool)
+{
+  lock_mutex(&pool->lock, "pool");
+  pool->stopping = true;
+  pthread_cond_broadcast(&pool->start);
+  unlock_mutex(&pool->lock);
+  for (int i = 1; i < pool->num_workers; i++)
+  {
+    pthread_join(pool->workers[i].thread, NULL);
+  }
+  for (int i = 0; i < pool->num_workers; i++)
+  {
+    free(pool->workers[i].deque.tasks);
+  }
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->start);
+  pthread_cond_destroy(&pool->done);
+  free(pool->workers);
+  free(pool);
+}
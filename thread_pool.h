@@ -0,0 +1,53 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+/*
+ * ThreadPool
+ *
+ * A fixed set of worker threads that run batches of tasks
+ * Each worker has its own deque of tasks: it takes tasks from the back of its own deque,
+ *   and when that is empty it steals from the front of the deques of the other workers,
+ *   so workers that finish early take over the work of the busy ones without a shared queue
+ */
+typedef struct ThreadPool ThreadPool;
+
+/*
+ * PoolTask
+ *
+ * a function that runs one task of a batch
+ * context is the context given to pool_run, task the number of the task and worker the index of the worker running it
+ */
+typedef void (*PoolTask)(void* context, int task, int worker);
+
+/*
+ * create_pool(int num_workers)
+ *
+ * create a pool of num_workers workers, the thread calling pool_run is one of them
+ * returns NULL (and logs the reason) when out of memory or threads cannot be created
+ */
+ThreadPool* create_pool(int num_workers);
+
+/*
+ * pool_size(const ThreadPool* pool)
+ *
+ * get the number of workers of the pool, including the thread calling pool_run
+ */
+int pool_size(const ThreadPool* pool);
+
+/*
+ * pool_run(ThreadPool* pool, PoolTask run, void* context, const int* tasks, int num_tasks)
+ *
+ * run every task in tasks on the workers of the pool, and return once all of them are done
+ * the tasks are spread evenly over the deques of the workers, neighbouring tasks on the same worker
+ * only one thread may call pool_run at a time
+ */
+void pool_run(ThreadPool* pool, PoolTask run, void* context, const int* tasks, int num_tasks);
+
+/*
+ * destroy_pool(ThreadPool* pool)
+ *
+ * stop the workers and free the pool
+ */
+void destroy_pool(ThreadPool* pool);
+
+#endif
@@ -0,0 +1,499 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "topology.h"
+#include "log.h"
+
+
+/*
+ * MaximalGroups
+ *
+ * a growing list of maximal groups, filled by find_maximal_groups
+ */
+typedef struct
+{
+  uint32_t* groups;
+  int count;
+  int capacity;
+} MaximalGroups;
+
+
+/*
+ * find_maximal_groups(const uint32_t* compatible, MaximalGroups* found, uint32_t group, uint32_t candidates, uint32_t excluded)
+ *
+ * add every maximal group that extends group with lights out of candidates, and with none of the excluded lights
+ * a Bron-Kerbosch search over the compatibility graph, pivoting on the light with the most compatible candidates
+ * returns false when out of memory
+ */
+static bool find_maximal_groups(const uint32_t* compatible, MaximalGroups* found, uint32_t group, uint32_t candidates, uint32_t excluded)
+{
+  if (candidates == 0 && excluded == 0)
+  {
+    if (found->count == found->capacity)
+    {
+      int capacity = found->capacity > 0 ? found->capacity * 2 : 64;
+      uint32_t* groups = realloc(found->groups, capacity * sizeof(uint32_t));
+      if (groups == NULL)
+      {
+        return false;
+      }
+      found->groups = groups;
+      found->capacity = capacity;
+    }
+    found->groups[found->count] = group;
+    found->count += 1;
+    return true;
+  }
+
+  // every maximal group holds the pivot or a light that is not compatible with it
+  int pivot = -1, pivot_count = -1;
+  for (uint32_t lights = candidates | excluded; lights != 0; lights &= lights - 1)
+  {
+    int light = __builtin_ctz(lights);
+    int count = __builtin_popcount(candidates & compatible[light]);
+    if (count > pivot_count)
+    {
+      pivot = light;
+      pivot_count = count;
+    }
+  }
+  for (uint32_t lights = candidates & ~compatible[pivot]; lights != 0; lights &= lights - 1)
+  {
+    int light = __builtin_ctz(lights);
+    uint32_t bit = 1u << light;
+    if (!find_maximal_groups(compatible, found, group | bit, candidates & compatible[light], excluded & compatible[light]))
+    {
+      return false;
+    }
+    candidates &= ~bit;
+    excluded |= bit;
+  }
+  return true;
+}
+
+
+/*
+ * compute_tables(Topology* topology)
+ *
+ * compute the conflict tables of the lights of the topology
+ * returns false when out of memory
+ */
+static bool compute_tables(Topology* topology)
+{
+  int num_lights = topology->num_lights;
+  const Light* lights = topology->lights;
+
+  // the compatibility matrix: two lights are compatible when their paths share no section
+  uint32_t* compatible = calloc(num_lights > 0 ? num_lights : 1, sizeof(uint32_t));
+  if (compatible == NULL)
+  {
+    return false;
+  }
+  topology->owned_compatible = compatible;
+  for (int i = 0; i < num_lights; i++)
+  {
+    for (int j = 0; j < num_lights; j++)
+    {
+      if (i != j && (lights[i].sections & lights[j].sections) == 0)
+      {
+        compatible[i] |= 1u << j;
+      }
+    }
+  }
+  topology->tables.compatible = compatible;
+
+  uint32_t all = num_lights == 32 ? ~0u : (1u << num_lights) - 1;
+  MaximalGroups found = {NULL, 0, 0};
+  if (!find_maximal_groups(compatible, &found, 0, all, 0))
+  {
+    free(found.groups);
+    return false;
+  }
+  topology->owned_maximal_groups = found.groups;
+  topology->tables.maximal_groups = found.groups;
+  topology->tables.num_maximal_groups = found.count;
+
+  if (num_lights > MAX_TABLE_LIGHTS)
+  {
+    topology->tables.best_groups = NULL;
+    return true;
+  }
+
+  uint32_t num_sets = 1u << num_lights;
+  uint16_t* best = malloc(num_sets * sizeof(uint16_t));
+  bool* set_compatible = malloc(num_sets * sizeof(bool));
+  SectionMask* set_sections = malloc(num_sets * sizeof(SectionMask));
+  if (best == NULL || set_compatible == NULL || set_sections == NULL)
+  {
+    free(best);
+    free(set_compatible);
+    free(set_sections);
+    return false;
+  }
+
+  // every set of lights that can be green together, built up from the set without its highest light
+  set_compatible[0] = true;
+  set_sections[0] = 0;
+  for (uint32_t set = 1; set < num_sets; set++)
+  {
+    int highest = 31 - __builtin_clz(set);
+    uint32_t rest = set & ~(1u << highest);
+    set_compatible[set] = set_compatible[rest] && (rest & ~compatible[highest]) == 0;
+    set_sections[set] = set_sections[rest] | lights[highest].sections;
+  }
+
+  // the best group out of every set: the largest compatible subset,
+  //   and of those the one that uses the most sections, so lights with long paths are not passed over
+  best[0] = 0;
+  for (uint32_t set = 1; set < num_sets; set++)
+  {
+    best[set] = set_compatible[set] ? set : 0;
+    if (best[set] != 0)
+    {
+      continue;
+    }
+    for (int i = 0; i < num_lights; i++)
+    {
+      if (set & (1u << i))
+      {
+        uint32_t candidate = best[set & ~(1u << i)];
+        int size = __builtin_popcount(candidate), best_size = __builtin_popcount(best[set]);
+        int used = __builtin_popcount(set_sections[candidate]), best_used = __builtin_popcount(set_sections[best[set]]);
+        if (size > best_size || (size == best_size && used > best_used))
+        {
+          best[set] = candidate;
+        }
+      }
+    }
+  }
+  free(set_compatible);
+  free(set_sections);
+  topology->owned_best_groups = best;
+  topology->tables.best_groups = best;
+  return true;
+}
+
+
+bool init_topology(Topology* topology, int num_approaches, int num_lanes, int num_sections,
+  const Light* lights, int num_lights, const TopologyTables* tables)
+{
+  memset(topology, 0, sizeof(Topology));
+  if (num_approaches <= 0 || num_lanes <= 0 || num_lights <= 0)
+  {
+    log_error("(Topology):\t Need at least one approach, lane and light\n");
+    return false;
+  }
+  if (num_sections <= 0 || num_sections > MAX_SECTIONS)
+  {
+    log_error("(Topology):\t The number of sections has to be between 1 and %d\n", MAX_SECTIONS);
+    return false;
+  }
+  if (num_lights > MAX_LIGHTS)
+  {
+    log_error("(Topology):\t At most %d lights are supported, got %d\n", MAX_LIGHTS, num_lights);
+    return false;
+  }
+
+  topology->num_approaches = num_approaches;
+  topology->num_lanes = num_lanes;
+  topology->num_sections = num_sections;
+  topology->num_lights = num_lights;
+  topology->lights = malloc(num_lights * sizeof(Light));
+  topology->lane_lights = malloc(num_approaches * num_lanes * sizeof(int));
+  if (topology->lights == NULL || topology->lane_lights == NULL)
+  {
+    log_error("(Topology):\t Out of memory\n");
+    free_topology(topology);
+    return false;
+  }
+  memcpy(topology->lights, lights, num_lights * sizeof(Light));
+
+  // look up the light of every lane, a lane has at most one light
+  for (int i = 0; i < num_approaches * num_lanes; i++)
+  {
+    topology->lane_lights[i] = -1;
+  }
+  SectionMask valid_sections = num_sections == 32 ? ~(SectionMask)0 : ((SectionMask)1 << num_sections) - 1;
+  for (int i = 0; i < num_lights; i++)
+  {
+    const Light* light = &lights[i];
+    if (light->side < 0 || light->side >= num_approaches || light->direction < 0 || light->direction >= num_lanes)
+    {
+      log_error("(Topology):\t Light %d: invalid lane %d / %d\n", i, light->side, light->direction);
+      free_topology(topology);
+      return false;
+    }
+    if (light->sections == 0 || (light->sections & ~valid_sections) != 0)
+    {
+      log_error("(Topology):\t Light %d / %d: sections have to be between 1 and %d\n", light->side, light->direction, num_sections);
+      free_topology(topology);
+      return false;
+    }
+    int* lane_light = &topology->lane_lights[light->side * num_lanes + light->direction];
+    if (*lane_light >= 0)
+    {
+      log_error("(Topology):\t Lane %d / %d has more than one light\n", light->side, light->direction);
+      free_topology(topology);
+      return false;
+    }
+    *lane_light = i;
+  }
+
+  if (tables != NULL)
+  {
+    topology->tables = *tables;
+    return true;
+  }
+  if (!compute_tables(topology))
+  {
+    log_error("(Topology):\t Out of memory\n");
+    free_topology(topology);
+    return false;
+  }
+  return true;
+}
+
+
+/*
+ * parse_count(const char* line, const char* keyword, int* count)
+ *
+ * parse a line "<keyword> <count>", returns false when the line is not of that form
+ */
+static bool parse_count(const char* line, const char* keyword, int* count)
+{
+  size_t length = strlen(keyword);
+  if (strncmp(line, keyword, length) != 0 || (line[length] != ' ' && line[length] != '\t'))
+  {
+    return false;
+  }
+  char* end;
+  long value = strtol(line + length, &end, 10);
+  while (*end == ' ' || *end == '\t' || *end == '\r' || *end == '\n')
+  {
+    end++;
+  }
+  if (*end != '\0' || value <= 0 || value > 1024)
+  {
+    return false;
+  }
+  *count = (int)value;
+  return true;
+}
+
+
+/*
+ * parse_light(const char* line, Light* light)
+ *
+ * parse a line "light <approach> <lane> <section> [<section> ...]", returns false when the line is not of that form
+ */
+static bool parse_light(const char* line, Light* light)
+{
+  if (strncmp(line, "light", 5) != 0 || (line[5] != ' ' && line[5] != '\t'))
+  {
+    return false;
+  }
+  const char* position = line + 5;
+  long values[2 + MAX_SECTIONS + 1];
+  int count = 0;
+  while (true)
+  {
+    char* end;
+    long value = strtol(position, &end, 10);
+    if (end == position)
+    {
+      break;
+    }
+    if (count == sizeof(values)/sizeof(values[0]))
+    {
+      return false;
+    }
+    values[count] = value;
+    count += 1;
+    position = end;
+  }
+  while (*position == ' ' || *position == '\t' || *position == '\r' || *position == '\n')
+  {
+    position++;
+  }
+  if (*position != '\0' || count < 3)
+  {
+    return false;
+  }
+  light->side = values[0];
+  light->direction = values[1];
+  light->sections = 0;
+  for (int i = 2; i < count; i++)
+  {
+    if (values[i] < 1 || values[i] > MAX_SECTIONS)
+    {
+      return false;
+    }
+    light->sections |= SECTION(values[i]);
+  }
+  return true;
+}
+
+
+bool load_topology(Topology* topology, const char* path)
+{
+  FILE* file = fopen(path, "r");
+  if (file == NULL)
+  {
+    log_error("(Topology):\t Cannot open %s\n", path);
+    return false;
+  }
+
+  int num_approaches = 0, num_lanes = 0, num_sections = 0, num_lights = 0;
+  Light lights[MAX_LIGHTS];
+  char* line_buffer = NULL;
+  size_t line_size = 0;
+  long line_number = 0;
+  bool valid = true;
+  while (valid && getline(&line_buffer, &line_size, file) >= 0)
+  {
+    line_number += 1;
+    char* line = line_buffer;
+    while (*line == ' ' || *line == '\t')
+    {
+      line++;
+    }
+    if (*line == '#' || *line == '\n' || *line == '\r' || *line == '\0')
+    {
+      continue;
+    }
+    if (parse_count(line, "approaches", &num_approaches) || parse_count(line, "lanes", &num_lanes)
+      || parse_count(line, "sections", &num_sections))
+    {
+      continue;
+    }
+    if (num_lights == MAX_LIGHTS)
+    {
+      log_error("(Topology):\t %s:%ld: at most %d lights are supported\n", path, line_number, MAX_LIGHTS);
+      valid = false;
+    }
+    else if (!parse_light(line, &lights[num_lights]))
+    {
+      log_error("(Topology):\t %s:%ld: expected \"approaches|lanes|sections <count>\" or \"light <approach> <lane> <section>...\"\n",
+        path, line_number);
+      valid = false;
+    }
+    else
+    {
+      num_lights += 1;
+    }
+  }
+  free(line_buffer);
+  fclose(file);
+  if (!valid)
+  {
+    return false;
+  }
+  return init_topology(topology, num_approaches, num_lanes, num_sections, lights, num_lights, NULL);
+}
+
+
+void free_topology(Topology* topology)
+{
+  free(topology->lights);
+  free(topology->lane_lights);
+  free(topology->owned_compatible);
+  free(topology->owned_maximal_groups);
+  free(topology->owned_best_groups);
+  memset(topology, 0, sizeof(Topology));
+}
+
+
+int topology_light(const Topology* topology, int approach, int lane)
+{
+  if (approach < 0 || approach >= topology->num_approaches || lane < 0 || lane >= topology->num_lanes)
+  {
+    return -1;
+  }
+  return topology->lane_lights[approach * topology->num_lanes + lane];
+}
+
+
+uint32_t best_group(const Topology* topology, uint32_t ready)
+{
+  if (topology->tables.best_groups != NULL)
+  {
+    return topology->tables.best_groups[ready];
+  }
+  // every group that can be green together is part of a maximal group,
+  //   so the best group is the largest overlap of the ready lights with a maximal group
+  uint32_t best = 0;
+  int best_size = 0, best_used = 0;
+  for (int i = 0; i < topology->tables.num_maximal_groups; i++)
+  {
+    uint32_t candidate = topology->tables.maximal_groups[i] & ready;
+    int size = __builtin_popcount(candidate);
+    if (size < best_size)
+    {
+      continue;
+    }
+    SectionMask sections = 0;
+    for (uint32_t lights = candidate; lights != 0; lights &= lights - 1)
+    {
+      sections |= topology->lights[__builtin_ctz(lights)].sections;
+    }
+    int used = __builtin_popcount(sections);
+    if (size > best_size || used > best_used)
+    {
+      best = candidate;
+      best_size = size;
+      best_used = used;
+    }
+  }
+  return best;
+}
+
+
+uint32_t busiest_group(const Topology* topology, uint32_t ready, const size_t* cars)
+{
+  // every largest group is the overlap of the ready lights with a maximal group, so only those are compared
+  int size = __builtin_popcount(best_group(topology, ready));
+  uint32_t best = 0;
+  size_t best_cars = 0;
+  for (int i = 0; i < topology->tables.num_maximal_groups; i++)
+  {
+    uint32_t candidate = topology->tables.maximal_groups[i] & ready;
+    if (__builtin_popcount(candidate) != size)
+    {
+      continue;
+    }
+    size_t waiting = 0;
+    for (uint32_t lights = candidate; lights != 0; lights &= lights - 1)
+    {
+      waiting += cars[__builtin_ctz(lights)];
+    }
+    if (best == 0 || waiting > best_cars || (waiting == best_cars && candidate > best))
+    {
+      best = candidate;
+      best_cars = waiting;
+    }
+  }
+  return best;
+}
+
+
+uint32_t weighted_group(const Topology* topology, uint32_t ready, const double* weights)
+{
+  uint32_t best = 0;
+  double best_weight = 0;
+  for (int i = 0; i < topology->tables.num_maximal_groups; i++)
+  {
+    uint32_t candidate = topology->tables.maximal_groups[i] & ready;
+    double weight = 0;
+    for (uint32_t lights = candidate; lights != 0; lights &= lights - 1)
+    {
+      weight += weights[__builtin_ctz(lights)];
+    }
+    if (weight > best_weight || (weight == best_weight && __builtin_popcount(candidate) > __builtin_popcount(best)))
+    {
+      best = candidate;
+      best_weight = weight;
+    }
+  }
+  return best;
+}
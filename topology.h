@@ -0,0 +1,123 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "lights.h"
+
+// lights and sections are kept in bitmasks of 32 bits
+#define MAX_LIGHTS 32
+#define MAX_SECTIONS 32
+
+// the table of best groups has an entry for every set of lights, so it is only used up to this many lights
+#define MAX_TABLE_LIGHTS 16
+
+/*
+ * TopologyTables
+ *
+ * The conflict relation between the lights of a topology, as generated into conflicts.h for the default geometry
+ * compatible: bit j of compatible[i] is set when lights i and j share no section
+ * maximal_groups: every group of lights that can be green together and that no other light can join
+ * best_groups: for every set of lights, the largest group of them that can be green together,
+ *   or NULL when there are more than MAX_TABLE_LIGHTS lights
+ */
+typedef struct
+{
+  const uint32_t* compatible;
+  const uint32_t* maximal_groups;
+  int num_maximal_groups;
+  const uint16_t* best_groups;
+} TopologyTables;
+
+/*
+ * Topology
+ *
+ * The layout of an intersection: the approaches (sides) it has, the number of entry lanes (directions) per approach,
+ *   the sections it is divided in, and the traffic lights with the sections their paths cross
+ * In a loaded topology the side of a light is the index of its approach and the direction the index of its lane
+ */
+typedef struct
+{
+  int num_approaches;
+  int num_lanes;
+  int num_sections;
+  int num_lights;
+  Light* lights;
+  // the index of the light for each lane, lane_lights[approach * num_lanes + lane], or -1 when the lane has none
+  int* lane_lights;
+  TopologyTables tables;
+  // the tables that were computed for this topology, freed by free_topology
+  uint32_t* owned_compatible;
+  uint32_t* owned_maximal_groups;
+  uint16_t* owned_best_groups;
+} Topology;
+
+/*
+ * init_topology(Topology* topology, int num_approaches, int num_lanes, int num_sections,
+ *   const Light* lights, int num_lights, const TopologyTables* tables)
+ *
+ * initialize a topology with a copy of the lights
+ * tables are the precomputed conflict tables of the lights, or NULL to compute them
+ * returns false (and logs the reason) when the topology is invalid or out of memory
+ */
+bool init_topology(Topology* topology, int num_approaches, int num_lanes, int num_sections,
+  const Light* lights, int num_lights, const TopologyTables* tables);
+
+/*
+ * load_topology(Topology* topology, const char* path)
+ *
+ * load a topology from a description file with lines
+ *   approaches <count>
+ *   lanes <count per approach>
+ *   sections <count>
+ *   light <approach> <lane> <section> [<section> ...]
+ * where sections are numbered from 1, and empty lines and lines starting with '#' are ignored
+ * the conflict tables are computed from the lights
+ * returns false (and logs the reason) when the file cannot be read or is invalid
+ */
+bool load_topology(Topology* topology, const char* path);
+
+/*
+ * free_topology(Topology* topology)
+ *
+ * free the lights, the lane table and the computed tables of the topology
+ */
+void free_topology(Topology* topology);
+
+/*
+ * topology_light(const Topology* topology, int approach, int lane)
+ *
+ * get the index of the light for the lane of the approach, or -1 when there is none
+ */
+int topology_light(const Topology* topology, int approach, int lane);
+
+/*
+ * best_group(const Topology* topology, uint32_t ready)
+ *
+ * get the largest group out of the ready lights (bit i for light i) that can be green together
+ * a table lookup for small topologies, otherwise a search over the maximal groups
+ * ties are broken in favour of the group whose paths cross the most sections
+ */
+uint32_t best_group(const Topology* topology, uint32_t ready);
+
+/*
+ * busiest_group(const Topology* topology, uint32_t ready, const size_t* cars)
+ *
+ * get the largest group out of the ready lights that can be green together, and of those the one
+ *   with the most cars waiting, cars[i] being the number of cars waiting at light i
+ * ties are broken in favour of the highest group (as a bitmask), so the choice does not depend on the tables
+ */
+uint32_t busiest_group(const Topology* topology, uint32_t ready, const size_t* cars);
+
+/*
+ * weighted_group(const Topology* topology, uint32_t ready, const double* weights)
+ *
+ * get the group out of the ready lights that can be green together with the largest total weight,
+ *   weights[i] being the weight of light i, with ties broken in favour of the larger group
+ * a search over the maximal groups, which contain every group that can be green together
+ */
+uint32_t weighted_group(const Topology* topology, uint32_t ready, const double* weights);
+
+#endif